@@ -176,6 +176,13 @@ ece391_vidmap (uint8_t** screen_start)
     return 0;
 }
 
+int32_t
+ece391_mmap (int32_t fd, uint8_t** start)
+{
+    /* callers fall back to ece391_read */
+    return -1;
+}
+
 int32_t 
 ece391_read (int32_t fd, void* buf, int32_t nbytes)
 {
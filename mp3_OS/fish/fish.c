@@ -79,9 +79,10 @@ void
 add_frames(uint8_t *f0, uint8_t *f1, int32_t rtc_fd)
 {
     int32_t row, col, offset = 40, eof0 = 0, eof1 = 0, num_bytes;
-    int32_t fd0, fd1;
+    int32_t fd0, fd1, len0, len1, pos0 = 0, pos1 = 0;
     struct mp1_blink_struct blink_struct;
     uint8_t c0 = '0', c1 = '0';
+    uint8_t *map0 = NULL, *map1 = NULL;
 
     blink_struct.on_length = 15;
     blink_struct.off_length = 15;
@@ -95,12 +96,21 @@ add_frames(uint8_t *f0, uint8_t *f1, int32_t rtc_fd)
         ece391_halt(-1);
     }
 
+    /* scan the frames in place instead of one read call per byte */
+    len0 = ece391_mmap(fd0, &map0);
+    len1 = ece391_mmap(fd1, &map1);
+
     while(eof0 == 0 || eof1 == 0) {
         col = 0;
         while(1) {
 
             if(c0 != '\n') {
-                num_bytes = ece391_read(fd0, &c0, 1);
+                if(len0 >= 0) {
+                    num_bytes = (pos0 < len0) ? 1 : 0;
+                    if(num_bytes) c0 = map0[pos0++];
+                } else {
+                    num_bytes = ece391_read(fd0, &c0, 1);
+                }
                 if(num_bytes == 0) {
                     c0 = '\n';
                     eof0 = 1;
@@ -108,7 +118,12 @@ add_frames(uint8_t *f0, uint8_t *f1, int32_t rtc_fd)
             }
 
             if(c1 != '\n') {
-                num_bytes = ece391_read(fd1, &c1, 1);
+                if(len1 >= 0) {
+                    num_bytes = (pos1 < len1) ? 1 : 0;
+                    if(num_bytes) c1 = map1[pos1++];
+                } else {
+                    num_bytes = ece391_read(fd1, &c1, 1);
+                }
                 if(num_bytes == 0) {
                     c1 = '\n';
                     eof1 = 1;
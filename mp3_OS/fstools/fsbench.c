@@ -0,0 +1,234 @@
+/* fsbench.c - run the kernel's file system code on the host against an
+ * image and time name lookup, read_data and block allocation
+ *
+ *   fsbench [-d] [-r rounds] image
+ *
+ * -d also mounts the image as an ATA disk behind the buffer cache and
+ * times the same reads cold and warm.  The CRC32C paths are timed on their
+ * own, and on an image built with mkfs391 -c the reads are timed again
+ * with verify-on-read off.  Files an image built with -z compresses are
+ * read through the cache of decompressed blocks.
+ */
+
+#include "host_lib.h"
+#include "file_system.h"
+#include "bcache.h"
+#include "crc32c.h"
+
+#define BENCH_CHUNK         65536       /* bytes per read_data call */
+#define BENCH_WRITE_FILES   32
+#define BENCH_WRITE_SIZE    (256 * 1024)
+#define BENCH_APPEND        4096
+#define BENCH_EXTRA         (64 << 20)  /* room for the write benchmark */
+
+extern dentry_t* dentry_ptr;
+extern uint32_t dir_num;
+extern uint32_t bitmap_counter;
+extern uint32_t db_num;
+
+static uint8_t chunk[BENCH_CHUNK];
+static uint32_t rounds = 100;
+
+static int32_t atoi_u(const int8_t* s)
+{
+    int32_t v = 0;
+    while (*s >= '0' && *s <= '9')
+        v = v * 10 + (*s++ - '0');
+    return v;
+}
+
+/* rate of n operations in us microseconds, as an integer per second */
+static uint32_t per_sec(uint32_t n, uint32_t us)
+{
+    if (us == 0)
+        us = 1;
+    return (uint32_t)((unsigned long long)n * 1000000ULL / us);
+}
+
+static void bench_lookup(void)
+{
+    uint32_t i, r, t, n = 0, hashed, linear;
+    uint8_t path[PATH_MAX_SIZE];
+    dentry_t d, e;
+
+    t = host_time_us();
+    for (r = 0; r < rounds * 100; r++)
+        for (i = 0; i < dir_num; i++, n++)
+            dentry_lookup_hashed(dentry_ptr[i].file_name);
+    hashed = host_time_us() - t;
+    t = host_time_us();
+    for (r = 0; r < rounds * 100; r++)
+        for (i = 0; i < dir_num; i++)
+            dentry_lookup_linear(dentry_ptr[i].file_name);
+    linear = host_time_us() - t;
+    printf((int8_t*)"lookup   %u root names: hashed %u/s, linear %u/s\n",
+           dir_num, per_sec(n, hashed), per_sec(n, linear));
+
+    if (path_lookup((uint8_t*)"gen", &d) == -1 || d.file_type != 1)
+        return;
+    memcpy(path, "gen/", 4);
+    path[4 + FILENAME_MAX_SIZE] = '\0';
+    n = 0;
+    t = host_time_us();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; dir_entry_by_index(d.inode_num, i, &e) == 0; i++, n++) {
+            memcpy(path + 4, e.file_name, FILENAME_MAX_SIZE);
+            path_lookup(path, &e);
+        }
+    }
+    printf((int8_t*)"lookup   gen/<name>: %u paths/s\n", per_sec(n, host_time_us() - t));
+}
+
+/* read every regular file, in the root and in gen, end to end */
+static uint32_t read_all(uint32_t* bytes)
+{
+    uint32_t i, off, n = 0;
+    int32_t got;
+    dentry_t d, g;
+    *bytes = 0;
+    for (i = 0; read_dentry_by_index(i, &d) == 0; i++) {
+        if (d.file_type != 2 && d.file_type != FILE_TYPE_COMPRESSED)
+            continue;
+        for (off = 0; (got = read_data(d.inode_num, off, chunk, BENCH_CHUNK)) > 0; off += got)
+            *bytes += got;
+        n++;
+    }
+    if (path_lookup((uint8_t*)"gen", &g) == 0 && g.file_type == 1) {
+        for (i = 0; dir_entry_by_index(g.inode_num, i, &d) == 0; i++) {
+            for (off = 0; (got = read_data(d.inode_num, off, chunk, BENCH_CHUNK)) > 0; off += got)
+                *bytes += got;
+            n++;
+        }
+    }
+    return n;
+}
+
+static void bench_read(const int8_t* label)
+{
+    uint32_t r, t, us, bytes = 0, total = 0, files = 0;
+    t = host_time_us();
+    for (r = 0; r < rounds; r++) {
+        files = read_all(&bytes);
+        total += bytes / 1024;
+    }
+    us = host_time_us() - t;
+    printf((int8_t*)"read     %s %u files, %u KB each round: %u MB/s\n",
+           label, files, bytes / 1024, per_sec(total / 1024, us));
+}
+
+static void bench_crc(void)
+{
+    uint32_t r, t, n, sw, hw = 0, crc = 0;
+    crc32c_init();
+    memset(chunk, 0x5A, BENCH_CHUNK);
+    n = rounds * 64;
+    t = host_time_us();
+    for (r = 0; r < n; r++)
+        crc = crc32c_sw(crc, chunk, BENCH_CHUNK);
+    sw = host_time_us() - t;
+    if (crc32c_sse42) {
+        t = host_time_us();
+        for (r = 0; r < n; r++)
+            crc = crc32c_hw(crc, chunk, BENCH_CHUNK);
+        hw = host_time_us() - t;
+    }
+    printf((int8_t*)"crc32c   slicing-by-8 %u MB/s, sse4.2 %u MB/s (%x)\n",
+           per_sec(n / 16, sw), crc32c_sse42 ? per_sec(n / 16, hw) : 0, crc);
+}
+
+static void bench_write(void)
+{
+    uint8_t path[PATH_MAX_SIZE] = "bench/w";
+    uint32_t i, created, appends = 0, off, t, us, blocks, before = bitmap_counter;
+    dentry_t d;
+    memset(chunk, 'w', BENCH_APPEND);
+    if (dir_write(0, "bench", DIR_WRITE_MKDIR) == -1) {
+        printf((int8_t*)"write    cannot create bench/\n");
+        return;
+    }
+    /* append until BENCH_WRITE_FILES files are full or the image is */
+    t = host_time_us();
+    for (created = 0; created < BENCH_WRITE_FILES; created++) {
+        path[7] = 'a' + created % 26;
+        path[8] = 'a' + created / 26;
+        if (dir_write(0, path, 0) == -1 || path_lookup(path, &d) == -1)
+            break;
+        for (off = 0; off < BENCH_WRITE_SIZE; off += BENCH_APPEND, appends++)
+            if (write_data(d.inode_num, off, chunk, BENCH_APPEND) != BENCH_APPEND)
+                break;
+        if (off < BENCH_WRITE_SIZE) {
+            created++;
+            break;
+        }
+    }
+    us = host_time_us() - t;
+    blocks = bitmap_counter - before;
+    printf((int8_t*)"write    %u appends of %u B into %u files: %u appends/s, %u blocks/s (%u of %u blocks in use)\n",
+           appends, BENCH_APPEND, created, per_sec(appends, us), per_sec(blocks, us), bitmap_counter, db_num);
+    t = host_time_us();
+    for (i = 0; i < created; i++) {
+        path[7] = 'a' + i % 26;
+        path[8] = 'a' + i / 26;
+        dir_write(0, path, DIR_WRITE_REMOVE);
+    }
+    dir_write(0, "bench", DIR_WRITE_REMOVE);
+    printf((int8_t*)"remove   %u blocks freed in %u us, %u blocks in use again\n",
+           blocks, host_time_us() - t, bitmap_counter);
+}
+
+int main(int argc, char** argv)
+{
+    uint8_t* img;
+    uint32_t size, disk = 0, bytes;
+    int32_t i;
+    const int8_t* path = NULL;
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-d", 3) == 0)
+            disk = 1;
+        else if (strncmp(argv[i], "-r", 3) == 0 && i + 1 < argc)
+            rounds = atoi_u((int8_t*)argv[++i]);
+        else
+            path = (int8_t*)argv[i];
+    }
+    if (path == NULL || rounds == 0) {
+        printf((int8_t*)"usage: fsbench [-d] [-r rounds] image\n");
+        return 1;
+    }
+
+    img = host_load_image(path, BENCH_EXTRA, &size);
+    file_system_init((uint32_t)img);
+    printf((int8_t*)"%s: %u bytes, %u root entries, %u rounds\n", path, size, dir_num, rounds);
+    bench_lookup();
+    bench_crc();
+    bench_read((int8_t*)"memory");
+    if (lz_misses != 0)
+        printf((int8_t*)"lz       %u decompressed block hits, %u misses over %u slots\n",
+               lz_hits, lz_misses, LZ_CACHE_SIZE);
+    if (fs_crc_on) {
+        fs_crc_verify = 0;
+        bench_read((int8_t*)"memory, no verify");
+        fs_crc_verify = 1;
+    }
+    bench_write();
+
+    if (!disk)
+        return 0;
+    host_disk_attach(img, size);
+    if (ata_init(ATA_MASTER) == -1 || file_system_init_disk() == -1) {
+        printf((int8_t*)"disk     image not accepted by file_system_init_disk\n");
+        return 1;
+    }
+    read_all(&bytes);
+    printf((int8_t*)"disk     cold pass: %u KB, %u misses, %u disk reads\n",
+           bytes / 1024, bcache_misses, host_disk_reads);
+    bcache_hits = bcache_misses = 0;
+    bench_read((int8_t*)"cached");
+    if (fs_crc_on) {
+        fs_crc_verify = 0;
+        bench_read((int8_t*)"cached, no verify");
+        fs_crc_verify = 1;
+    }
+    printf((int8_t*)"disk     %u hits, %u misses over %u buffers\n", bcache_hits, bcache_misses, BCACHE_SIZE);
+    return 0;
+}
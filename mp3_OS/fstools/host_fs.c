@@ -0,0 +1,6 @@
+/* host_fs.c - the kernel's file system, buffer cache and checksums, built for the host */
+
+#include "host_lib.h"
+#include "file_system.c"
+#include "bcache.c"
+#include "crc32c.c"
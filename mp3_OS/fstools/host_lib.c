@@ -0,0 +1,49 @@
+/* host_lib.c - the kernel services file_system.c calls, for the host build:
+ * one process, one terminal, and an ATA disk backed by memory */
+
+#include "host_lib.h"
+#include "file_system.h"
+#include "ata.h"
+
+static process_control_block_t host_pcb;
+static uint8_t* host_disk;
+uint32_t host_disk_reads;
+uint32_t host_disk_writes;
+uint32_t ata_sectors;
+
+int32_t get_pid(void) { return 0; }
+process_control_block_t* get_pcb_by_pid(int32_t pid) { return &host_pcb; }
+int32_t get_curr_terminal(void) { return 0; }
+void screen_backspace(void) { }
+void putc(uint8_t c) { printf((int8_t*)"%c", c); }
+
+void host_disk_attach(uint8_t* disk, uint32_t size)
+{
+    host_disk = disk;
+    ata_sectors = size / ATA_SECTOR_SIZE;
+    host_disk_reads = 0;
+    host_disk_writes = 0;
+}
+
+int32_t ata_init(uint32_t drive)
+{
+    return (host_disk != NULL && drive == ATA_MASTER) ? 0 : -1;
+}
+
+int32_t ata_read(uint32_t lba, uint32_t count, void* buf)
+{
+    if (host_disk == NULL || lba + count > ata_sectors)
+        return -1;
+    memcpy(buf, host_disk + lba * ATA_SECTOR_SIZE, count * ATA_SECTOR_SIZE);
+    host_disk_reads++;
+    return 0;
+}
+
+int32_t ata_write(uint32_t lba, uint32_t count, const void* buf)
+{
+    if (host_disk == NULL || lba + count > ata_sectors)
+        return -1;
+    memcpy(host_disk + lba * ATA_SECTOR_SIZE, buf, count * ATA_SECTOR_SIZE);
+    host_disk_writes++;
+    return 0;
+}
@@ -0,0 +1,40 @@
+/* host_lib.h - lib.h for building the file system on a Linux host
+ *
+ * Pulls in the kernel's lib.h, then replaces what cannot run in user space
+ * (interrupt flag handling) and the string functions whose kernel
+ * prototypes take uint32_t where libc takes size_t.  Every host translation
+ * unit that sees kernel headers includes this first.
+ */
+
+#ifndef _HOST_LIB_H
+#define _HOST_LIB_H
+
+#include "lib.h"
+
+#undef cli
+#undef sti
+#undef cli_and_save
+#undef restore_flags
+#define cli()                   do { } while (0)
+#define sti()                   do { } while (0)
+#define cli_and_save(flags)     do { (flags) = 0; } while (0)
+#define restore_flags(flags)    do { (void)(flags); } while (0)
+
+#define memcpy(d, s, n)         __builtin_memcpy((d), (s), (unsigned long)(n))
+#define memset(s, c, n)         __builtin_memset((s), (c), (unsigned long)(n))
+#define memmove(d, s, n)        __builtin_memmove((d), (s), (unsigned long)(n))
+#define strlen(s)               ((uint32_t)__builtin_strlen((const char*)(s)))
+#define strncmp(a, b, n)        __builtin_strncmp((const char*)(a), (const char*)(b), (unsigned long)(n))
+#define strncpy(d, s, n)        ((int8_t*)__builtin_strncpy((char*)(d), (const char*)(s), (unsigned long)(n)))
+#define puts(s)                 printf((int8_t*)"%s", (s))
+
+/* libc side, host_os.c */
+uint8_t* host_load_image(const int8_t* path, uint32_t extra, uint32_t* size);
+uint32_t host_time_us(void);
+
+/* kernel side, host_lib.c */
+void     host_disk_attach(uint8_t* disk, uint32_t size);
+extern uint32_t host_disk_reads;
+extern uint32_t host_disk_writes;
+
+#endif /* _HOST_LIB_H */
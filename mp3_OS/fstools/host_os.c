@@ -0,0 +1,46 @@
+/* host_os.c - the libc half of the host build; sees no kernel headers,
+ * so the kernel's printf and string prototypes do not clash with libc's */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* file_system.c keeps addresses in uint32_t, so the image must sit below 4GB */
+#ifndef MAP_32BIT
+#define MAP_32BIT 0
+#endif
+
+unsigned char* host_load_image(const char* path, unsigned int extra, unsigned int* size)
+{
+    struct stat st;
+    unsigned char* img;
+    FILE* f;
+
+    if (stat(path, &st) != 0 || (f = fopen(path, "rb")) == NULL) {
+        fprintf(stderr, "cannot open %s\n", path);
+        exit(1);
+    }
+    /* extra room past the image lets write benchmarks grow it */
+    img = mmap(NULL, st.st_size + extra, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (img == MAP_FAILED || (unsigned long)img + st.st_size + extra > 0xFFFFFFFFUL) {
+        fprintf(stderr, "cannot map %s below 4GB\n", path);
+        exit(1);
+    }
+    if (fread(img, 1, st.st_size, f) != (size_t)st.st_size) {
+        fprintf(stderr, "cannot read %s\n", path);
+        exit(1);
+    }
+    fclose(f);
+    *size = st.st_size;
+    return img;
+}
+
+unsigned int host_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned int)(ts.tv_sec * 1000000UL + ts.tv_nsec / 1000);
+}
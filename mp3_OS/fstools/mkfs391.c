@@ -0,0 +1,534 @@
+/* mkfs391.c - build a file system image for the ECE391 OS on the host
+ *
+ * The layout is the one student-distrib/file_system.c reads: a boot block
+ * with the root directory, the inodes, then the data blocks.  Beyond copying
+ * a directory in, it can generate many files, one large file, and scatter
+ * the data blocks, so lookups, reads and allocation can be measured on
+ * images much bigger than filesys_img.  -c adds a table with the CRC32C of
+ * every data block, which the kernel verifies reads and scrubs against.
+ * -z stores every regular file that shrinks as a compressed file, each 4kb
+ * of it an LZ4 block of its own.
+ *
+ *   mkfs391 [-2] [-F] [-c] [-z] [-o image] [-i inodes] [-b free_blocks]
+ *           [-n files] [-s file_size] [-l large_size] [-S seed] [srcdir]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/* on-image layout, mirrors file_system.h */
+#define BLOCK_SIZE          4096
+#define FILENAME_MAX_SIZE   32
+#define DENTRY_SIZE         64
+#define DENTRY_LIST_SIZE    63
+#define INODE_DATA_BLOCKS   1023        /* version 1 inode: one 4kb block */
+#define FS_MAGIC_V2         0x32534633
+#define INODE2_SIZE         64
+#define INODE2_PER_BLOCK    (BLOCK_SIZE / INODE2_SIZE)
+#define INODE2_DIRECT       12
+#define BLOCK_PTRS          (BLOCK_SIZE / 4)
+#define INODE2_SINGLE_END   (INODE2_DIRECT + BLOCK_PTRS)
+#define MAX_DEPTH           8           /* PATH_MAX_DEPTH in the kernel */
+#define DB_NUM              16384       /* most data blocks the kernel tracks */
+#define INODE_NUM           1024
+#define CRC_PER_BLOCK       (BLOCK_SIZE / 4)
+#define CRC32C_POLY         0x82F63B78
+
+#define TYPE_RTC            0
+#define TYPE_DIR            1
+#define TYPE_FILE           2
+#define TYPE_COMPRESSED     3
+
+#define LZ_MAGIC            0x315A4C33  /* "3LZ1" */
+#define LZ_HEADER_SIZE      8
+#define LZ_MIN_MATCH        4
+#define LZ_LAST_LITERALS    5           /* LZ4 ends a block with this many literals */
+#define LZ_MATCH_LIMIT      12          /* and starts no match closer to the end */
+#define LZ_HASH_BITS        12
+#define LZ_MAX_OFFSET       65535
+
+typedef struct node_t {
+    char            name[FILENAME_MAX_SIZE + 1];
+    uint32_t        type;
+    uint32_t        inode;
+    uint8_t*        data;
+    uint32_t        size;
+    uint32_t        nblocks;            /* data blocks */
+    uint32_t        nmeta;              /* indirect blocks, version 2 only */
+    uint32_t*       blocks;             /* nblocks data then nmeta indirect block numbers */
+    struct node_t*  child;
+    struct node_t*  next;
+} node_t;
+
+static int      v2 = 0;
+static int      fragment = 0;
+static int      checksum = 0;
+static int      compress = 0;
+static uint32_t raw_bytes = 0, stored_bytes = 0;
+static uint32_t seed = 391;
+static uint32_t num_inodes = 0;
+static uint32_t free_blocks = 16;
+
+/* CRC32C of one block, bit at a time; the kernel's table driven version must agree */
+static uint32_t crc32c(const uint8_t* buf, uint32_t len)
+{
+    uint32_t crc = 0xFFFFFFFF, i;
+    while (len--) {
+        crc ^= *buf++;
+        for (i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+    }
+    return ~crc;
+}
+
+static void put32(uint8_t* p, uint32_t v);
+
+static uint32_t get32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/* an LZ4 length past the 4 bits of the token: 255s, then the rest */
+static uint32_t lz_put_length(uint8_t* dst, uint32_t len)
+{
+    uint32_t op = 0;
+    for (; len >= 255; len -= 255)
+        dst[op++] = 255;
+    dst[op++] = len;
+    return op;
+}
+
+/* one sequence: literals from anchor, then a match of mlen at offset, or no match when mlen is 0 */
+static uint32_t lz_put_sequence(uint8_t* dst, const uint8_t* lit, uint32_t nlit, uint32_t offset, uint32_t mlen)
+{
+    uint32_t op = 1;
+    uint32_t m = mlen ? mlen - LZ_MIN_MATCH : 0;
+    dst[0] = ((nlit < 15 ? nlit : 15) << 4) | (m < 15 ? m : 15);
+    if (nlit >= 15)
+        op += lz_put_length(dst + op, nlit - 15);
+    memcpy(dst + op, lit, nlit);
+    op += nlit;
+    if (mlen == 0)
+        return op;
+    dst[op++] = offset & 0xFF;
+    dst[op++] = offset >> 8;
+    if (m >= 15)
+        op += lz_put_length(dst + op, m - 15);
+    return op;
+}
+
+/* greedy LZ4 block compression with one hash table of 4 byte sequences;
+ * dst needs len + len / 255 + 16 bytes */
+static uint32_t lz_compress(const uint8_t* src, uint32_t len, uint8_t* dst)
+{
+    int32_t table[1 << LZ_HASH_BITS];
+    uint32_t ip = 0, anchor = 0, op = 0, seq, h, mlen;
+    int32_t ref;
+    memset(table, 0xFF, sizeof(table));
+    while (len > LZ_MATCH_LIMIT && ip < len - LZ_MATCH_LIMIT) {
+        seq = get32(src + ip);
+        h = (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+        ref = table[h];
+        table[h] = ip;
+        if (ref < 0 || ip - ref > LZ_MAX_OFFSET || get32(src + ref) != seq) {
+            ip++;
+            continue;
+        }
+        for (mlen = LZ_MIN_MATCH; ip + mlen < len - LZ_LAST_LITERALS && src[ref + mlen] == src[ip + mlen]; mlen++)
+            ;
+        op += lz_put_sequence(dst + op, src + anchor, ip - anchor, ip - ref, mlen);
+        ip += mlen;
+        anchor = ip;
+    }
+    return op + lz_put_sequence(dst + op, src + anchor, len - anchor, 0, 0);
+}
+
+/* store a file compressed when that makes it smaller: the header, one
+ * offset per block and the end, then the blocks, raw where LZ4 did not help */
+static void compress_node(node_t* n)
+{
+    uint32_t nblocks = (n->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t hdr = LZ_HEADER_SIZE + 4 * (nblocks + 1), pos = hdr, i, raw, len;
+    uint8_t *out, tmp[BLOCK_SIZE + BLOCK_SIZE / 255 + 16];
+
+    raw_bytes += n->size;
+    if (nblocks == 0 || (out = malloc(hdr + (size_t)nblocks * BLOCK_SIZE + 1)) == NULL) {
+        stored_bytes += n->size;
+        return;
+    }
+    put32(out, LZ_MAGIC);
+    put32(out + 4, n->size);
+    for (i = 0; i < nblocks; i++) {
+        raw = (n->size - i * BLOCK_SIZE < BLOCK_SIZE) ? n->size - i * BLOCK_SIZE : BLOCK_SIZE;
+        len = lz_compress(n->data + i * BLOCK_SIZE, raw, tmp);
+        put32(out + LZ_HEADER_SIZE + 4 * i, pos);
+        if (len < raw) {
+            memcpy(out + pos, tmp, len);
+            pos += len;
+        } else {
+            memcpy(out + pos, n->data + i * BLOCK_SIZE, raw);
+            pos += raw;
+        }
+    }
+    put32(out + LZ_HEADER_SIZE + 4 * nblocks, pos);
+    if (pos >= n->size) {
+        free(out);
+        stored_bytes += n->size;
+        return;
+    }
+    free(n->data);
+    n->data = out;
+    n->size = pos;
+    n->type = TYPE_COMPRESSED;
+    stored_bytes += pos;
+}
+
+static void compress_dir(node_t* dir)
+{
+    node_t* n;
+    for (n = dir->child; n != NULL; n = n->next) {
+        if (n->type == TYPE_DIR)
+            compress_dir(n);
+        else if (n->type == TYPE_FILE)
+            compress_node(n);
+    }
+}
+
+/* the PRNG used for generated data and fragmentation, same on every host */
+static uint32_t rnd(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xFFFFFF;
+}
+
+static void die(const char* msg, const char* arg)
+{
+    fprintf(stderr, "mkfs391: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(1);
+}
+
+static node_t* node_new(const char* name, uint32_t type)
+{
+    node_t* n = calloc(1, sizeof(node_t));
+    if (n == NULL)
+        die("out of memory", NULL);
+    /* names longer than 32 bytes are cut, as createfs does */
+    memcpy(n->name, name, strlen(name) < FILENAME_MAX_SIZE ? strlen(name) : FILENAME_MAX_SIZE);
+    n->type = type;
+    return n;
+}
+
+static void node_add(node_t* dir, node_t* n)
+{
+    node_t** link = &dir->child;
+    while (*link != NULL)
+        link = &(*link)->next;
+    *link = n;
+}
+
+static uint32_t node_count(const node_t* dir)
+{
+    uint32_t cnt = 0;
+    for (dir = dir->child; dir != NULL; dir = dir->next)
+        cnt++;
+    return cnt;
+}
+
+/* read a host directory in, subdirectories included */
+static void load_dir(node_t* dir, const char* path, int depth)
+{
+    DIR* d;
+    struct dirent* e;
+    struct stat st;
+    char full[4096];
+    node_t* n;
+    FILE* f;
+
+    if ((d = opendir(path)) == NULL)
+        die("cannot open directory", path);
+    while ((e = readdir(d)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            continue;
+        snprintf(full, sizeof(full), "%s/%s", path, e->d_name);
+        if (stat(full, &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode)) {
+            if (depth + 1 >= MAX_DEPTH)
+                die("directory nested too deep", full);
+            n = node_new(e->d_name, TYPE_DIR);
+            load_dir(n, full, depth + 1);
+        } else if (S_ISREG(st.st_mode)) {
+            n = node_new(e->d_name, TYPE_FILE);
+            n->size = st.st_size;
+            n->data = malloc(n->size + 1);
+            if ((f = fopen(full, "rb")) == NULL || fread(n->data, 1, n->size, f) != n->size)
+                die("cannot read", full);
+            fclose(f);
+        } else {
+            continue;
+        }
+        node_add(dir, n);
+    }
+    closedir(d);
+}
+
+/* text lines, so grep and cat have something to chew on */
+static node_t* gen_file(const char* name, uint32_t size, uint32_t id)
+{
+    node_t* n = node_new(name, TYPE_FILE);
+    uint32_t i = 0, line = 0;
+    char buf[64];
+    int len;
+
+    n->size = size;
+    n->data = malloc(size + 1);
+    while (i < size) {
+        len = snprintf(buf, sizeof(buf), "file %u line %u value %06u\n", id, line++, rnd() % 1000000);
+        if ((uint32_t)len > size - i)
+            len = size - i;
+        memcpy(n->data + i, buf, len);
+        i += len;
+    }
+    return n;
+}
+
+/* indirect blocks a file of nblocks needs, as inode_meta_blocks counts them */
+static uint32_t meta_blocks(uint32_t nblocks)
+{
+    if (!v2 || nblocks <= INODE2_DIRECT)
+        return 0;
+    if (nblocks <= INODE2_SINGLE_END)
+        return 1;
+    return 2 + (nblocks - INODE2_SINGLE_END + BLOCK_PTRS - 1) / BLOCK_PTRS;
+}
+
+/* give out inode numbers depth first, the root keeps inode 0 */
+static void assign_inodes(node_t* dir, uint32_t* next)
+{
+    node_t* n;
+    for (n = dir->child; n != NULL; n = n->next) {
+        /* "rtc" and "." share inode 0 with the root */
+        if (n->type == TYPE_RTC || strcmp(n->name, ".") == 0)
+            continue;
+        n->inode = (*next)++;
+        if (n->type == TYPE_DIR)
+            assign_inodes(n, next);
+    }
+}
+
+/* a subdirectory holds its entries as an array of 64 byte dentries */
+static void build_dir_data(node_t* dir)
+{
+    node_t* n;
+    uint32_t i = 0;
+    for (n = dir->child; n != NULL; n = n->next)
+        if (n->type == TYPE_DIR)
+            build_dir_data(n);
+    if (dir->inode == 0)
+        return;
+    dir->size = node_count(dir) * DENTRY_SIZE;
+    dir->data = calloc(1, dir->size + 1);
+    for (n = dir->child; n != NULL; n = n->next, i++) {
+        memcpy(dir->data + i * DENTRY_SIZE, n->name, strlen(n->name));
+        memcpy(dir->data + i * DENTRY_SIZE + 32, &n->type, 4);
+        memcpy(dir->data + i * DENTRY_SIZE + 36, &n->inode, 4);
+    }
+}
+
+static uint32_t count_blocks(node_t* dir, node_t** list, uint32_t* nlist)
+{
+    node_t* n;
+    uint32_t total = 0;
+    for (n = dir->child; n != NULL; n = n->next) {
+        if (n->type == TYPE_RTC)
+            continue;
+        n->nblocks = (n->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (!v2 && n->nblocks > INODE_DATA_BLOCKS)
+            die("file too large for version 1 inodes, use -2", n->name);
+        n->nmeta = meta_blocks(n->nblocks);
+        n->blocks = malloc((n->nblocks + n->nmeta + 1) * sizeof(uint32_t));
+        total += n->nblocks + n->nmeta;
+        list[(*nlist)++] = n;
+        if (n->type == TYPE_DIR)
+            total += count_blocks(n, list, nlist);
+    }
+    return total;
+}
+
+static void put32(uint8_t* p, uint32_t v)
+{
+    memcpy(p, &v, 4);
+}
+
+int main(int argc, char** argv)
+{
+    const char* out = "filesys_img";
+    uint32_t gen_num = 0, gen_size = BLOCK_SIZE, large_size = 0;
+    uint32_t next_inode = 1, nlist = 0, used, db_num, inode_blocks, i, j, k;
+    uint32_t crc_blocks = 0;
+    uint32_t *order, b;
+    node_t *root, *n, *gen, **list;
+    uint8_t *img, *data, *ino;
+    size_t img_size;
+    FILE* f;
+    char name[FILENAME_MAX_SIZE + 1];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "2Fczo:i:b:n:s:l:S:")) != -1) {
+        switch (opt) {
+            case '2': v2 = 1; break;
+            case 'F': fragment = 1; break;
+            case 'c': checksum = 1; break;
+            case 'z': compress = 1; break;
+            case 'o': out = optarg; break;
+            case 'i': num_inodes = strtoul(optarg, NULL, 0); break;
+            case 'b': free_blocks = strtoul(optarg, NULL, 0); break;
+            case 'n': gen_num = strtoul(optarg, NULL, 0); break;
+            case 's': gen_size = strtoul(optarg, NULL, 0); break;
+            case 'l': large_size = strtoul(optarg, NULL, 0); break;
+            case 'S': seed = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-2] [-F] [-c] [-z] [-o image] [-i inodes] [-b free_blocks] "
+                        "[-n files] [-s file_size] [-l large_size] [-S seed] [srcdir]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    root = node_new(".", TYPE_DIR);
+    node_add(root, node_new(".", TYPE_DIR));
+    node_add(root, node_new("rtc", TYPE_RTC));
+    if (optind < argc)
+        load_dir(root, argv[optind], 0);
+    if (large_size)
+        node_add(root, gen_file("large.bin", large_size, 0));
+    if (gen_num) {
+        /* the root has room for 63 entries, the generated ones go in a subdirectory */
+        gen = node_new("gen", TYPE_DIR);
+        for (i = 0; i < gen_num; i++) {
+            snprintf(name, sizeof(name), "f%05u", i);
+            node_add(gen, gen_file(name, gen_size, i + 1));
+        }
+        node_add(root, gen);
+    }
+    if (node_count(root) > DENTRY_LIST_SIZE)
+        die("more than 63 entries in the root directory", NULL);
+
+    if (compress)
+        compress_dir(root);
+    assign_inodes(root, &next_inode);
+    if (num_inodes == 0)
+        num_inodes = (next_inode + 16 > 64) ? next_inode + 16 : 64;
+    if (num_inodes < next_inode || num_inodes > INODE_NUM)
+        die("inode count out of range", NULL);
+    build_dir_data(root);
+
+    list = malloc(next_inode * sizeof(node_t*));
+    used = count_blocks(root, list, &nlist);
+    /* "." is in the list too but owns no blocks */
+    /* the checksum table follows the used blocks and covers itself too */
+    if (checksum) {
+        crc_blocks = (used + free_blocks + CRC_PER_BLOCK - 1) / CRC_PER_BLOCK;
+        if (used + free_blocks + crc_blocks > crc_blocks * CRC_PER_BLOCK)
+            crc_blocks++;
+    }
+    db_num = used + crc_blocks + free_blocks;
+    if (db_num > DB_NUM)
+        die("more data blocks than the kernel tracks", NULL);
+    inode_blocks = v2 ? (num_inodes + INODE2_PER_BLOCK - 1) / INODE2_PER_BLOCK : num_inodes;
+
+    /* data block order: in file order, or shuffled to fragment every file */
+    order = malloc((used + 1) * sizeof(uint32_t));
+    for (i = 0; i < used; i++)
+        order[i] = i;
+    if (fragment) {
+        for (i = used; i > 1; i--) {
+            j = rnd() % i;
+            b = order[i - 1];
+            order[i - 1] = order[j];
+            order[j] = b;
+        }
+    }
+    for (i = 0, k = 0; i < nlist; i++)
+        for (j = 0; j < list[i]->nblocks + list[i]->nmeta; j++)
+            list[i]->blocks[j] = order[k++];
+
+    img_size = (size_t)(1 + inode_blocks + db_num) * BLOCK_SIZE;
+    if ((img = calloc(1, img_size)) == NULL)
+        die("out of memory", NULL);
+    data = img + (size_t)(1 + inode_blocks) * BLOCK_SIZE;
+
+    /* boot block */
+    put32(img, node_count(root));
+    put32(img + 4, num_inodes);
+    put32(img + 8, db_num);
+    if (v2)
+        put32(img + 12, FS_MAGIC_V2);
+    if (crc_blocks) {
+        put32(img + 16, used);
+        put32(img + 20, crc_blocks);
+    }
+    for (n = root->child, i = 0; n != NULL; n = n->next, i++) {
+        memcpy(img + DENTRY_SIZE * (i + 1), n->name, strlen(n->name));
+        put32(img + DENTRY_SIZE * (i + 1) + 32, n->type);
+        put32(img + DENTRY_SIZE * (i + 1) + 36, n->inode);
+    }
+
+    /* inodes and data */
+    for (i = 0; i < nlist; i++) {
+        n = list[i];
+        if (n->inode == 0)
+            continue;
+        for (j = 0; j < n->nblocks; j++) {
+            k = (n->size - j * BLOCK_SIZE < BLOCK_SIZE) ? n->size - j * BLOCK_SIZE : BLOCK_SIZE;
+            memcpy(data + (size_t)n->blocks[j] * BLOCK_SIZE, n->data + j * BLOCK_SIZE, k);
+        }
+        if (!v2) {
+            ino = img + (size_t)(1 + n->inode) * BLOCK_SIZE;
+            put32(ino, n->size);
+            for (j = 0; j < n->nblocks; j++)
+                put32(ino + 4 + 4 * j, n->blocks[j]);
+            continue;
+        }
+        ino = img + BLOCK_SIZE + (size_t)n->inode * INODE2_SIZE;
+        put32(ino, n->size);
+        for (j = 0; j < n->nblocks && j < INODE2_DIRECT; j++)
+            put32(ino + 4 + 4 * j, n->blocks[j]);
+        if (n->nmeta == 0)
+            continue;
+        /* meta blocks: the indirect, then the double indirect and its children */
+        put32(ino + 4 + 4 * INODE2_DIRECT, n->blocks[n->nblocks]);
+        for (j = INODE2_DIRECT; j < n->nblocks && j < INODE2_SINGLE_END; j++)
+            put32(data + (size_t)n->blocks[n->nblocks] * BLOCK_SIZE + 4 * (j - INODE2_DIRECT), n->blocks[j]);
+        if (n->nmeta < 2)
+            continue;
+        put32(ino + 8 + 4 * INODE2_DIRECT, n->blocks[n->nblocks + 1]);
+        for (j = INODE2_SINGLE_END; j < n->nblocks; j++) {
+            k = (j - INODE2_SINGLE_END) / BLOCK_PTRS;
+            if ((j - INODE2_SINGLE_END) % BLOCK_PTRS == 0)
+                put32(data + (size_t)n->blocks[n->nblocks + 1] * BLOCK_SIZE + 4 * k, n->blocks[n->nblocks + 2 + k]);
+            put32(data + (size_t)n->blocks[n->nblocks + 2 + k] * BLOCK_SIZE + 4 * ((j - INODE2_SINGLE_END) % BLOCK_PTRS), n->blocks[j]);
+        }
+    }
+
+    /* the table's own entries are not checked */
+    for (i = 0; crc_blocks && i < db_num; i++)
+        if (i < used || i >= used + crc_blocks)
+            put32(data + (size_t)used * BLOCK_SIZE + 4 * i, crc32c(data + (size_t)i * BLOCK_SIZE, BLOCK_SIZE));
+
+    if ((f = fopen(out, "wb")) == NULL || fwrite(img, 1, img_size, f) != img_size)
+        die("cannot write", out);
+    fclose(f);
+    if (compress)
+        printf("%s: %u bytes of files stored in %u\n", out, raw_bytes, stored_bytes);
+    printf("%s: %u entries in the root, %u inodes (%u used), %u data blocks (%u free), %s%s%s\n",
+           out, node_count(root), num_inodes, next_inode, db_num, free_blocks,
+           v2 ? "version 2" : "version 1", fragment ? ", fragmented" : "", crc_blocks ? ", checksummed" : "");
+    return 0;
+}
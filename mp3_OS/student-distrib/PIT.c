@@ -1,5 +1,6 @@
 #include "PIT.h"
 #include "scheduler.h"
+#include "file_system.h"
 
 /* 
  * PIT_init
@@ -23,11 +24,12 @@ void PIT_init(){
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Send EOI to PIT IRQ
+ *   SIDE EFFECTS: Send EOI to PIT IRQ, write back the disk cache now and then
  */
 void PIT_handler(){
     send_eoi(PIT_IRQ);
     cli();
+    file_system_tick();
     switch_schedule();
     sti();
 }
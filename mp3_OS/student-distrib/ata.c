@@ -0,0 +1,171 @@
+#include "ata.h"
+
+uint32_t ata_sectors = 0;
+static uint8_t ata_drive_sel = ATA_DRIVE_LBA;   // drive select bits of the drive in use
+
+/* 
+ * ata_wait
+ *   DESCRIPTION: Poll the status until the drive is not busy
+ *   INPUTS: need_drq -- 1 to also wait until data can be moved
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 when ready, -1 on an error or a timeout
+ *   SIDE EFFECTS: none
+ */
+static int32_t ata_wait(uint32_t need_drq){
+    uint32_t i, status;
+    for (i = 0; i < ATA_TIMEOUT; i++) {
+        status = inb(ATA_STATUS);
+        if (status & ATA_SR_BSY)
+            continue;
+        if (status & (ATA_SR_ERR | ATA_SR_DF))
+            return -1;
+        if (!need_drq || (status & ATA_SR_DRQ))
+            return 0;
+    }
+    return -1;
+}
+
+/* 
+ * ata_select
+ *   DESCRIPTION: Program the drive registers for a transfer
+ *   INPUTS: lba -- the first sector
+ *           count -- the number of sectors, 1 to 256 (0 means 256)
+ *           cmd -- the command to issue
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: start the command
+ */
+static void ata_select(uint32_t lba, uint32_t count, uint8_t cmd){
+    outb(ata_drive_sel | ((lba >> 24) & 0x0F), ATA_DRIVE);
+    outb(count & 0xFF, ATA_SECCOUNT);
+    outb(lba & 0xFF, ATA_LBA_LO);
+    outb((lba >> 8) & 0xFF, ATA_LBA_MID);
+    outb((lba >> 16) & 0xFF, ATA_LBA_HI);
+    outb(cmd, ATA_COMMAND);
+}
+
+/* 
+ * ata_init
+ *   DESCRIPTION: Find a drive on the primary bus with IDENTIFY and use it
+ *   INPUTS: drive -- ATA_MASTER or ATA_SLAVE
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if an ATA drive is there, -1 otherwise
+ *   SIDE EFFECTS: set ata_sectors, turn the drive interrupts off
+ */
+int32_t ata_init(uint32_t drive){
+    uint16_t identify[ATA_SECTOR_SIZE / 2];
+    uint32_t i;
+    ata_sectors = 0;
+    outb(ATA_NIEN, ATA_CONTROL);
+    if (inb(ATA_STATUS) == 0xFF)            // floating bus, no controller
+        return -1;
+    ata_drive_sel = ATA_DRIVE_LBA | ((drive & 1) << 4);
+    outb(ata_drive_sel, ATA_DRIVE);
+    outb(0, ATA_SECCOUNT);
+    outb(0, ATA_LBA_LO);
+    outb(0, ATA_LBA_MID);
+    outb(0, ATA_LBA_HI);
+    outb(ATA_CMD_IDENTIFY, ATA_COMMAND);
+    if (inb(ATA_STATUS) == 0)               // no drive
+        return -1;
+    for (i = 0; i < ATA_TIMEOUT && (inb(ATA_STATUS) & ATA_SR_BSY); i++);
+    if (inb(ATA_LBA_MID) != 0 || inb(ATA_LBA_HI) != 0)     // ATAPI or SATA, not ours
+        return -1;
+    if (ata_wait(1) == -1)
+        return -1;
+    for (i = 0; i < ATA_SECTOR_SIZE / 2; i++)
+        identify[i] = inw(ATA_DATA);
+    // words 60 and 61: sectors addressable with LBA28
+    ata_sectors = identify[60] | ((uint32_t)identify[61] << 16);
+    return (ata_sectors == 0) ? -1 : 0;
+}
+
+/* 
+ * ata_read
+ *   DESCRIPTION: Read sectors from the drive, polled
+ *   INPUTS: lba -- the first sector
+ *           count -- the number of sectors
+ *           buf -- where to store count * 512 bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: the transfer runs with interrupts off so the PIT
+ *                 write-back cannot interleave on the bus
+ */
+int32_t ata_read(uint32_t lba, uint32_t count, void* buf){
+    uint32_t flags, n, i, done, words;
+    uint8_t* ptr;
+    int32_t ret = 0;
+    if (ata_sectors == 0 || count == 0 || lba + count > ata_sectors || lba + count > ATA_LBA28_MAX)
+        return -1;
+    cli_and_save(flags);
+    for (done = 0; done < count && ret == 0; done += n) {
+        n = (count - done > 256) ? 256 : count - done;
+        if (ata_wait(0) == -1) {
+            ret = -1;
+            break;
+        }
+        ata_select(lba + done, n, ATA_CMD_READ);
+        for (i = 0; i < n; i++) {
+            if (ata_wait(1) == -1) {
+                ret = -1;
+                break;
+            }
+            ptr = (uint8_t*)buf + (done + i) * ATA_SECTOR_SIZE;
+            words = ATA_SECTOR_SIZE / 2;
+            asm volatile ("cld; rep insw"
+                    : "+D" (ptr), "+c" (words)
+                    : "d" (ATA_DATA)
+                    : "memory");
+        }
+    }
+    restore_flags(flags);
+    return ret;
+}
+
+/* 
+ * ata_write
+ *   DESCRIPTION: Write sectors to the drive, polled, then flush its cache
+ *   INPUTS: lba -- the first sector
+ *           count -- the number of sectors
+ *           buf -- the count * 512 bytes to write
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: the transfer runs with interrupts off
+ */
+int32_t ata_write(uint32_t lba, uint32_t count, const void* buf){
+    uint32_t flags, n, i, done, words;
+    const uint8_t* ptr;
+    int32_t ret = 0;
+    if (ata_sectors == 0 || count == 0 || lba + count > ata_sectors || lba + count > ATA_LBA28_MAX)
+        return -1;
+    cli_and_save(flags);
+    for (done = 0; done < count && ret == 0; done += n) {
+        n = (count - done > 256) ? 256 : count - done;
+        if (ata_wait(0) == -1) {
+            ret = -1;
+            break;
+        }
+        ata_select(lba + done, n, ATA_CMD_WRITE);
+        for (i = 0; i < n; i++) {
+            if (ata_wait(1) == -1) {
+                ret = -1;
+                break;
+            }
+            ptr = (const uint8_t*)buf + (done + i) * ATA_SECTOR_SIZE;
+            words = ATA_SECTOR_SIZE / 2;
+            asm volatile ("cld; rep outsw"
+                    : "+S" (ptr), "+c" (words)
+                    : "d" (ATA_DATA)
+                    : "memory");
+        }
+    }
+    // BSY stays set while the last sector goes out, the flush has to wait for it
+    if (ret == 0)
+        ret = ata_wait(0);
+    if (ret == 0) {
+        outb(ATA_CMD_FLUSH, ATA_COMMAND);
+        ret = ata_wait(0);
+    }
+    restore_flags(flags);
+    return ret;
+}
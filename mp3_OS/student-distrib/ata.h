@@ -0,0 +1,43 @@
+#ifndef _ATA_H
+#define _ATA_H
+
+#include "types.h"
+#include "lib.h"
+
+// primary ATA bus, PIO mode
+#define ATA_DATA        0x1F0
+#define ATA_ERROR       0x1F1
+#define ATA_SECCOUNT    0x1F2
+#define ATA_LBA_LO      0x1F3
+#define ATA_LBA_MID     0x1F4
+#define ATA_LBA_HI      0x1F5
+#define ATA_DRIVE       0x1F6
+#define ATA_STATUS      0x1F7   // read
+#define ATA_COMMAND     0x1F7   // write
+#define ATA_CONTROL     0x3F6
+
+#define ATA_CMD_READ    0x20    // read sectors, LBA28
+#define ATA_CMD_WRITE   0x30    // write sectors, LBA28
+#define ATA_CMD_FLUSH   0xE7
+#define ATA_CMD_IDENTIFY 0xEC
+
+#define ATA_SR_BSY      0x80
+#define ATA_SR_DF       0x20
+#define ATA_SR_DRQ      0x08
+#define ATA_SR_ERR      0x01
+
+#define ATA_MASTER      0       // -hda, the boot disk in the usual setup
+#define ATA_SLAVE       1       // -hdb
+#define ATA_DRIVE_LBA   0xE0    // LBA addressing, bit 4 picks the slave
+#define ATA_NIEN        0x02    // no interrupts, every transfer is polled
+#define ATA_SECTOR_SIZE 512
+#define ATA_LBA28_MAX   0x0FFFFFFF
+#define ATA_TIMEOUT     100000  // status polls before giving up
+
+extern uint32_t ata_sectors;    // size of the drive, 0 when there is none
+
+int32_t ata_init(uint32_t drive);
+int32_t ata_read(uint32_t lba, uint32_t count, void* buf);
+int32_t ata_write(uint32_t lba, uint32_t count, const void* buf);
+
+#endif
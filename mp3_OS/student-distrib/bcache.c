@@ -0,0 +1,235 @@
+#include "bcache.h"
+
+// the buffers themselves, apart from the headers so they stay 4kb aligned
+static uint8_t bcache_data[BCACHE_SIZE][BCACHE_BLOCK_SIZE] __attribute__((aligned (BCACHE_BLOCK_SIZE)));
+static bcache_buf_t bcache_buf[BCACHE_SIZE];
+static int32_t bcache_hash_head[BCACHE_HASH_SIZE];
+static int32_t lru_head;                // most recently used
+static int32_t lru_tail;                // least recently used, evicted first
+
+uint32_t bcache_hits;
+uint32_t bcache_misses;
+uint32_t bcache_prefetched;
+void (*bcache_load_hook)(uint32_t block);
+
+/* 
+ * bcache_unlink
+ *   DESCRIPTION: Take a buffer out of the LRU list
+ *   INPUTS: i -- the buffer index
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modify the LRU list
+ */
+static void bcache_unlink(int32_t i){
+    if (bcache_buf[i].lru_prev == BCACHE_NONE)
+        lru_head = bcache_buf[i].lru_next;
+    else
+        bcache_buf[bcache_buf[i].lru_prev].lru_next = bcache_buf[i].lru_next;
+    if (bcache_buf[i].lru_next == BCACHE_NONE)
+        lru_tail = bcache_buf[i].lru_prev;
+    else
+        bcache_buf[bcache_buf[i].lru_next].lru_prev = bcache_buf[i].lru_prev;
+}
+
+/* 
+ * bcache_touch
+ *   DESCRIPTION: Move a buffer to the front of the LRU list
+ *   INPUTS: i -- the buffer index
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modify the LRU list
+ */
+static void bcache_touch(int32_t i){
+    if (lru_head == i)
+        return;
+    bcache_unlink(i);
+    bcache_buf[i].lru_prev = BCACHE_NONE;
+    bcache_buf[i].lru_next = lru_head;
+    bcache_buf[lru_head].lru_prev = i;
+    lru_head = i;
+}
+
+/* 
+ * bcache_hash_remove
+ *   DESCRIPTION: Take a buffer out of its hash chain
+ *   INPUTS: i -- the buffer index
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modify the hash chains
+ */
+static void bcache_hash_remove(int32_t i){
+    int32_t* link = &bcache_hash_head[bcache_buf[i].block & (BCACHE_HASH_SIZE - 1)];
+    while (*link != BCACHE_NONE) {
+        if (*link == i) {
+            *link = bcache_buf[i].hash_next;
+            return;
+        }
+        link = &bcache_buf[*link].hash_next;
+    }
+}
+
+/* 
+ * bcache_writeback
+ *   DESCRIPTION: Write a dirty buffer back to the disk
+ *   INPUTS: i -- the buffer index
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a disk error
+ *   SIDE EFFECTS: clear the dirty flag on success
+ */
+static int32_t bcache_writeback(int32_t i){
+    if (ata_write(bcache_buf[i].block * BCACHE_SECTORS, BCACHE_SECTORS, bcache_data[i]) == -1)
+        return -1;
+    bcache_buf[i].dirty = 0;
+    return 0;
+}
+
+/* 
+ * bcache_init
+ *   DESCRIPTION: Empty the cache
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: every buffer goes on the LRU list, invalid
+ */
+void bcache_init(){
+    int32_t i;
+    for (i = 0; i < BCACHE_HASH_SIZE; i++)
+        bcache_hash_head[i] = BCACHE_NONE;
+    for (i = 0; i < BCACHE_SIZE; i++) {
+        bcache_buf[i].valid = 0;
+        bcache_buf[i].dirty = 0;
+        bcache_buf[i].hash_next = BCACHE_NONE;
+        bcache_buf[i].lru_prev = i - 1;
+        bcache_buf[i].lru_next = (i == BCACHE_SIZE - 1) ? BCACHE_NONE : i + 1;
+    }
+    lru_head = 0;
+    lru_tail = BCACHE_SIZE - 1;
+    bcache_hits = 0;
+    bcache_misses = 0;
+    bcache_prefetched = 0;
+}
+
+/* 
+ * bcache_lookup
+ *   DESCRIPTION: Find the buffer holding a disk block
+ *   INPUTS: block -- the disk block
+ *   OUTPUTS: none
+ *   RETURN VALUE: the buffer index, BCACHE_NONE if it is not cached
+ *   SIDE EFFECTS: none
+ */
+static int32_t bcache_lookup(uint32_t block){
+    int32_t i;
+    for (i = bcache_hash_head[block & (BCACHE_HASH_SIZE - 1)]; i != BCACHE_NONE; i = bcache_buf[i].hash_next)
+        if (bcache_buf[i].block == block)
+            break;
+    return i;
+}
+
+/* 
+ * bcache_load
+ *   DESCRIPTION: Read a disk block into the least recently used buffer
+ *   INPUTS: block -- the disk block, not cached yet
+ *   OUTPUTS: none
+ *   RETURN VALUE: the buffer index, BCACHE_NONE on a disk error
+ *   SIDE EFFECTS: write the evicted buffer back if it is dirty, call
+ *                 bcache_load_hook once the block is in
+ */
+static int32_t bcache_load(uint32_t block){
+    int32_t i = lru_tail;
+    if (bcache_buf[i].valid && bcache_buf[i].dirty && bcache_writeback(i) == -1)
+        return BCACHE_NONE;
+    if (bcache_buf[i].valid)
+        bcache_hash_remove(i);
+    bcache_buf[i].valid = 0;
+    if (ata_read(block * BCACHE_SECTORS, BCACHE_SECTORS, bcache_data[i]) == -1)
+        return BCACHE_NONE;
+    bcache_buf[i].block = block;
+    bcache_buf[i].valid = 1;
+    bcache_buf[i].hash_next = bcache_hash_head[block & (BCACHE_HASH_SIZE - 1)];
+    bcache_hash_head[block & (BCACHE_HASH_SIZE - 1)] = i;
+    if (bcache_load_hook != NULL)
+        bcache_load_hook(block);
+    return i;
+}
+
+/* 
+ * bcache_get
+ *   DESCRIPTION: Get the buffer holding a disk block, reading it in on a miss;
+ *                the least recently used buffer is the one given up
+ *   INPUTS: block -- the disk block, in BCACHE_BLOCK_SIZE units
+ *           dirty -- 1 if the caller is going to modify it
+ *   OUTPUTS: none
+ *   RETURN VALUE: the 4kb of the block, NULL on a disk error
+ *   SIDE EFFECTS: the pointer stays good only until the next bcache_get, so
+ *                 the caller keeps interrupts off while it uses it
+ */
+uint8_t* bcache_get(uint32_t block, uint32_t dirty){
+    int32_t i = bcache_lookup(block);
+    if (i != BCACHE_NONE) {
+        bcache_hits++;
+    } else {
+        bcache_misses++;
+        if ((i = bcache_load(block)) == BCACHE_NONE)
+            return NULL;
+    }
+    bcache_touch(i);
+    if (dirty)
+        bcache_buf[i].dirty = 1;
+    return bcache_data[i];
+}
+
+/* 
+ * bcache_peek
+ *   DESCRIPTION: Get the buffer of a block only if it is cached already; not
+ *                counted as a hit or a miss, and the LRU is left as it is
+ *   INPUTS: block -- the disk block
+ *   OUTPUTS: none
+ *   RETURN VALUE: the 4kb of the block, NULL if it is not cached
+ *   SIDE EFFECTS: the pointer stays good only until the next bcache_get
+ */
+uint8_t* bcache_peek(uint32_t block){
+    int32_t i = bcache_lookup(block);
+    return (i == BCACHE_NONE) ? NULL : bcache_data[i];
+}
+
+/* 
+ * bcache_prefetch
+ *   DESCRIPTION: Read a disk block in ahead of its use; not counted as a
+ *                hit or a miss, and a cached block is left where it is in the LRU
+ *   INPUTS: block -- the disk block
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a disk error
+ *   SIDE EFFECTS: may evict a buffer
+ */
+int32_t bcache_prefetch(uint32_t block){
+    int32_t i;
+    if (bcache_lookup(block) != BCACHE_NONE)
+        return 0;
+    if ((i = bcache_load(block)) == BCACHE_NONE)
+        return -1;
+    bcache_touch(i);
+    bcache_prefetched++;
+    return 0;
+}
+
+/* 
+ * bcache_flush
+ *   DESCRIPTION: Write dirty buffers back, oldest first
+ *   INPUTS: max -- the most buffers to write, 0 for all of them
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of buffers written, -1 on a disk error
+ *   SIDE EFFECTS: clear their dirty flags
+ */
+int32_t bcache_flush(uint32_t max){
+    int32_t i;
+    uint32_t count = 0;
+    for (i = lru_tail; i != BCACHE_NONE; i = bcache_buf[i].lru_prev) {
+        if (!bcache_buf[i].valid || !bcache_buf[i].dirty)
+            continue;
+        if (bcache_writeback(i) == -1)
+            return -1;
+        if (++count == max)
+            break;
+    }
+    return count;
+}
@@ -0,0 +1,36 @@
+#ifndef _BCACHE_H
+#define _BCACHE_H
+
+#include "types.h"
+#include "lib.h"
+#include "ata.h"
+
+#define BCACHE_SIZE         64          // 4kb buffers, 256kb in total
+#define BCACHE_HASH_SIZE    128         // power of 2, about twice BCACHE_SIZE
+#define BCACHE_NONE         -1          // end of a list
+#define BCACHE_BLOCK_SIZE   4096
+#define BCACHE_SECTORS      (BCACHE_BLOCK_SIZE / ATA_SECTOR_SIZE)
+#define BCACHE_FLUSH_MAX    8           // dirty buffers one tick may write back
+
+typedef struct bcache_buf_t
+{
+    uint32_t block;                     // disk block, in BCACHE_BLOCK_SIZE units
+    uint32_t valid;
+    uint32_t dirty;
+    int32_t  hash_next;
+    int32_t  lru_prev;                  // towards the most recently used
+    int32_t  lru_next;                  // towards the least recently used
+} bcache_buf_t;
+
+void     bcache_init(void);
+uint8_t* bcache_get(uint32_t block, uint32_t dirty);
+int32_t  bcache_prefetch(uint32_t block);
+uint8_t* bcache_peek(uint32_t block);
+int32_t  bcache_flush(uint32_t max);
+
+extern uint32_t bcache_hits;
+extern uint32_t bcache_misses;
+extern uint32_t bcache_prefetched;    // blocks read in by bcache_prefetch
+extern void (*bcache_load_hook)(uint32_t block);   // told of every block read in from the disk
+
+#endif
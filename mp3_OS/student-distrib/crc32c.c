@@ -0,0 +1,115 @@
+#include "crc32c.h"
+
+static uint32_t crc32c_table[CRC32C_SLICES][256];
+static uint32_t crc32c_ready;
+
+uint32_t crc32c_sse42;
+
+/* 
+ * crc32c_init
+ *   DESCRIPTION: Build the slicing-by-8 tables and pick the SSE4.2 path when
+ *                CPUID reports it; later calls do nothing
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: set crc32c_sse42
+ */
+void crc32c_init(void){
+    uint32_t i, j, crc, eax, ebx, ecx, edx;
+    if (crc32c_ready)
+        return;
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        crc32c_table[0][i] = crc;
+    }
+    // table k gives the crc of a byte followed by k zero bytes
+    for (i = 0; i < 256; i++)
+        for (j = 1; j < CRC32C_SLICES; j++)
+            crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[j - 1][i] & 0xFF];
+    asm volatile ("cpuid"
+            : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+            : "a"(1)
+    );
+    crc32c_sse42 = (ecx & CPUID_ECX_SSE42) ? 1 : 0;
+    crc32c_ready = 1;
+}
+
+/* 
+ * crc32c_sw
+ *   DESCRIPTION: CRC32C with table lookups, 8 bytes per step
+ *   INPUTS: crc -- the crc of the bytes before buf, 0 to start
+ *           buf -- the bytes
+ *           len -- the number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: the crc including buf
+ *   SIDE EFFECTS: none
+ */
+uint32_t crc32c_sw(uint32_t crc, const uint8_t* buf, uint32_t len){
+    uint32_t lo, hi;
+    crc = ~crc;
+    while (len > 0 && ((unsigned long)buf & 3)) {
+        crc = crc32c_table[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        lo = *(const uint32_t*)buf ^ crc;
+        hi = *(const uint32_t*)(buf + 4);
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+              crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^
+              crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+        buf += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        crc = crc32c_table[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+/* 
+ * crc32c_hw
+ *   DESCRIPTION: CRC32C with the SSE4.2 crc32 instruction, 4 bytes per step;
+ *                only call it when crc32c_sse42 is set
+ *   INPUTS: crc -- the crc of the bytes before buf, 0 to start
+ *           buf -- the bytes
+ *           len -- the number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: the crc including buf
+ *   SIDE EFFECTS: none
+ */
+uint32_t crc32c_hw(uint32_t crc, const uint8_t* buf, uint32_t len){
+    crc = ~crc;
+    while (len > 0 && ((unsigned long)buf & 3)) {
+        asm ("crc32b %1, %0" : "+r"(crc) : "rm"(*buf));
+        buf++;
+        len--;
+    }
+    while (len >= 4) {
+        asm ("crc32l %1, %0" : "+r"(crc) : "rm"(*(const uint32_t*)buf));
+        buf += 4;
+        len -= 4;
+    }
+    while (len-- > 0) {
+        asm ("crc32b %1, %0" : "+r"(crc) : "rm"(*buf));
+        buf++;
+    }
+    return ~crc;
+}
+
+/* 
+ * crc32c
+ *   DESCRIPTION: CRC32C of a buffer, by the fastest path the CPU has
+ *   INPUTS: crc -- the crc of the bytes before buf, 0 to start
+ *           buf -- the bytes
+ *           len -- the number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: the crc including buf
+ *   SIDE EFFECTS: none
+ */
+uint32_t crc32c(uint32_t crc, const uint8_t* buf, uint32_t len){
+    if (crc32c_sse42)
+        return crc32c_hw(crc, buf, len);
+    return crc32c_sw(crc, buf, len);
+}
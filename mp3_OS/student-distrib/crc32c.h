@@ -0,0 +1,17 @@
+#ifndef _CRC32C_H
+#define _CRC32C_H
+
+#include "types.h"
+
+#define CRC32C_POLY         0x82F63B78  // Castagnoli, bit reflected
+#define CRC32C_SLICES       8           // table lookups per 8 bytes in the software path
+#define CPUID_ECX_SSE42     (1 << 20)
+
+void     crc32c_init(void);
+uint32_t crc32c(uint32_t crc, const uint8_t* buf, uint32_t len);
+uint32_t crc32c_sw(uint32_t crc, const uint8_t* buf, uint32_t len);
+uint32_t crc32c_hw(uint32_t crc, const uint8_t* buf, uint32_t len);
+
+extern uint32_t crc32c_sse42;           // 1 when crc32c uses the SSE4.2 crc32 instruction
+
+#endif
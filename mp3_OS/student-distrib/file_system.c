@@ -1,23 +1,91 @@
 #include "file_system.h"
 #include "keyboard.h"
+#include "bcache.h"
+#include "crc32c.h"
 
 
 // global variables
 boot_block_t*   boot_block_ptr;
 dentry_t*       dentry_ptr;
 inode_t*        inode_ptr;
+inode2_t*       inode2_ptr;         // NULL for the original 4kb inode format
 data_block_t*   data_block_ptr;
 // bitmap for data blocks
-uint8_t bitmap[128];             // 59 data blocks
+uint32_t bitmap[BITMAP_WORDS(DB_NUM)];
 uint32_t bitmap_counter;
-uint8_t inodemap[128];        // 64 inodes
+uint32_t bitmap_hint;           // where the next search starts
+// owners of a data block beyond the first, rebuilt from the inodes at init
+uint16_t block_refs[DB_NUM];
+uint32_t inodemap[BITMAP_WORDS(INODE_NUM)];
+uint32_t compmap[BITMAP_WORDS(INODE_NUM)];      // inodes holding compressed files
 uint32_t inodemap_counter;
+uint32_t inodemap_hint;
 uint32_t dir_num;           //change !!!
 uint32_t in_num;            //not change !!!
 uint32_t db_num;            //not change !!!
 
 uint32_t last_modify_length = 0;
 uint32_t search_list_index;
+// hash index for the dentries: bucket heads and per-dentry chain links
+int32_t dentry_hash_head[DENTRY_HASH_SIZE];
+int32_t dentry_hash_next[MAX_DIR_ENTRIES];
+// prefix trie over the root names, node 0 is the root of the trie
+trie_node_t trie[TRIE_NODES];
+int32_t trie_free;
+// recently resolved path components
+dcache_entry_t dcache[DCACHE_SIZE];
+// last run of contiguous blocks looked up, one slot per inode % EXTENT_CACHE_SIZE
+extent_t extent_cache[EXTENT_CACHE_SIZE];
+// disk-backed image: metadata pinned here, data blocks read through the buffer cache
+uint32_t fs_disk;                   // 1 once file_system_init_disk took over
+uint32_t fs_data_start;             // disk block of data block 0
+uint32_t fs_meta_num;               // blocks held in fs_meta
+uint32_t fs_ticks;
+static uint8_t fs_meta[FS_META_BLOCKS * BLOCK_SIZE] __attribute__((aligned (BLOCK_SIZE)));
+static uint32_t fs_meta_dirty_map[BITMAP_WORDS(FS_META_BLOCKS)];
+// blocks waiting to be prefetched by the PIT, ra_head == ra_tail when empty
+ra_request_t ra_queue[RA_QUEUE_SIZE];
+uint32_t ra_head;
+uint32_t ra_tail;
+// checksums of the data blocks, a copy of the table on the image
+uint32_t fs_crc[DB_NUM];
+static uint32_t crc_valid[BITMAP_WORDS(DB_NUM)];   // set once fs_crc matches the block
+static uint32_t crc_verified[BITMAP_WORDS(DB_NUM)]; // set once a read checked the copy in memory, until it changes
+uint32_t fs_crc_on;
+uint32_t fs_crc_verify;
+uint32_t crc_start;
+uint32_t crc_blocks;
+uint32_t crc_scrub_next;
+uint32_t crc_errors;
+uint32_t crc_bad_block;             // the last block that failed
+uint32_t crc_scrubbed;
+// decompressed blocks of compressed files, by (inode, block)
+static lz_cache_t lz_cache[LZ_CACHE_SIZE];
+static uint8_t lz_in[BLOCK_SIZE];
+// one block of a subdirectory at a time while it is searched
+static dentry_t dir_block[BLOCK_SIZE / sizeof(dentry_t)];
+uint32_t lz_hits;
+uint32_t lz_misses;
+
+static uint32_t dentry_name_hash (const uint8_t* fname);
+static void     dentry_hash_insert (uint32_t index);
+static void     dentry_hash_remove (uint32_t index);
+static void     dentry_hash_build (void);
+static void     trie_build (void);
+static int32_t  inode_get_block (uint32_t inode, uint32_t idx);
+static uint32_t inode_meta_blocks (uint32_t block_num);
+static int32_t  inode_meta_block (uint32_t inode, uint32_t idx);
+static void     extent_invalidate (uint32_t inode);
+static void     inode_mark (uint32_t inode, uint32_t file_type, uint32_t depth);
+static void     fs_meta_dirty (const void* addr);
+static void     read_ahead_run (uint32_t max);
+static void     crc_load (void);
+static void     crc_reloaded (uint32_t block);
+static void     crc_scrub (uint32_t max);
+static int32_t  block_read (uint32_t block, uint32_t offset, uint8_t* buf, uint32_t length);
+static int32_t  block_write (uint32_t block, uint32_t offset, const uint8_t* buf, uint32_t length);
+static int32_t  read_stored (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
+
 /* file_system_init
  *   DESCRIPTION: Initialize the file system
  *   INPUTS: start_addr -- the starting address of the file system
@@ -27,7 +95,7 @@ uint32_t search_list_index;
  */
 void file_system_init (uint32_t start_addr)
 {
-    uint32_t i, j, inode_num_, max_db;
+    uint32_t i;
 
     boot_block_ptr = (boot_block_t*)start_addr;
     dir_num = boot_block_ptr->num_dir_entries;  // de_num: 18
@@ -36,41 +104,1133 @@ void file_system_init (uint32_t start_addr)
 
     dentry_ptr = (dentry_t*)(start_addr + DENTRY_OFFSET);
     inode_ptr = (inode_t*)(start_addr + BOOT_BLOCK_SIZE);
-    data_block_ptr = (data_block_t*)(start_addr + BOOT_BLOCK_SIZE + INODE_SIZE * boot_block_ptr->num_inodes);
-    // initialize inodemap
-    for (i=0; i<in_num; i++)
+    if (boot_block_ptr->fs_magic == FS_MAGIC_V2)
+    {
+        // inodes are packed INODE2_PER_BLOCK to a block
+        inode2_ptr = (inode2_t*)inode_ptr;
+        data_block_ptr = (data_block_t*)(start_addr + BOOT_BLOCK_SIZE +
+                BLOCK_SIZE * ((in_num + INODE2_PER_BLOCK - 1) / INODE2_PER_BLOCK));
+    }
+    else
+    {
+        inode2_ptr = NULL;
+        data_block_ptr = (data_block_t*)(start_addr + BOOT_BLOCK_SIZE + INODE_SIZE * boot_block_ptr->num_inodes);
+    }
+    for (i=0; i<EXTENT_CACHE_SIZE; i++)
+        extent_cache[i].inode = INODE_NUM;
+    for (i=0; i<DCACHE_SIZE; i++)
+        dcache[i].parent = DCACHE_EMPTY;
+    if (in_num > INODE_NUM)
+        in_num = INODE_NUM;
+    if (db_num > DB_NUM)
+        db_num = DB_NUM;
+    // initialize the bitmaps, the bits past the end of the image stay in use
+    for (i=0; i<BITMAP_WORDS(INODE_NUM); i++)
+        inodemap[i] = compmap[i] = 0;
+    for (i=0; i<LZ_CACHE_SIZE; i++)
+        lz_cache[i].inode = INODE_NUM;
+    for (i=in_num; i<BITMAP_WORDS(INODE_NUM)*BITMAP_WORD_BITS; i++)
+        BITMAP_SET(inodemap, i);
+    inodemap_counter = 0;
+    inodemap_hint = 0;
+    for (i=0; i<BITMAP_WORDS(DB_NUM); i++)
+        bitmap[i] = 0;
+    for (i=db_num; i<BITMAP_WORDS(DB_NUM)*BITMAP_WORD_BITS; i++)
+        BITMAP_SET(bitmap, i);
+    for (i=0; i<DB_NUM; i++)
+        block_refs[i] = 0;
+    bitmap_counter = 0;
+    bitmap_hint = 0;
+    //mark every inode in use and the blocks they own, subdirectories included
+    for (i=0; i<dir_num; i++)
+        inode_mark(dentry_ptr[i].inode_num, dentry_ptr[i].file_type, 0);
+    // build the name index and the completion trie
+    dentry_hash_build();
+    trie_build();
+    crc_load();
+}
+
+/* file_system_init_disk
+ *   DESCRIPTION: Switch the file system over to the image on the ATA disk;
+ *                the boot block and inodes are read into memory once, data
+ *                blocks are read and written through the buffer cache
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the disk holds no image, the module
+ *                 image stays in use then
+ *   SIDE EFFECTS: reinitialize the file system
+ */
+int32_t file_system_init_disk (void)
+{
+    boot_block_t* boot = (boot_block_t*)fs_meta;
+    uint32_t inode_blocks, i;
+    if (ata_read(0, BLOCK_SIZE / ATA_SECTOR_SIZE, fs_meta) == -1)
+        return -1;
+    //sanity check: same layout as the module, "." first
+    if (boot->num_dir_entries == 0 || boot->num_dir_entries > MAX_DIR_ENTRIES ||
+        boot->num_inodes == 0 || boot->num_inodes > INODE_NUM || boot->num_data_blocks > DB_NUM ||
+        strncmp((int8_t*)boot->dir_entries[0].file_name, ".", FILENAME_MAX_SIZE) != 0)
+        return -1;
+    if (boot->fs_magic == FS_MAGIC_V2)
+        inode_blocks = (boot->num_inodes + INODE2_PER_BLOCK - 1) / INODE2_PER_BLOCK;
+    else
+        inode_blocks = boot->num_inodes;
+    if (1 + inode_blocks > FS_META_BLOCKS ||
+        (1 + inode_blocks + boot->num_data_blocks) * (BLOCK_SIZE / ATA_SECTOR_SIZE) > ata_sectors)
+        return -1;
+    if (ata_read(BLOCK_SIZE / ATA_SECTOR_SIZE, inode_blocks * (BLOCK_SIZE / ATA_SECTOR_SIZE), fs_meta + BLOCK_SIZE) == -1)
+        return -1;
+    for (i=0; i<BITMAP_WORDS(FS_META_BLOCKS); i++)
+        fs_meta_dirty_map[i] = 0;
+    bcache_init();
+    bcache_load_hook = crc_reloaded;
+    fs_meta_num = 1 + inode_blocks;
+    fs_data_start = fs_meta_num;
+    fs_ticks = 0;
+    ra_head = ra_tail = 0;
+    fs_disk = 1;
+    file_system_init((uint32_t)fs_meta);
+    return 0;
+}
+
+/* fs_meta_dirty
+ *   DESCRIPTION: Note that the boot block or an inode changed
+ *   INPUTS: addr -- the byte that changed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the block holding it is written back on the next sync
+ */
+static void fs_meta_dirty (const void* addr)
+{
+    uint32_t block;
+    if (!fs_disk)
+        return;
+    block = ((uint32_t)addr - (uint32_t)fs_meta) / BLOCK_SIZE;
+    if (block < fs_meta_num)
+        BITMAP_SET(fs_meta_dirty_map, block);
+}
+
+/* fs_meta_flush
+ *   DESCRIPTION: Write changed metadata blocks back, lowest first
+ *   INPUTS: max -- the most blocks to write, 0 for all of them
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of blocks written, -1 on a disk error
+ *   SIDE EFFECTS: clear their dirty bits
+ */
+static int32_t fs_meta_flush (uint32_t max)
+{
+    uint32_t i, count = 0;
+    for (i=0; i<fs_meta_num; i++)
+    {
+        if (!BITMAP_TEST(fs_meta_dirty_map, i))
+            continue;
+        if (ata_write(i * (BLOCK_SIZE / ATA_SECTOR_SIZE), BLOCK_SIZE / ATA_SECTOR_SIZE, fs_meta + i * BLOCK_SIZE) == -1)
+            return -1;
+        BITMAP_CLEAR(fs_meta_dirty_map, i);
+        if (++count == max)
+            break;
+    }
+    return count;
+}
+
+/* file_system_sync
+ *   DESCRIPTION: Write every changed metadata block and dirty buffer to the disk
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a disk error
+ *   SIDE EFFECTS: none
+ */
+int32_t file_system_sync (void)
+{
+    uint32_t flags;
+    int32_t ret = 0;
+    if (!fs_disk)
+        return 0;
+    cli_and_save(flags);
+    if (fs_meta_flush(0) == -1 || bcache_flush(0) == -1)
+        ret = -1;
+    restore_flags(flags);
+    return ret;
+}
+
+/* file_system_tick
+ *   DESCRIPTION: Background work, called from the PIT handler: a few blocks
+ *                of checksum scrub and queued readahead every tick, and
+ *                periodic write-back of a few metadata blocks and data
+ *                buffers at a time
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: write to the disk every FS_SYNC_TICKS ticks, and on the
+ *                 ticks after while metadata is left to write
+ */
+void file_system_tick (void)
+{
+    crc_scrub(CRC_SCRUB_BLOCKS);
+    if (!fs_disk)
+        return;
+    read_ahead_run(RA_TICK_BLOCKS);
+    if (++fs_ticks < FS_SYNC_TICKS)
+        return;
+    //the PIT runs with interrupts off, so the rest waits for the next tick
+    if (fs_meta_flush(FS_META_FLUSH_MAX) != FS_META_FLUSH_MAX)
+        fs_ticks = 0;
+    bcache_flush(BCACHE_FLUSH_MAX);
+}
+
+/* crc_load
+ *   DESCRIPTION: Read the checksum table the boot block points at and trust
+ *                it for every block in use; without one checksums stay off
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: keep the table blocks out of the bitmap's free blocks
+ */
+static void crc_load (void)
+{
+    uint32_t i;
+    fs_crc_on = fs_crc_verify = 0;
+    crc_scrub_next = crc_errors = crc_scrubbed = 0;
+    for (i=0; i<BITMAP_WORDS(DB_NUM); i++)
+        crc_valid[i] = crc_verified[i] = 0;
+    crc_start = boot_block_ptr->crc_start;
+    crc_blocks = boot_block_ptr->crc_blocks;
+    if (crc_blocks == 0 || crc_start >= db_num || crc_blocks > db_num - crc_start ||
+        crc_blocks * CRC_PER_BLOCK < db_num)
+        return;
+    crc32c_init();
+    if (block_read(crc_start, 0, (uint8_t*)fs_crc, db_num * sizeof(uint32_t)) == -1)
+        return;
+    for (i=crc_start; i<crc_start+crc_blocks; i++)
+    {
+        if (!BITMAP_TEST(bitmap, i))
+        {
+            BITMAP_SET(bitmap, i);
+            bitmap_counter++;
+        }
+    }
+    for (i=0; i<db_num; i++)
+        if (BITMAP_TEST(bitmap, i) && (i < crc_start || i >= crc_start + crc_blocks))
+            BITMAP_SET(crc_valid, i);
+    fs_crc_on = fs_crc_verify = 1;
+}
+
+/* crc_check
+ *   DESCRIPTION: Compare a data block against its checksum
+ *   INPUTS: block -- the data block number
+ *           data -- its BLOCK_SIZE bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if it matches or has no checksum yet, -1 if not
+ *   SIDE EFFECTS: count the mismatch, the next read checks the block again
+ */
+static int32_t crc_check (uint32_t block, const uint8_t* data)
+{
+    if (!fs_crc_on || !BITMAP_TEST(crc_valid, block))
+        return 0;
+    if (crc32c(0, data, BLOCK_SIZE) == fs_crc[block])
+        return 0;
+    BITMAP_CLEAR(crc_verified, block);
+    crc_errors++;
+    crc_bad_block = block;
+    return -1;
+}
+
+/* crc_verify
+ *   DESCRIPTION: Check a data block on its way to a reader, once for each
+ *                time it is written or read in from the disk
+ *   INPUTS: block -- the data block number
+ *           data -- its BLOCK_SIZE bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if it matches or was checked already, -1 if not
+ *   SIDE EFFECTS: remember a block that passed
+ */
+static int32_t crc_verify (uint32_t block, const uint8_t* data)
+{
+    if (BITMAP_TEST(crc_verified, block))
+        return 0;
+    if (crc_check(block, data) == -1)
+        return -1;
+    BITMAP_SET(crc_verified, block);
+    return 0;
+}
+
+/* crc_reloaded
+ *   DESCRIPTION: Called by the buffer cache after it reads a block from the
+ *                disk, so the new copy is checked again
+ *   INPUTS: block -- the disk block
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void crc_reloaded (uint32_t block)
+{
+    if (block >= fs_data_start && block - fs_data_start < DB_NUM)
+        BITMAP_CLEAR(crc_verified, block - fs_data_start);
+}
+
+/* crc_update
+ *   DESCRIPTION: Take the checksum of a data block that was just written
+ *   INPUTS: block -- the data block number
+ *           data -- its BLOCK_SIZE bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: crc_store has to put it in the table afterwards
+ */
+static void crc_update (uint32_t block, const uint8_t* data)
+{
+    if (!fs_crc_on || (block >= crc_start && block < crc_start + crc_blocks))
+        return;
+    fs_crc[block] = crc32c(0, data, BLOCK_SIZE);
+    BITMAP_SET(crc_valid, block);
+    BITMAP_CLEAR(crc_verified, block);
+}
+
+/* crc_store
+ *   DESCRIPTION: Copy the checksum of a block into the table on the image
+ *   INPUTS: block -- the data block number
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a disk error
+ *   SIDE EFFECTS: dirty a table block
+ */
+static int32_t crc_store (uint32_t block)
+{
+    if (!fs_crc_on || (block >= crc_start && block < crc_start + crc_blocks))
+        return 0;
+    return block_write(crc_start + block / CRC_PER_BLOCK, (block % CRC_PER_BLOCK) * sizeof(uint32_t),
+                       (uint8_t*)&fs_crc[block], sizeof(uint32_t));
+}
+
+/* crc_scrub
+ *   DESCRIPTION: Check a few more blocks in use against their checksums,
+ *                going round the image one pass after another; on a disk
+ *                image only the blocks already in the buffer cache are checked,
+ *                the PIT must not wait on the disk or evict the working set
+ *   INPUTS: max -- the most blocks to check
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: count mismatches in crc_errors
+ */
+static void crc_scrub (uint32_t max)
+{
+    uint32_t i, block, checked, flags;
+    uint8_t* data;
+    if (!fs_crc_on)
+        return;
+    for (i = 0, checked = 0; i < db_num && checked < max; i++)
+    {
+        block = crc_scrub_next;
+        crc_scrub_next = (block + 1 < db_num) ? block + 1 : 0;
+        if (!BITMAP_TEST(crc_valid, block))
+            continue;
+        checked++;
+        if (!fs_disk)
+        {
+            crc_scrubbed++;
+            crc_check(block, data_block_ptr[block].data);
+            continue;
+        }
+        //a block not cached counts against max too, so a tick stays short
+        cli_and_save(flags);
+        if ((data = bcache_peek(fs_data_start + block)) != NULL)
+        {
+            crc_scrubbed++;
+            crc_check(block, data);
+        }
+        restore_flags(flags);
+    }
+}
+
+/* read_ahead_reset
+ *   DESCRIPTION: Start the sequential detection over, for a new open file
+ *   INPUTS: ra -- the readahead state
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void read_ahead_reset (readahead_t* ra)
+{
+    ra->next = 0;
+    ra->window = 0;
+    ra->queued = 0;
+}
+
+/* read_ahead
+ *   DESCRIPTION: Note a read and, while the reads stay sequential, queue the
+ *                blocks after it for the PIT to prefetch; the window doubles
+ *                with each sequential read and drops to 0 on a seek
+ *   INPUTS: ra -- the readahead state of the reader
+ *           inode -- the file read
+ *           offset -- where the read started
+ *           length -- the bytes it returned
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modify the readahead queue
+ */
+void read_ahead (readahead_t* ra, uint32_t inode, uint32_t offset, uint32_t length)
+{
+    uint32_t first, last, block_num, flags;
+    //the offsets of a compressed file do not name its blocks
+    if (!fs_disk || length == 0 || BITMAP_TEST(compmap, inode))
+        return;
+    if (offset != ra->next)
+    {
+        ra->window = 0;
+        ra->queued = 0;
+        ra->next = offset + length;
+        return;
+    }
+    if (ra->window == 0)
+        ra->window = RA_WINDOW_MIN;
+    else if (ra->window < RA_WINDOW_MAX)
+        ra->window *= 2;
+    ra->next = offset + length;
+    // the block holding the next byte is cached already unless the read ended on a boundary
+    first = (ra->next + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    last = first + ra->window;
+    block_num = (inode_length(inode) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (last > block_num)
+        last = block_num;
+    if (first < ra->queued)
+        first = ra->queued;
+    cli_and_save(flags);
+    for (; first < last && ra_tail - ra_head < RA_QUEUE_SIZE; first++)
+    {
+        ra_queue[ra_tail & (RA_QUEUE_SIZE - 1)].inode = inode;
+        ra_queue[ra_tail & (RA_QUEUE_SIZE - 1)].file_block = first;
+        ra_tail++;
+    }
+    if (first > ra->queued)
+        ra->queued = first;
+    restore_flags(flags);
+}
+
+/* read_ahead_run
+ *   DESCRIPTION: Prefetch blocks off the readahead queue, called with
+ *                interrupts off
+ *   INPUTS: max -- the most blocks to read from the disk
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fill the buffer cache
+ */
+static void read_ahead_run (uint32_t max)
+{
+    ra_request_t* req;
+    int32_t block;
+    while (ra_head != ra_tail && max > 0)
+    {
+        req = &ra_queue[ra_head & (RA_QUEUE_SIZE - 1)];
+        ra_head++;
+        //the file may have shrunk or gone since the request was queued
+        if (req->inode >= in_num || req->file_block >= (inode_length(req->inode) + BLOCK_SIZE - 1) / BLOCK_SIZE)
+            continue;
+        if ((block = inode_get_block(req->inode, req->file_block)) == -1)
+            continue;
+        if (bcache_prefetch(fs_data_start + block) == -1)
+            return;
+        max--;
+    }
+}
+
+/* inode_mark
+ *   DESCRIPTION: Mark an inode, its data and indirect blocks in the bitmaps,
+ *                and everything under it if it is a directory
+ *   INPUTS: inode -- the inode number
+ *           file_type -- the type in the dentry naming it
+ *           depth -- how many directories deep it is
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modify the bitmaps
+ */
+static void inode_mark (uint32_t inode, uint32_t file_type, uint32_t depth)
+{
+    uint32_t j, max_db;
+    int32_t block;
+    dentry_t dentry;
+    //"." and "rtc" share inode 0
+    if (inode >= in_num || BITMAP_TEST(inodemap, inode))
+        return;
+    //set inode bitmap to 1
+    BITMAP_SET(inodemap, inode);
+    inodemap_counter++;
+    //rtc and the root own no data blocks
+    if (file_type == 0 || inode == ROOT_DIR_INODE)
+        return;
+    if (file_type == FILE_TYPE_COMPRESSED)
+        BITMAP_SET(compmap, inode);
+    //get all data block number in inode and set bitmap to 1, a block seen
+    //again belongs to a clone
+    max_db = (inode_length(inode) + BLOCK_SIZE - 1)/BLOCK_SIZE;
+    for (j=0; j<max_db; j++)
+    {
+        block = inode_get_block(inode, j);
+        if (block == -1)
+            continue;
+        if (!BITMAP_TEST(bitmap, block))
+        {
+            BITMAP_SET(bitmap, block);
+            bitmap_counter++;
+        }
+        else if (block_refs[block] < BLOCK_REF_MAX)
+            block_refs[block]++;
+    }
+    //and the indirect blocks holding the block numbers
+    for (j=0; j<inode_meta_blocks(max_db); j++)
+    {
+        block = inode_meta_block(inode, j);
+        if (block != -1 && !BITMAP_TEST(bitmap, block))
+        {
+            BITMAP_SET(bitmap, block);
+            bitmap_counter++;
+        }
+    }
+    if (file_type != 1 || depth >= PATH_MAX_DEPTH)
+        return;
+    for (j=0; dir_entry_by_index(inode, j, &dentry) == 0; j++)
+        inode_mark(dentry.inode_num, dentry.file_type, depth + 1);
+}
+
+/* bitmap_find
+ *   DESCRIPTION: First fit search for clear bits, a word at a time with bsf,
+ *                starting at a hint and wrapping around
+ *   INPUTS: map -- the bitmap
+ *           nbits -- the number of bits in use
+ *           start -- the bit to start from
+ *           run -- the number of clear bits wanted in a row
+ *   OUTPUTS: none
+ *   RETURN VALUE: the first bit of a clear run of that length, else the first
+ *                 clear bit seen, -1 if every bit is set
+ *   SIDE EFFECTS: none
+ */
+static int32_t bitmap_find (const uint32_t* map, uint32_t nbits, uint32_t start, uint32_t run)
+{
+    uint32_t words = BITMAP_WORDS(nbits);
+    uint32_t w, n, bit, len, free_bits;
+    int32_t first = -1;
+    if (words == 0)
+        return -1;
+    if (start >= nbits)
+        start = 0;
+    w = start / BITMAP_WORD_BITS;
+    // bits below the start in the first word are looked at after the wrap
+    free_bits = ~map[w] & (0xFFFFFFFF << (start % BITMAP_WORD_BITS));
+    for (n = 0; n <= words; )
+    {
+        if (free_bits == 0)
+        {
+            n++;
+            w = (w + 1 == words) ? 0 : w + 1;
+            free_bits = ~map[w];
+            continue;
+        }
+        asm volatile ("bsfl %1, %0" : "=r" (bit) : "rm" (free_bits));
+        bit += w * BITMAP_WORD_BITS;
+        if (first == -1)
+            first = bit;
+        // measure the clear run from here
+        for (len = 1; len < run && bit + len < nbits && !BITMAP_TEST(map, bit + len); len++);
+        if (len >= run)
+            return bit;
+        // skip the run, its tail bits in this word are cleared from the mask
+        if ((bit + len) / BITMAP_WORD_BITS != w)
+            free_bits = 0;
+        else
+            free_bits &= 0xFFFFFFFF << ((bit + len) % BITMAP_WORD_BITS);
+    }
+    return first;
+}
+
+/* data_block_alloc
+ *   DESCRIPTION: Take a free data block, the preferred one when it is free so
+ *                files grow in contiguous runs
+ *   INPUTS: prefer -- the block wanted, usually the one after the previous block
+ *           run -- how many more blocks the caller is going to take
+ *   OUTPUTS: none
+ *   RETURN VALUE: the data block number, -1 if none is free
+ *   SIDE EFFECTS: mark the block in the bitmap and move the hint past it
+ */
+static int32_t data_block_alloc (uint32_t prefer, uint32_t run)
+{
+    int32_t block;
+    if (prefer < db_num && !BITMAP_TEST(bitmap, prefer))
+        block = prefer;
+    else
+        block = bitmap_find(bitmap, db_num, bitmap_hint, run);
+    if (block == -1)
+        return -1;
+    BITMAP_SET(bitmap, block);
+    BITMAP_CLEAR(crc_valid, block);         // no checksum until it is written
+    BITMAP_CLEAR(crc_verified, block);
+    bitmap_counter++;
+    bitmap_hint = block + 1;
+    return block;
+}
+
+/* data_block_free
+ *   DESCRIPTION: Give a data block back
+ *   INPUTS: block -- the data block number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: clear the block in the bitmap
+ */
+static void data_block_free (uint32_t block)
+{
+    if (block >= db_num || !BITMAP_TEST(bitmap, block))
+        return;
+    //a shared block stays with its other owners
+    if (block_refs[block] > 0)
+    {
+        block_refs[block]--;
+        return;
+    }
+    BITMAP_CLEAR(bitmap, block);
+    BITMAP_CLEAR(crc_valid, block);
+    BITMAP_CLEAR(crc_verified, block);
+    bitmap_counter--;
+}
+
+/* inode_alloc
+ *   DESCRIPTION: Take a free inode
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the inode number, -1 if none is free
+ *   SIDE EFFECTS: mark the inode in the inode bitmap
+ */
+static int32_t inode_alloc (void)
+{
+    int32_t inode = bitmap_find(inodemap, in_num, inodemap_hint, 1);
+    if (inode == -1)
+        return -1;
+    BITMAP_SET(inodemap, inode);
+    inodemap_counter++;
+    inodemap_hint = inode + 1;
+    return inode;
+}
+
+/* inode_free
+ *   DESCRIPTION: Give an inode back
+ *   INPUTS: inode -- the inode number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: clear the inode in the inode bitmap
+ */
+static void inode_free (uint32_t inode)
+{
+    uint32_t i;
+    if (inode >= in_num || !BITMAP_TEST(inodemap, inode))
+        return;
+    BITMAP_CLEAR(inodemap, inode);
+    inodemap_counter--;
+    if (!BITMAP_TEST(compmap, inode))
+        return;
+    BITMAP_CLEAR(compmap, inode);
+    for (i=0; i<LZ_CACHE_SIZE; i++)
+        if (lz_cache[i].inode == inode)
+            lz_cache[i].inode = INODE_NUM;
+}
+
+/* dentry_name_hash
+ *   DESCRIPTION: FNV-1a hash of a file name (at most 32 bytes, stops at NUL)
+ *   INPUTS: fname -- the file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the bucket index in dentry_hash_head
+ *   SIDE EFFECTS: none
+ */
+static uint32_t dentry_name_hash (const uint8_t* fname)
+{
+    uint32_t i;
+    uint32_t hash = 2166136261U;                // FNV offset basis
+    for (i=0; i<FILENAME_MAX_SIZE && fname[i] != '\0'; i++)
+    {
+        hash ^= fname[i];
+        hash *= 16777619U;                      // FNV prime
+    }
+    return hash & (DENTRY_HASH_SIZE - 1);
+}
+
+/* dentry_hash_insert
+ *   DESCRIPTION: Add a dentry to the head of its bucket
+ *   INPUTS: index -- the index of the dentry in the boot block
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modify the hash index
+ */
+static void dentry_hash_insert (uint32_t index)
+{
+    uint32_t bucket = dentry_name_hash(dentry_ptr[index].file_name);
+    dentry_hash_next[index] = dentry_hash_head[bucket];
+    dentry_hash_head[bucket] = index;
+}
+
+/* dentry_hash_remove
+ *   DESCRIPTION: Unlink a dentry from its bucket
+ *   INPUTS: index -- the index of the dentry in the boot block
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modify the hash index
+ */
+static void dentry_hash_remove (uint32_t index)
+{
+    int32_t* link = &dentry_hash_head[dentry_name_hash(dentry_ptr[index].file_name)];
+    while (*link != DENTRY_HASH_NONE)
+    {
+        if (*link == index)
+        {
+            *link = dentry_hash_next[index];
+            return;
+        }
+        link = &dentry_hash_next[*link];
+    }
+}
+
+/* dentry_hash_build
+ *   DESCRIPTION: Rebuild the hash index from all the dentries
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: overwrite the hash index
+ */
+static void dentry_hash_build (void)
+{
+    int32_t i;
+    for (i=0; i<DENTRY_HASH_SIZE; i++)
+        dentry_hash_head[i] = DENTRY_HASH_NONE;
+    // insert backwards so every chain keeps the lower indices in front
+    for (i=dir_num-1; i>=0; i--)
+        dentry_hash_insert(i);
+}
+
+/* trie_name_length
+ *   DESCRIPTION: Get the length of a dentry name, which is not terminated at 32 bytes
+ *   INPUTS: name -- the name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the length, at most FILENAME_MAX_SIZE
+ *   SIDE EFFECTS: none
+ */
+static uint32_t trie_name_length (const uint8_t* name)
+{
+    uint32_t len = 0;
+    while (len < FILENAME_MAX_SIZE && name[len] != '\0')
+        len++;
+    return len;
+}
+
+/* trie_child
+ *   DESCRIPTION: Find the child of a trie node for a character
+ *   INPUTS: node -- the parent
+ *           ch -- the character
+ *   OUTPUTS: none
+ *   RETURN VALUE: the child, TRIE_NONE if there is none
+ *   SIDE EFFECTS: none
+ */
+static int32_t trie_child (int32_t node, uint8_t ch)
+{
+    int32_t child;
+    for (child = trie[node].child; child != TRIE_NONE && trie[child].ch < ch; child = trie[child].sibling);
+    return (child != TRIE_NONE && trie[child].ch == ch) ? child : TRIE_NONE;
+}
+
+/* trie_find
+ *   DESCRIPTION: Walk down the trie along a prefix
+ *   INPUTS: prefix -- the characters
+ *           len -- how many
+ *   OUTPUTS: none
+ *   RETURN VALUE: the node the prefix ends at, TRIE_NONE if no name starts with it
+ *   SIDE EFFECTS: none
+ */
+static int32_t trie_find (const uint8_t* prefix, uint32_t len)
+{
+    int32_t node = 0;
+    uint32_t i;
+    for (i = 0; i < len && node != TRIE_NONE; i++)
+        node = trie_child(node, prefix[i]);
+    return node;
+}
+
+/* trie_insert
+ *   DESCRIPTION: Add a name to the trie, the children stay sorted
+ *   INPUTS: name -- the dentry name
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: take nodes off the free list
+ */
+static void trie_insert (const uint8_t* name)
+{
+    int32_t node = 0, child;
+    int16_t* link;
+    uint32_t i, len = trie_name_length(name);
+    trie[0].count++;
+    for (i = 0; i < len; i++)
+    {
+        link = &trie[node].child;
+        while (*link != TRIE_NONE && trie[*link].ch < name[i])
+            link = &trie[*link].sibling;
+        if (*link == TRIE_NONE || trie[*link].ch != name[i])
+        {
+            //TRIE_NODES covers a full root directory, the free list never runs dry
+            child = trie_free;
+            trie_free = trie[child].sibling;
+            trie[child].ch = name[i];
+            trie[child].count = 0;
+            trie[child].terminal = 0;
+            trie[child].child = TRIE_NONE;
+            trie[child].sibling = *link;
+            *link = child;
+        }
+        node = *link;
+        trie[node].count++;
+    }
+    trie[node].terminal = 1;
+}
+
+/* trie_remove
+ *   DESCRIPTION: Take a name out of the trie; the nodes no other name uses
+ *                go back on the free list
+ *   INPUTS: name -- the dentry name
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modify the trie
+ */
+static void trie_remove (const uint8_t* name)
+{
+    int32_t node = 0, next;
+    int16_t* link;
+    uint32_t i, len = trie_name_length(name);
+    next = trie_find(name, len);
+    if (next == TRIE_NONE || !trie[next].terminal)
+        return;
+    trie[next].terminal = 0;
+    trie[0].count--;
+    for (i = 0; i < len; i++)
+    {
+        link = &trie[node].child;
+        while (trie[*link].ch != name[i])
+            link = &trie[*link].sibling;
+        next = *link;
+        if (--trie[next].count == 0)
+        {
+            //nothing else below: unlink it and free the chain down to the end of the name
+            *link = trie[next].sibling;
+            while (next != TRIE_NONE)
+            {
+                node = trie[next].child;
+                trie[next].sibling = trie_free;
+                trie_free = next;
+                next = node;
+            }
+            return;
+        }
+        node = next;
+    }
+}
+
+/* trie_build
+ *   DESCRIPTION: Rebuild the trie from the root dentries
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modify the trie
+ */
+static void trie_build (void)
+{
+    uint32_t i;
+    for (i = 1; i < TRIE_NODES; i++)
+        trie[i].sibling = (i + 1 < TRIE_NODES) ? i + 1 : TRIE_NONE;
+    trie_free = 1;
+    trie[0].child = TRIE_NONE;
+    trie[0].sibling = TRIE_NONE;
+    trie[0].count = 0;
+    trie[0].terminal = 0;
+    for (i = 0; i < dir_num; i++)
+        trie_insert(dentry_ptr[i].file_name);
+}
+
+/* trie_prefix
+ *   DESCRIPTION: Count the root names starting with a prefix and find the
+ *                longest prefix they all share
+ *   INPUTS: prefix -- the characters typed
+ *           len -- how many
+ *           lcp -- gets the longest common prefix, NUL terminated,
+ *                  FILENAME_MAX_SIZE + 1 bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of names matching
+ *   SIDE EFFECTS: none
+ */
+int32_t trie_prefix (const uint8_t* prefix, uint32_t len, uint8_t* lcp)
+{
+    int32_t node;
+    if (len > FILENAME_MAX_SIZE || (node = trie_find(prefix, len)) == TRIE_NONE)
+        return 0;
+    memcpy(lcp, prefix, len);
+    //go down while there is exactly one way to go
+    while (!trie[node].terminal && trie[node].child != TRIE_NONE && trie[trie[node].child].sibling == TRIE_NONE)
+    {
+        node = trie[node].child;
+        lcp[len++] = trie[node].ch;
+    }
+    lcp[len] = '\0';
+    return trie[node].count;
+}
+
+/* trie_match
+ *   DESCRIPTION: Get the k-th root name, in sorted order, starting with a prefix
+ *   INPUTS: prefix -- the characters typed
+ *           len -- how many
+ *           k -- which match, from 0
+ *           name -- gets the name, NUL terminated, FILENAME_MAX_SIZE + 1 bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if there are not k + 1 matches
+ *   SIDE EFFECTS: none
+ */
+int32_t trie_match (const uint8_t* prefix, uint32_t len, uint32_t k, uint8_t* name)
+{
+    int32_t node, child;
+    if (len > FILENAME_MAX_SIZE || (node = trie_find(prefix, len)) == TRIE_NONE || k >= trie[node].count)
+        return -1;
+    memcpy(name, prefix, len);
+    //the counts say which subtree holds the k-th name
+    while (k >= trie[node].terminal)
+    {
+        k -= trie[node].terminal;
+        for (child = trie[node].child; k >= trie[child].count; child = trie[child].sibling)
+            k -= trie[child].count;
+        node = child;
+        name[len++] = trie[node].ch;
+    }
+    name[len] = '\0';
+    return 0;
+}
+
+/* dentry_lookup_hashed
+ *   DESCRIPTION: Find the index of a dentry by name through the hash index
+ *   INPUTS: fname -- the file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the dentry index, -1 if not found
+ *   SIDE EFFECTS: none
+ */
+int32_t dentry_lookup_hashed (const uint8_t* fname)
+{
+    int32_t i;
+    for (i=dentry_hash_head[dentry_name_hash(fname)]; i!=DENTRY_HASH_NONE; i=dentry_hash_next[i])
+    {
+        if (strncmp((int8_t*)fname, (int8_t*)dentry_ptr[i].file_name, FILENAME_MAX_SIZE) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* dentry_lookup_linear
+ *   DESCRIPTION: Find the index of a dentry by name by scanning every dentry,
+ *                kept as the reference for the hash index
+ *   INPUTS: fname -- the file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the dentry index, -1 if not found
+ *   SIDE EFFECTS: none
+ */
+int32_t dentry_lookup_linear (const uint8_t* fname)
+{
+    int32_t i;
+    for (i=0; i<boot_block_ptr->num_dir_entries; i++)
+    {
+        if (strncmp((int8_t*)fname, (int8_t*)boot_block_ptr->dir_entries[i].file_name, FILENAME_MAX_SIZE) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* dcache_slot
+ *   DESCRIPTION: Find the dentry cache slot of a name in a directory
+ *   INPUTS: parent -- the inode of the directory
+ *           name -- the name, at most 32 bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: the slot
+ *   SIDE EFFECTS: none
+ */
+static dcache_entry_t* dcache_slot (uint32_t parent, const uint8_t* name)
+{
+    return &dcache[(dentry_name_hash(name) ^ (parent * 2654435761U)) & (DCACHE_SIZE - 1)];
+}
+
+/* dcache_remove
+ *   DESCRIPTION: Drop a name from the dentry cache once it leaves its directory
+ *   INPUTS: parent -- the inode of the directory
+ *           name -- the name
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modify the dentry cache
+ */
+static void dcache_remove (uint32_t parent, const uint8_t* name)
+{
+    dcache_entry_t* e = dcache_slot(parent, name);
+    if (e->parent == parent && strncmp((int8_t*)e->file_name, (int8_t*)name, FILENAME_MAX_SIZE) == 0)
+        e->parent = DCACHE_EMPTY;
+}
+
+/* dir_entry_by_index
+ *   DESCRIPTION: Read the dentry at an index of a directory
+ *   INPUTS: dir -- the inode of the directory, ROOT_DIR_INODE for the boot block
+ *           index -- the index of the entry
+ *           dentry -- the directory entry
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 past the last entry
+ *   SIDE EFFECTS: none
+ */
+int32_t dir_entry_by_index (uint32_t dir, uint32_t index, dentry_t* dentry)
+{
+    if (dir == ROOT_DIR_INODE)
+        return read_dentry_by_index(index, dentry);
+    if (read_data(dir, index * sizeof(dentry_t), (uint8_t*)dentry, sizeof(dentry_t)) != sizeof(dentry_t))
+        return -1;
+    return 0;
+}
+
+/* subdir_find
+ *   DESCRIPTION: Find a name in a subdirectory, reading it a block at a time
+ *   INPUTS: dir -- the inode of the directory, not ROOT_DIR_INODE
+ *           name -- the name
+ *           dentry -- the directory entry found
+ *   OUTPUTS: none
+ *   RETURN VALUE: the index of the entry, -1 if not found
+ *   SIDE EFFECTS: none
+ */
+static int32_t subdir_find (uint32_t dir, const uint8_t* name, dentry_t* dentry)
+{
+    uint32_t offset, i;
+    int32_t got;
+    for (offset = 0; ; offset += BLOCK_SIZE)
+    {
+        got = read_data(dir, offset, (uint8_t*)dir_block, BLOCK_SIZE);
+        if (got <= 0)
+            return -1;
+        for (i = 0; i < got / sizeof(dentry_t); i++)
+        {
+            if (strncmp((int8_t*)name, (int8_t*)dir_block[i].file_name, FILENAME_MAX_SIZE) == 0)
+            {
+                *dentry = dir_block[i];
+                return offset / sizeof(dentry_t) + i;
+            }
+        }
+        if (got < BLOCK_SIZE)
+            return -1;
+    }
+}
+
+/* dir_lookup
+ *   DESCRIPTION: Find a name in one directory, through the dentry cache
+ *   INPUTS: dir -- the inode of the directory
+ *           name -- the name, NUL terminated
+ *           dentry -- the directory entry found
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if not found
+ *   SIDE EFFECTS: fill the dentry cache on a miss
+ */
+static int32_t dir_lookup (uint32_t dir, const uint8_t* name, dentry_t* dentry)
+{
+    dcache_entry_t* e = dcache_slot(dir, name);
+    int32_t i;
+    if (e->parent == dir && strncmp((int8_t*)e->file_name, (int8_t*)name, FILENAME_MAX_SIZE) == 0)
     {
-        inodemap[i] = 0;
-        inodemap_counter = 0;
+        memcpy(dentry->file_name, e->file_name, FILENAME_MAX_SIZE);
+        dentry->file_type = e->file_type;
+        dentry->inode_num = e->inode_num;
+        return 0;
     }
-    // initialize bitmap
-    for (i=0; i<db_num; i++)
+    if (dir == ROOT_DIR_INODE)
     {
-        bitmap[i] = 0;
-        bitmap_counter = 0;
+        if ((i = dentry_lookup_hashed(name)) == -1)
+            return -1;
+        read_dentry_by_index(i, dentry);
     }
-    for (i=0; i<dir_num; i++)
+    else if (subdir_find(dir, name, dentry) == -1)
+    {
+        return -1;
+    }
+    e->parent = dir;
+    memcpy(e->file_name, dentry->file_name, FILENAME_MAX_SIZE);
+    e->file_type = dentry->file_type;
+    e->inode_num = dentry->inode_num;
+    return 0;
+}
+
+/* path_lookup
+ *   DESCRIPTION: Resolve a "/" separated path from the root one directory at a time
+ *   INPUTS: path -- the path, "." components are skipped
+ *           dentry -- the directory entry of the last component
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: fill the dentry cache
+ */
+int32_t path_lookup (const uint8_t* path, dentry_t* dentry)
+{
+    uint8_t name[FILENAME_MAX_SIZE + 1];
+    uint32_t len;
+    if (path[0] == '\0')
+        return -1;
+    // start from the root directory
+    memset(dentry, 0, sizeof(dentry_t));
+    dentry->file_name[0] = '.';
+    dentry->file_type = 1;
+    dentry->inode_num = ROOT_DIR_INODE;
+    while (1)
     {
-        //get inode number
-        inode_num_ = dentry_ptr[i].inode_num;
-        //set inode bitmap to 1
-        inodemap[inode_num_] = 1;
-        inodemap_counter++;
-        //get all data block number in inode and set bitmap to 1
-        max_db = inode_ptr[inode_num_].length_in_B/BLOCK_SIZE;
-        for (j=0; j<=max_db; j++)
+        while (*path == '/')
+            path++;
+        if (*path == '\0')
+            return 0;
+        if (dentry->file_type != 1)         // only a directory has entries
+            return -1;
+        for (len = 0; path[len] != '\0' && path[len] != '/'; len++)
         {
-            bitmap[inode_ptr[inode_num_].data_blocks[j]] = 1;
-            bitmap_counter++;
+            if (len == FILENAME_MAX_SIZE)
+                return -1;
         }
+        memcpy(name, path, len);
+        name[len] = '\0';
+        path += len;
+        if (len == 1 && name[0] == '.')
+            continue;
+        if (dir_lookup(dentry->inode_num, name, dentry) == -1)
+            return -1;
     }
-
 }
 
+/* path_parent
+ *   DESCRIPTION: Split a path into the directory holding the last component and its name
+ *   INPUTS: path -- the path
+ *           parent -- the directory entry of the directory
+ *           name -- gets the last component, FILENAME_MAX_SIZE + 1 bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+static int32_t path_parent (const uint8_t* path, dentry_t* parent, uint8_t* name)
+{
+    uint8_t dir_path[PATH_MAX_SIZE + 1];
+    int32_t i, slash, len;
+    slash = -1;
+    for (i = 0; path[i] != '\0'; i++)
+    {
+        if (i == PATH_MAX_SIZE)
+            return -1;
+        if (path[i] == '/')
+            slash = i;
+    }
+    len = i - slash - 1;
+    if (len <= 0 || len > FILENAME_MAX_SIZE)
+        return -1;
+    memcpy(name, path + slash + 1, len);
+    name[len] = '\0';
+    memcpy(dir_path, path, slash + 1);
+    dir_path[slash + 1] = '\0';
+    if (slash == -1)
+        dir_path[0] = '.', dir_path[1] = '\0';
+    if (path_lookup(dir_path, parent) == -1 || parent->file_type != 1)
+        return -1;
+    return 0;
+}
 
 /* read_dentry_by_name
  *   DESCRIPTION: Read the directory entry by name
- *   INPUTS: fname -- the file name
+ *   INPUTS: fname -- the file name, or a path through subdirectories
  *           dentry -- the directory entry
  *   OUTPUTS: none
  *   RETURN VALUE: 0 on success, -1 on failure
@@ -78,44 +1238,32 @@ void file_system_init (uint32_t start_addr)
  */
 int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry)
 {
-    int i;
     if (fname == NULL || dentry == NULL)    // check for null pointers
         return -1;
-    if (strlen((int8_t*)fname) > FILENAME_MAX_SIZE)        // check for invalid length
+    if (strlen((int8_t*)fname) > PATH_MAX_SIZE)            // check for invalid length
         return -1;
 
-    for (i=0; i<boot_block_ptr->num_dir_entries; i++)
-    {
-        if (strncmp((int8_t*)fname, (int8_t*)boot_block_ptr->dir_entries[i].file_name, FILENAME_MAX_SIZE) == 0)
-        {
-            // dentry->file_name = boot_block_ptr->dir_entries[i].file_name;
-            strncpy((int8_t*)dentry->file_name, (int8_t*)boot_block_ptr->dir_entries[i].file_name, FILENAME_MAX_SIZE);  //copy dentry
-            dentry->file_type = boot_block_ptr->dir_entries[i].file_type;
-            dentry->inode_num = boot_block_ptr->dir_entries[i].inode_num;
-            return 0;
-        }
-    }
-    // If the file name not found, return -1
-    return -1;
+    // If the path not found, return -1
+    return path_lookup(fname, dentry);
 }
 
+/* return_dentry_index
+ *   DESCRIPTION: Find the index of the directory entry by name
+ *   INPUTS: fname -- the file name
+ *           dentry -- the directory entry
+ *   OUTPUTS: none
+ *   RETURN VALUE: the dentry index, -1 on failure
+ *   SIDE EFFECTS: none
+ */
 int32_t return_dentry_index (const uint8_t* fname, dentry_t* dentry)
 {
-    int i;
     if (fname == NULL || dentry == NULL)    // check for null pointers
         return -1;
     if (strlen((int8_t*)fname) > FILENAME_MAX_SIZE)        // check for invalid length
         return -1;
 
-    for (i=0; i<boot_block_ptr->num_dir_entries; i++)
-    {
-        if (strncmp((int8_t*)fname, (int8_t*)boot_block_ptr->dir_entries[i].file_name, FILENAME_MAX_SIZE) == 0)
-        {
-            return i;
-        }
-    }
     // If the file name not found, return -1
-    return -1;
+    return dentry_lookup_hashed(fname);
 }
 /* read_dentry_by_index
  *   DESCRIPTION: Read the directory entry by index
@@ -143,23 +1291,39 @@ int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry)
 }
 
 /* read_directory
- *   DESCRIPTION: Read the directory
+ *   DESCRIPTION: Read the root directory
  *   INPUTS: 
  *           buf -- the buffer to store the data
  *           index -- index of the dentry node
  *   OUTPUTS: none
- *   RETURN VALUE: 0
+ *   RETURN VALUE: the length of the name, 0 at the end, -1 past it
  *   SIDE EFFECTS: none
  */
 int32_t read_directory (uint8_t* buf, uint32_t index)
+{
+    return read_directory_in(ROOT_DIR_INODE, buf, index);
+}
+
+/* read_directory_in
+ *   DESCRIPTION: Read the name of one entry of a directory
+ *   INPUTS: dir -- the inode of the directory
+ *           buf -- the buffer to store the data
+ *           index -- index of the dentry node
+ *   OUTPUTS: none
+ *   RETURN VALUE: the length of the name, 0 at the end, -1 past it
+ *   SIDE EFFECTS: none
+ */
+int32_t read_directory_in (uint32_t dir, uint8_t* buf, uint32_t index)
 {
     dentry_t dentry;
     int32_t i;
     int32_t count;
-    if (index == boot_block_ptr->num_dir_entries)       // check for invalid index
-        return 0;
-    if (read_dentry_by_index(index, &dentry) == -1)
-        return -1;                                      // return 0 if reached to the end
+    if (dir_entry_by_index(dir, index, &dentry) == -1)  // return 0 if reached to the end
+    {
+        if (index == ((dir == ROOT_DIR_INODE) ? dir_num : inode_length(dir) / sizeof(dentry_t)))
+            return 0;
+        return -1;
+    }
     count = 0;
     for(i=0; i<FILENAME_MAX_SIZE;i++)                             
     {
@@ -187,8 +1351,421 @@ int32_t read_directory (uint8_t* buf, uint32_t index)
     // }
 }
 
-/* read_data
- *   DESCRIPTION: Read the data
+/* block_read
+ *   DESCRIPTION: Copy bytes out of a run of contiguous data blocks, from the
+ *                module image or through the buffer cache, checking each
+ *                block against its checksum in verify-on-read mode the
+ *                first time it is read after a change
+ *   INPUTS: block -- the first data block number
+ *           offset -- the byte offset from the start of that block
+ *           buf -- the destination
+ *           length -- the number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a disk error or a checksum mismatch
+ *   SIDE EFFECTS: none
+ */
+static int32_t block_read (uint32_t block, uint32_t offset, uint8_t* buf, uint32_t length)
+{
+    uint32_t done, copy, flags, i;
+    int32_t ret;
+    uint8_t* data;
+    if (!fs_disk)
+    {
+        if (fs_crc_verify && length > 0)
+            for (i = block + offset / BLOCK_SIZE; i <= block + (offset + length - 1) / BLOCK_SIZE; i++)
+                if (crc_verify(i, data_block_ptr[i].data) == -1)
+                    return -1;
+        memcpy(buf, data_block_ptr[block].data + offset, length);
+        return 0;
+    }
+    block += offset / BLOCK_SIZE;
+    offset %= BLOCK_SIZE;
+    for (done = 0; done < length; done += copy, block++, offset = 0)
+    {
+        copy = BLOCK_SIZE - offset;
+        if (copy > length - done)
+            copy = length - done;
+        //the buffer is only ours until the next bcache_get, keep the PIT out
+        cli_and_save(flags);
+        ret = -1;
+        data = bcache_get(fs_data_start + block, 0);
+        if (data != NULL && (!fs_crc_verify || crc_verify(block, data) == 0))
+        {
+            memcpy(buf + done, data + offset, copy);
+            ret = 0;
+        }
+        restore_flags(flags);
+        if (ret == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/* block_write
+ *   DESCRIPTION: Copy bytes into one data block
+ *   INPUTS: block -- the data block number
+ *           offset -- the byte offset inside it
+ *           buf -- the source, NULL to fill with zeros
+ *           length -- the number of bytes, not past the end of the block
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a disk error
+ *   SIDE EFFECTS: the cached block is written back later, its checksum is updated
+ */
+static int32_t block_write (uint32_t block, uint32_t offset, const uint8_t* buf, uint32_t length)
+{
+    uint32_t flags;
+    uint8_t* data;
+    if (!fs_disk)
+        data = data_block_ptr[block].data;
+    else
+    {
+        cli_and_save(flags);
+        if ((data = bcache_get(fs_data_start + block, 1)) == NULL)
+        {
+            restore_flags(flags);
+            return -1;
+        }
+    }
+    if (buf == NULL)
+        memset(data + offset, 0, length);
+    else
+        memcpy(data + offset, buf, length);
+    crc_update(block, data);
+    if (fs_disk)
+        restore_flags(flags);
+    return crc_store(block);
+}
+
+/* block_ptr_get
+ *   DESCRIPTION: Read a block number out of an indirect block
+ *   INPUTS: block -- the indirect block
+ *           idx -- which of its BLOCK_PTRS entries
+ *   OUTPUTS: none
+ *   RETURN VALUE: the block number, db_num (never valid) on a disk error
+ *   SIDE EFFECTS: none
+ */
+static uint32_t block_ptr_get (uint32_t block, uint32_t idx)
+{
+    uint32_t ptr;
+    if (block_read(block, idx * sizeof(uint32_t), (uint8_t*)&ptr, sizeof(uint32_t)) == -1)
+        return db_num;
+    return ptr;
+}
+
+/* block_ptr_set
+ *   DESCRIPTION: Write a block number into an indirect block
+ *   INPUTS: block -- the indirect block
+ *           idx -- which of its BLOCK_PTRS entries
+ *           ptr -- the block number
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a disk error
+ *   SIDE EFFECTS: none
+ */
+static int32_t block_ptr_set (uint32_t block, uint32_t idx, uint32_t ptr)
+{
+    return block_write(block, idx * sizeof(uint32_t), (uint8_t*)&ptr, sizeof(uint32_t));
+}
+
+/* inode_max_blocks
+ *   DESCRIPTION: Get the most data blocks one file can have in this image
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of blocks
+ *   SIDE EFFECTS: none
+ */
+static uint32_t inode_max_blocks (void)
+{
+    if (inode2_ptr == NULL)
+        return MAX_DATA_BLOCK_SIZE;
+    return DB_NUM;              // the double indirect reaches further than any image
+}
+
+/* inode_meta_blocks
+ *   DESCRIPTION: Count the indirect blocks a file of some size needs
+ *   INPUTS: block_num -- the number of data blocks in the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of indirect blocks, 0 for the original format
+ *   SIDE EFFECTS: none
+ */
+static uint32_t inode_meta_blocks (uint32_t block_num)
+{
+    if (inode2_ptr == NULL || block_num <= INODE2_DIRECT)
+        return 0;
+    if (block_num <= INODE2_SINGLE_END)
+        return 1;
+    // the indirect, the double indirect and the indirect blocks under it
+    return 2 + (block_num - INODE2_SINGLE_END + BLOCK_PTRS - 1) / BLOCK_PTRS;
+}
+
+/* inode_meta_block
+ *   DESCRIPTION: Find an indirect block of a file
+ *   INPUTS: inode -- the inode number
+ *           idx -- 0 for the indirect, 1 for the double indirect, 2 and up
+ *                  for the indirect blocks under the double indirect
+ *   OUTPUTS: none
+ *   RETURN VALUE: the data block number, -1 if it is not valid
+ *   SIDE EFFECTS: none
+ */
+static int32_t inode_meta_block (uint32_t inode, uint32_t idx)
+{
+    uint32_t block;
+    if (inode2_ptr == NULL)
+        return -1;
+    if (idx == 0)
+        block = inode2_ptr[inode].indirect;
+    else if (idx == 1)
+        block = inode2_ptr[inode].double_indirect;
+    else
+    {
+        if (idx - 2 >= BLOCK_PTRS || inode2_ptr[inode].double_indirect >= db_num)
+            return -1;
+        block = block_ptr_get(inode2_ptr[inode].double_indirect, idx - 2);
+    }
+    return (block < db_num) ? (int32_t)block : -1;
+}
+
+/* inode_get_block
+ *   DESCRIPTION: Find where a block of a file sits on the image
+ *   INPUTS: inode -- the inode number
+ *           idx -- the block index inside the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: the data block number, -1 if it is not valid
+ *   SIDE EFFECTS: none
+ */
+static int32_t inode_get_block (uint32_t inode, uint32_t idx)
+{
+    uint32_t block, mid;
+    if (inode2_ptr == NULL)
+    {
+        if (idx >= MAX_DATA_BLOCK_SIZE)
+            return -1;
+        block = inode_ptr[inode].data_blocks[idx];
+    }
+    else if (idx < INODE2_DIRECT)
+        block = inode2_ptr[inode].direct[idx];
+    else if (idx < INODE2_SINGLE_END)
+    {
+        if (inode2_ptr[inode].indirect >= db_num)
+            return -1;
+        block = block_ptr_get(inode2_ptr[inode].indirect, idx - INODE2_DIRECT);
+    }
+    else
+    {
+        idx -= INODE2_SINGLE_END;
+        if (idx / BLOCK_PTRS >= BLOCK_PTRS || inode2_ptr[inode].double_indirect >= db_num)
+            return -1;
+        mid = block_ptr_get(inode2_ptr[inode].double_indirect, idx / BLOCK_PTRS);
+        if (mid >= db_num)
+            return -1;
+        block = block_ptr_get(mid, idx % BLOCK_PTRS);
+    }
+    return (block < db_num) ? (int32_t)block : -1;
+}
+
+/* inode_set_block
+ *   DESCRIPTION: Record where a block of a file sits; blocks are added in
+ *                order, so the indirect blocks are taken at the first index
+ *                they cover
+ *   INPUTS: inode -- the inode number
+ *           idx -- the block index inside the file
+ *           block -- the data block number
+ *           grow -- 1 if idx is a new block past the end, 0 to replace one
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if no block is left for an indirect block
+ *                 or on a disk error
+ *   SIDE EFFECTS: may take indirect blocks from the bitmap, given back if it fails
+ */
+static int32_t inode_set_block (uint32_t inode, uint32_t idx, uint32_t block, uint32_t grow)
+{
+    int32_t meta, top = -1, ret = 0;
+    inode2_t* ino;
+    extent_invalidate(inode);
+    if (inode2_ptr == NULL)
+    {
+        inode_ptr[inode].data_blocks[idx] = block;
+        fs_meta_dirty(&inode_ptr[inode].data_blocks[idx]);
+        return 0;
+    }
+    ino = &inode2_ptr[inode];
+    if (idx < INODE2_DIRECT)
+    {
+        ino->direct[idx] = block;
+        fs_meta_dirty(ino);
+        return 0;
+    }
+    if (idx < INODE2_SINGLE_END)
+    {
+        if (grow && idx == INODE2_DIRECT)
+        {
+            if ((top = data_block_alloc(db_num, 1)) == -1)
+                return -1;
+            ino->indirect = top;
+            fs_meta_dirty(ino);
+        }
+        if (block_ptr_set(ino->indirect, idx - INODE2_DIRECT, block) == -1)
+        {
+            data_block_free(top);
+            return -1;
+        }
+        return 0;
+    }
+    idx -= INODE2_SINGLE_END;
+    if (grow && idx == 0)
+    {
+        if ((top = data_block_alloc(db_num, 1)) == -1)
+            return -1;
+        ino->double_indirect = top;
+        fs_meta_dirty(ino);
+    }
+    meta = -1;
+    if (grow && idx % BLOCK_PTRS == 0)
+    {
+        if ((meta = data_block_alloc(db_num, 1)) == -1 ||
+            block_ptr_set(ino->double_indirect, idx / BLOCK_PTRS, meta) == -1)
+            ret = -1;
+    }
+    if (ret == 0)
+        ret = block_ptr_set(block_ptr_get(ino->double_indirect, idx / BLOCK_PTRS), idx % BLOCK_PTRS, block);
+    if (ret == -1)
+    {
+        //the indirect blocks taken here hold nothing yet
+        data_block_free(meta);
+        data_block_free(top);
+    }
+    return ret;
+}
+
+/* inode_set_length
+ *   DESCRIPTION: Set the length of a file
+ *   INPUTS: inode -- the inode number
+ *           length -- the length in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modify the inode
+ */
+static void inode_set_length (uint32_t inode, uint32_t length)
+{
+    if (inode2_ptr == NULL)
+    {
+        inode_ptr[inode].length_in_B = length;
+        fs_meta_dirty(&inode_ptr[inode]);
+    }
+    else
+    {
+        inode2_ptr[inode].length_in_B = length;
+        fs_meta_dirty(&inode2_ptr[inode]);
+    }
+}
+
+/* extent_invalidate
+ *   DESCRIPTION: Forget the cached run of a file whose blocks change
+ *   INPUTS: inode -- the inode number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modify the extent cache
+ */
+static void extent_invalidate (uint32_t inode)
+{
+    extent_t* e = &extent_cache[inode & (EXTENT_CACHE_SIZE - 1)];
+    if (e->inode == inode)
+        e->inode = INODE_NUM;
+}
+
+/* inode_extent
+ *   DESCRIPTION: Find the run of contiguous data blocks that starts at a
+ *                block of a file, from the extent cache when it covers it
+ *   INPUTS: inode -- the inode number
+ *           idx -- the block index inside the file
+ *           block_num -- the number of blocks in the file
+ *           count -- gets the number of blocks in the run
+ *   OUTPUTS: none
+ *   RETURN VALUE: the data block number of the block, -1 if it is not valid
+ *   SIDE EFFECTS: fill the extent cache on a miss
+ */
+static int32_t inode_extent (uint32_t inode, uint32_t idx, uint32_t block_num, uint32_t* count)
+{
+    extent_t* e = &extent_cache[inode & (EXTENT_CACHE_SIZE - 1)];
+    int32_t block, next;
+    uint32_t n;
+    if (e->inode != inode || idx < e->file_block || idx >= e->file_block + e->count)
+    {
+        if ((block = inode_get_block(inode, idx)) == -1)
+            return -1;
+        for (n = 1; n < EXTENT_MAX_BLOCKS && idx + n < block_num; n++)
+        {
+            next = inode_get_block(inode, idx + n);
+            if (next != block + n)
+                break;
+        }
+        e->inode = inode;
+        e->file_block = idx;
+        e->data_block = block;
+        e->count = n;
+    }
+    *count = e->count - (idx - e->file_block);
+    return e->data_block + (idx - e->file_block);
+}
+
+/* inode_length
+ *   DESCRIPTION: Get the length of a file
+ *   INPUTS: inode -- the inode number
+ *   OUTPUTS: none
+ *   RETURN VALUE: the length in bytes, 0 for an invalid inode
+ *   SIDE EFFECTS: none
+ */
+uint32_t inode_length (uint32_t inode)
+{
+    if (inode >= in_num)
+        return 0;
+    if (inode2_ptr != NULL)
+        return inode2_ptr[inode].length_in_B;
+    return inode_ptr[inode].length_in_B;
+}
+
+/* file_length
+ *   DESCRIPTION: Get the length of a file as read_data sees it, which for a
+ *                compressed file is the length before compression
+ *   INPUTS: inode -- the inode number
+ *   OUTPUTS: none
+ *   RETURN VALUE: the length in bytes, 0 for an invalid inode
+ *   SIDE EFFECTS: none
+ */
+uint32_t file_length (uint32_t inode)
+{
+    lz_header_t header;
+    if (inode >= in_num || !BITMAP_TEST(compmap, inode))
+        return inode_length(inode);
+    if (read_stored(inode, 0, (uint8_t*)&header, sizeof(header)) != sizeof(header) || header.magic != LZ_MAGIC)
+        return 0;
+    return header.length;
+}
+
+/* inode_block_addr
+ *   DESCRIPTION: Get where a block of a file sits in the in-memory image
+ *   INPUTS: inode -- the inode number
+ *           block -- the block index inside the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: the address of the data block, NULL if out of the file,
+ *                 if the file is compressed, or if the image is on the disk,
+ *                 cache buffers do not stay put
+ *   SIDE EFFECTS: none
+ */
+uint8_t* inode_block_addr (uint32_t inode, uint32_t block)
+{
+    int32_t data_block;
+    if (inode >= in_num || fs_disk || BITMAP_TEST(compmap, inode))
+        return NULL;
+    if (block >= (inode_length(inode) + BLOCK_SIZE - 1) / BLOCK_SIZE)
+        return NULL;
+    if ((data_block = inode_get_block(inode, block)) == -1)
+        return NULL;
+    return data_block_ptr[data_block].data;
+}
+
+/* read_stored
+ *   DESCRIPTION: Read the bytes a file keeps in its blocks; every run of
+ *                contiguous data blocks is copied with one memcpy, the runs
+ *                come from the extent cache
  *   INPUTS: inode -- the inode number
  *           offset -- the offset of the data
  *           buf -- the buffer to store the data
@@ -197,82 +1774,213 @@ int32_t read_directory (uint8_t* buf, uint32_t index)
  *   RETURN VALUE: the number of bytes read
  *   SIDE EFFECTS: none
  */
-int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length)
+static int32_t read_stored (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length)
 {
+    uint32_t block_idx, block_offset, block_num;
+    uint32_t run, span;
+    uint32_t counter;
+    uint32_t read_limit, file_length;
+    int32_t block;
 
-    uint32_t start_block_idx, end_block_idx;
-    uint32_t start_block_offset, end_block_offset;
-    uint32_t counter, i;
-    uint32_t read_limit;
-
-    if (inode < 0 || inode >= boot_block_ptr->num_inodes)       // check for invalid inode
+    if (inode < 0 || inode >= in_num)                           // check for invalid inode
         return -1;
     if (buf == NULL)                                            // check for null pointer
         return -1;
-    if (offset < 0 || offset > inode_ptr[inode].length_in_B)              // check for invalid offset
+    file_length = inode_length(inode);
+    if (offset < 0 || offset > file_length)                     // check for invalid offset
         return -1;
-    if (offset == inode_ptr[inode].length_in_B)             // check for end of file
+    if (offset == file_length)                                  // check for end of file
         return 0;
 
-    if (offset+length > inode_ptr[inode].length_in_B)        // check for invalid length
-        read_limit = inode_ptr[inode].length_in_B - offset;
+    if (length > file_length - offset)                          // check for invalid length
+        read_limit = file_length - offset;
     else
         read_limit = length;
 
     // If valid parameters
-    start_block_idx = offset / BLOCK_SIZE;
-    end_block_idx = (offset + read_limit - 1) / BLOCK_SIZE;
-    start_block_offset = offset % BLOCK_SIZE;
-    end_block_offset = (offset + read_limit - 1) % BLOCK_SIZE;
-
-    for (i=start_block_idx; i<=end_block_idx; i++)
+    block_num = (file_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    block_idx = offset / BLOCK_SIZE;
+    block_offset = offset % BLOCK_SIZE;
+    counter = 0;
+    while (counter < read_limit)
     {
-        if (inode_ptr[inode].data_blocks[i] < 0 || inode_ptr[inode].data_blocks[i] >= boot_block_ptr->num_data_blocks)       // check for invalid data block
-            // clean buffer
+        if ((block = inode_extent(inode, block_idx, block_num, &run)) == -1)
+            return -1;                                          // check for invalid data block
+        span = run * BLOCK_SIZE - block_offset;
+        if (span > read_limit - counter)
+            span = read_limit - counter;
+        if (block_read(block, block_offset, buf+counter, span) == -1)
             return -1;
+        counter += span;
+        block_idx += run;
+        block_offset = 0;
     }
+    return counter;
+}
 
-    // If valid data blocks
-    // if start block and end block are the same
-    if (start_block_idx == end_block_idx)
+/* lz_decompress
+ *   DESCRIPTION: Expand one LZ4 block: a token with the literal and match
+ *                lengths, the literals, then a 2 byte offset back into the
+ *                output; the last sequence has literals only
+ *   INPUTS: src -- the compressed bytes
+ *           src_len -- their number
+ *           dst -- the output
+ *           dst_len -- room in the output
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of bytes written, -1 if the block is malformed
+ *   SIDE EFFECTS: none
+ */
+int32_t lz_decompress (const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len)
+{
+    uint32_t in = 0, out = 0, len, offset, i;
+    uint8_t token, extra;
+    while (in < src_len)
     {
-        // same_flag = 1;
-        for (counter=0; counter<read_limit; counter++)
+        token = src[in++];
+        len = token >> 4;
+        if (len == 15)
         {
-            buf[counter] = data_block_ptr[inode_ptr[inode].data_blocks[start_block_idx]]
-                            .data[start_block_offset + counter];
+            do {
+                if (in >= src_len)
+                    return -1;
+                extra = src[in++];
+                len += extra;
+            } while (extra == 255);
         }
-        return counter;
-    }
-    // if start block and end block are different
-    else
-    {
-        // same_flag = 0;
-        for (counter=0; counter<BLOCK_SIZE-start_block_offset; counter++)
+        if (len > src_len - in || len > dst_len - out)
+            return -1;
+        memcpy(dst + out, src + in, len);
+        in += len;
+        out += len;
+        if (in == src_len)
+            break;
+        if (src_len - in < 2)
+            return -1;
+        offset = src[in] | (src[in + 1] << 8);
+        in += 2;
+        if (offset == 0 || offset > out)
+            return -1;
+        len = token & 0x0F;
+        if (len == 15)
         {
-            buf[counter] = data_block_ptr[inode_ptr[inode].data_blocks[start_block_idx]]
-                            .data[start_block_offset + counter];
+            do {
+                if (in >= src_len)
+                    return -1;
+                extra = src[in++];
+                len += extra;
+            } while (extra == 255);
         }
+        len += LZ_MIN_MATCH;
+        if (len > dst_len - out)
+            return -1;
+        //a match closer than its length repeats bytes it is copying, go a byte at a time then
+        if (offset >= len)
+            memcpy(dst + out, dst + out - offset, len);
+        else
+            for (i = 0; i < len; i++)
+                dst[out + i] = dst[out + i - offset];
+        out += len;
     }
+    return out;
+}
 
-    // middle blocks
-    for (i=start_block_idx+1; i<end_block_idx; i++)
+/* lz_block
+ *   DESCRIPTION: Get one block of a compressed file decompressed, from the
+ *                cache or by reading and expanding it; call with interrupts
+ *                off, the slot is only ours until the next call
+ *   INPUTS: inode -- the inode number
+ *           block -- the block index inside the uncompressed file
+ *           length -- the uncompressed length of the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: the BLOCK_SIZE bytes of the block, NULL on a bad block
+ *   SIDE EFFECTS: may replace a cached block
+ */
+static uint8_t* lz_block (uint32_t inode, uint32_t block, uint32_t length)
+{
+    lz_cache_t* slot = &lz_cache[(inode + block) & (LZ_CACHE_SIZE - 1)];
+    uint32_t range[2], raw;
+    if (slot->inode == inode && slot->block == block)
+    {
+        lz_hits++;
+        return slot->data;
+    }
+    lz_misses++;
+    slot->inode = INODE_NUM;
+    raw = (length - block * BLOCK_SIZE < BLOCK_SIZE) ? length - block * BLOCK_SIZE : BLOCK_SIZE;
+    if (read_stored(inode, LZ_HEADER_SIZE + block * sizeof(uint32_t), (uint8_t*)range, sizeof(range)) != sizeof(range))
+        return NULL;
+    if (range[1] < range[0] || range[1] - range[0] > raw)
+        return NULL;
+    //a block compression did not shrink is kept as it is
+    if (range[1] - range[0] == raw)
     {
-        memcpy(buf+counter, data_block_ptr[inode_ptr[inode].data_blocks[i]].data, BLOCK_SIZE);
-        counter += BLOCK_SIZE;
+        if (read_stored(inode, range[0], slot->data, raw) != (int32_t)raw)
+            return NULL;
     }
+    else if (read_stored(inode, range[0], lz_in, range[1] - range[0]) != (int32_t)(range[1] - range[0]) ||
+             lz_decompress(lz_in, range[1] - range[0], slot->data, raw) != (int32_t)raw)
+        return NULL;
+    slot->inode = inode;
+    slot->block = block;
+    return slot->data;
+}
 
-    // end block
-    for (i=0; i<end_block_offset; i++)
+/* read_compressed
+ *   DESCRIPTION: Read a compressed file block by block through the cache of
+ *                decompressed blocks
+ *   INPUTS: inode -- the inode number
+ *           offset -- the offset in the uncompressed file
+ *           buf -- the buffer to store the data
+ *           length -- the length of the data
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of bytes read, -1 on failure
+ *   SIDE EFFECTS: may replace cached blocks
+ */
+static int32_t read_compressed (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length)
+{
+    uint32_t file_len, counter, span, block_offset, flags;
+    uint8_t* data;
+    file_len = file_length(inode);
+    if (offset > file_len)
+        return -1;
+    if (length > file_len - offset)
+        length = file_len - offset;
+    for (counter = 0; counter < length; counter += span)
     {
-        buf[counter] = data_block_ptr[inode_ptr[inode].data_blocks[end_block_idx]]
-                        .data[i];
-        counter++;
+        block_offset = (offset + counter) % BLOCK_SIZE;
+        span = BLOCK_SIZE - block_offset;
+        if (span > length - counter)
+            span = length - counter;
+        cli_and_save(flags);
+        data = lz_block(inode, (offset + counter) / BLOCK_SIZE, file_len);
+        if (data != NULL)
+            memcpy(buf + counter, data + block_offset, span);
+        restore_flags(flags);
+        if (data == NULL)
+            return -1;
     }
-    
     return counter;
 }
 
+/* read_data
+ *   DESCRIPTION: Read the data of a file, compressed files come out expanded
+ *   INPUTS: inode -- the inode number
+ *           offset -- the offset of the data
+ *           buf -- the buffer to store the data
+ *           length -- the length of the data
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of bytes read, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length)
+{
+    if (inode >= in_num || buf == NULL)
+        return -1;
+    if (BITMAP_TEST(compmap, inode))
+        return read_compressed(inode, offset, buf, length);
+    return read_stored(inode, offset, buf, length);
+}
+
 
 /* -------------------- System call functions -------------------- */
 
@@ -318,23 +2026,26 @@ int32_t file_read (int32_t fd, void* buf, int32_t nbytes)
     int32_t pid = get_pid();
     process_control_block_t* pcb = get_pcb_by_pid(pid);
     int32_t bytes_read;
-    bytes_read = read_data(pcb->fds[fd].inode, 
-            pcb->fds[fd].file_position, buf, nbytes);
+    if (pcb->fds[fd]->file_position >= file_length(pcb->fds[fd]->inode))    // a seek may go past the end
+        return 0;
+    bytes_read = read_data(pcb->fds[fd]->inode, 
+            pcb->fds[fd]->file_position, buf, nbytes);
 
     if (bytes_read == -1)           // if read_data fails, return -1
         return -1;
-    pcb->fds[fd].file_position += bytes_read;
+    read_ahead(&pcb->fds[fd]->ra, pcb->fds[fd]->inode, pcb->fds[fd]->file_position, bytes_read);
+    pcb->fds[fd]->file_position += bytes_read;
     return bytes_read;              // otherwise return number of bytes read
 }
 
 /* file_write
- *   DESCRIPTION: Write the file
+ *   DESCRIPTION: Write the file at the file position, or at the end in append mode
  *   INPUTS: fd -- the file descriptor
  *           buf -- the buffer to store the data
  *           nbytes -- the number of bytes to write
  *   OUTPUTS: none
- *   RETURN VALUE: -1
- *   SIDE EFFECTS: none
+ *   RETURN VALUE: the number of bytes written, -1 on failure
+ *   SIDE EFFECTS: advance the file position
  */
 int32_t file_write (int32_t fd, const void* buf, int32_t nbytes)
 {
@@ -342,101 +2053,370 @@ int32_t file_write (int32_t fd, const void* buf, int32_t nbytes)
     int32_t pid = get_pid();
     process_control_block_t* pcb = get_pcb_by_pid(pid);
     int32_t bytes_write;
-    bytes_write = write_data(pcb->fds[fd].inode, 
-            (uint8_t*)buf, nbytes);
+    if (nbytes < 0)
+        return -1;
+    if (pcb->fds[fd]->flags & FD_APPEND)     // append always writes at the end
+        pcb->fds[fd]->file_position = inode_length(pcb->fds[fd]->inode);
+    bytes_write = write_data(pcb->fds[fd]->inode, 
+            pcb->fds[fd]->file_position, (uint8_t*)buf, nbytes);
 
     if (bytes_write == -1)           // if read_data fails, return -1
         return -1;
-    pcb->fds[fd].file_position += bytes_write;
+    pcb->fds[fd]->file_position += bytes_write;
     return bytes_write;              // otherwise return number of bytes read
 }
 
-//overwrite previous data-- write from the beginning of the file
-int32_t write_data (uint32_t inode, uint8_t* buf, uint32_t length)
+/* seek_target
+ *   DESCRIPTION: Work out where an lseek lands
+ *   INPUTS: pos -- the current position
+ *           offset -- the signed distance
+ *           whence -- SEEK_SET, SEEK_CUR or SEEK_END
+ *           end -- the position of the end
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new position, -1 if it is before the start or whence is unknown
+ *   SIDE EFFECTS: none
+ */
+static int32_t seek_target (uint32_t pos, int32_t offset, int32_t whence, uint32_t end)
 {
-    //free the previous data block and inode
-    int32_t i, j, used_db_num, length_written,inode_find, bytes_in_last_block;
-//---------------------------------
-    //free data block
-    if(inode_ptr[inode].length_in_B != 0)
+    uint32_t base;
+    switch (whence)
     {
-        if(inode_ptr[inode].length_in_B % BLOCK_SIZE ==0 )
-        {
-            used_db_num = inode_ptr[inode].length_in_B/BLOCK_SIZE;
-        }
-        else 
-        {
-            used_db_num = inode_ptr[inode].length_in_B/BLOCK_SIZE + 1;
-        }
-            //update db bitmap
-        for(i=0; i < used_db_num; i++)
-        {
-            bitmap[inode_ptr[inode].data_blocks[i]] = 0;
-            bitmap_counter--;
-        }
-            //update inode legnth
-        inode_ptr[inode].length_in_B = 0;
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = pos;
+            break;
+        case SEEK_END:
+            base = end;
+            break;
+        default:
+            return -1;
+    }
+    if (offset < 0 && (uint32_t)(-offset) > base)
+        return -1;
+    if (offset > 0 && base + offset > 0x7FFFFFFF)       // the result has to fit the return value
+        return -1;
+    return base + offset;
+}
+
+/* file_seek
+ *   DESCRIPTION: Move the file position, past the end is allowed and a
+ *                write there leaves a zero filled hole
+ *   INPUTS: fd -- the file descriptor
+ *           offset -- the signed distance in bytes
+ *           whence -- SEEK_SET, SEEK_CUR or SEEK_END
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new position, -1 on failure
+ *   SIDE EFFECTS: modify the file position
+ */
+int32_t file_seek (int32_t fd, int32_t offset, int32_t whence)
+{
+    int32_t pid = get_pid();
+    process_control_block_t* pcb = get_pcb_by_pid(pid);
+    int32_t pos;
+    pos = seek_target(pcb->fds[fd]->file_position, offset, whence, file_length(pcb->fds[fd]->inode));
+    if (pos == -1)
+        return -1;
+    pcb->fds[fd]->file_position = pos;
+    return pos;
+}
+
+/* file_pread
+ *   DESCRIPTION: Read the file at an offset, the file position stays
+ *   INPUTS: fd -- the file descriptor
+ *           buf -- the buffer to store the data
+ *           nbytes -- the number of bytes to read
+ *           offset -- the byte offset in the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of bytes read, 0 at or past the end, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t file_pread (int32_t fd, void* buf, int32_t nbytes, uint32_t offset)
+{
+    int32_t pid = get_pid();
+    process_control_block_t* pcb = get_pcb_by_pid(pid);
+    if (nbytes < 0)
+        return -1;
+    if (offset >= file_length(pcb->fds[fd]->inode))
+        return 0;
+    return read_data(pcb->fds[fd]->inode, offset, buf, nbytes);
+}
+
+/* file_pwrite
+ *   DESCRIPTION: Write the file at an offset, the file position stays and
+ *                append mode does not apply
+ *   INPUTS: fd -- the file descriptor
+ *           buf -- the data to write
+ *           nbytes -- the number of bytes to write
+ *           offset -- the byte offset in the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of bytes written, -1 on failure
+ *   SIDE EFFECTS: may grow the file
+ */
+int32_t file_pwrite (int32_t fd, const void* buf, int32_t nbytes, uint32_t offset)
+{
+    int32_t pid = get_pid();
+    process_control_block_t* pcb = get_pcb_by_pid(pid);
+    if (nbytes < 0)
+        return -1;
+    return write_data(pcb->fds[fd]->inode, offset, (const uint8_t*)buf, nbytes);
+}
+
+/* block_copy
+ *   DESCRIPTION: Copy a whole data block into another
+ *   INPUTS: src -- the data block to copy
+ *           dst -- the data block to overwrite
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a disk error
+ *   SIDE EFFECTS: the cached dst is written back later
+ */
+static int32_t block_copy (uint32_t src, uint32_t dst)
+{
+    uint32_t flags;
+    uint8_t* from;
+    uint8_t* to = NULL;
+    if (!fs_disk)
+    {
+        to = data_block_ptr[dst].data;
+        memcpy(to, data_block_ptr[src].data, BLOCK_SIZE);
+        crc_update(dst, to);
+        return crc_store(dst);
     }
-//---------------------------------
-    //write new data
-    length_written = length;    
-    if (length_written ==0) return 0;
-    if(length_written % BLOCK_SIZE ==0 )
+    //src was used last, so taking dst evicts some other buffer
+    cli_and_save(flags);
+    if ((from = bcache_get(fs_data_start + src, 0)) != NULL &&
+        (to = bcache_get(fs_data_start + dst, 1)) != NULL)
+    {
+        memcpy(to, from, BLOCK_SIZE);
+        crc_update(dst, to);
+    }
+    restore_flags(flags);
+    return (to == NULL) ? -1 : crc_store(dst);
+}
+
+/* data_block_unshare
+ *   DESCRIPTION: Give a file its own copy of a block it shares with a clone,
+ *                before the block is written
+ *   INPUTS: inode -- the inode number
+ *           idx -- the block index inside the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: the block the file now owns alone, -1 on failure
+ *   SIDE EFFECTS: may take a block from the bitmap
+ */
+static int32_t data_block_unshare (uint32_t inode, uint32_t idx)
+{
+    int32_t block, copy;
+    if ((block = inode_get_block(inode, idx)) == -1 || block_refs[block] == 0)
+        return block;
+    if ((copy = data_block_alloc(block + 1, 1)) == -1)
+        return -1;
+    if (block_copy(block, copy) == -1 || inode_set_block(inode, idx, copy, 0) == -1)
     {
-        used_db_num = length_written/BLOCK_SIZE;
+        data_block_free(copy);
+        return -1;
     }
-    else 
+    block_refs[block]--;
+    return copy;
+}
+
+/* data_copy_in
+ *   DESCRIPTION: Copy bytes into the blocks already owned by a file, copying
+ *                the blocks shared with a clone first
+ *   INPUTS: inode -- the inode number
+ *           offset -- the byte offset in the file
+ *           buf -- the source, NULL to fill with zeros
+ *           length -- the number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a disk error or if no block is left
+ *   SIDE EFFECTS: modify the data blocks
+ */
+static int32_t data_copy_in (uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length)
+{
+    uint32_t done, block_offset, copy;
+    int32_t block;
+    for (done = 0; done < length; done += copy)
     {
-        used_db_num = length_written/BLOCK_SIZE + 1;
+        block_offset = (offset + done) % BLOCK_SIZE;
+        copy = BLOCK_SIZE - block_offset;
+        if (copy > length - done)
+            copy = length - done;
+        if ((block = data_block_unshare(inode, (offset + done) / BLOCK_SIZE)) == -1)
+            return -1;
+        if (block_write(block, block_offset, (buf == NULL) ? NULL : buf + done, copy) == -1)
+            return -1;
     }
-    bytes_in_last_block = length_written % BLOCK_SIZE;
-    if(bytes_in_last_block == 0) bytes_in_last_block = BLOCK_SIZE;
+    return 0;
+}
+
+/* write_undo
+ *   DESCRIPTION: Give back the blocks a failed write added past the end of a
+ *                file, and the indirect blocks taken for them
+ *   INPUTS: inode -- the inode number
+ *           old_blocks -- the blocks the file had before the write
+ *           blocks -- the blocks attached when it failed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modify the bitmap, the length is left as it was
+ */
+static void write_undo (uint32_t inode, uint32_t old_blocks, uint32_t blocks)
+{
+    uint32_t i;
+    for (i = old_blocks; i < blocks; i++)
+        data_block_free(inode_get_block(inode, i));
+    for (i = inode_meta_blocks(old_blocks); i < inode_meta_blocks(blocks); i++)
+        data_block_free(inode_meta_block(inode, i));
+    extent_invalidate(inode);
+}
 
-    //check there is an inode and an data block available and check there is dir entry available
-    if(inodemap_counter >= in_num || bitmap_counter >= db_num || dir_num >= MAX_DIR_ENTRIES)
+/* write_data
+ *   DESCRIPTION: Write into a file at an offset; the blocks inside the file are
+ *                updated in place and new blocks are only taken past the end
+ *   INPUTS: inode -- the inode number
+ *           offset -- the byte offset in the file, past the end leaves a zero filled hole
+ *           buf -- the data to write
+ *           length -- the number of bytes to write
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of bytes written, -1 on failure
+ *   SIDE EFFECTS: may grow the file; a failed write gives back the blocks it took
+ */
+int32_t write_data (uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length)
+{
+    uint32_t old_length, old_blocks, new_blocks, end, i, max_length;
+    int32_t block;
+    if (inode >= in_num || BITMAP_TEST(compmap, inode))   // compressed files are read only
         return -1;
-    //check enough db
-    if(used_db_num > db_num - bitmap_counter)
+    if (length == 0)
+        return 0;
+    max_length = inode_max_blocks() * BLOCK_SIZE;
+    if (offset >= max_length)
         return -1;
-    //start writing
-    inode_find = inode;
-    //write db except the last one
-    for(i=0; i<used_db_num-1; i++)
+    if (length > max_length - offset)
+        length = max_length - offset;
+    end = offset + length;
+    old_length = inode_length(inode);
+    old_blocks = (old_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    new_blocks = (end + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (new_blocks > old_blocks)
     {
-        //find db in each loop
-        for(j=0; j<db_num; j++)
+        //check enough db, indirect blocks included, before taking any
+        if (new_blocks + inode_meta_blocks(new_blocks) - old_blocks - inode_meta_blocks(old_blocks) > db_num - bitmap_counter)
+            return -1;
+        for (i = old_blocks; i < new_blocks; i++)
         {
-            if(bitmap[j] == 0)
+            block = data_block_alloc((i == 0) ? db_num : inode_get_block(inode, i-1) + 1, new_blocks - i);
+            if (block != -1 && inode_set_block(inode, i, block, 1) == -1)
             {
-                bitmap[j] = 1;
-                bitmap_counter++;
-                (inode_ptr[inode_find].data_blocks)[i] = j;
-                break;
+                data_block_free(block);
+                block = -1;
+            }
+            if (block == -1)
+            {
+                write_undo(inode, old_blocks, i);
+                return -1;
             }
-        }
-        // memcpy(data_block_ptr[inode_ptr[inode_find].data_blocks[i]].data, ((uint8_t*)buf)+i*BLOCK_SIZE, BLOCK_SIZE);
-        for (j=0; j<BLOCK_SIZE; j++)
-        {
-            data_block_ptr[(inode_ptr[inode_find].data_blocks)[i]].data[j] = ((uint8_t*)buf)[i*BLOCK_SIZE+j];
         }
     }
-    //write the last data block
-    for(j=0; j<db_num; j++)
+    //zero the hole between the old end and the offset
+    if ((offset > old_length && data_copy_in(inode, old_length, NULL, offset - old_length) == -1) ||
+        data_copy_in(inode, offset, buf, length) == -1)
     {
-        if(bitmap[j] == 0)
-        {
-            bitmap[j] = 1;
-            bitmap_counter++;
-            (inode_ptr[inode_find].data_blocks)[used_db_num-1] = j;
-            break;
-        }
+        write_undo(inode, old_blocks, new_blocks);
+        return -1;
     }
-    for (i=0; i<bytes_in_last_block; i++)
+    if (end > old_length)
+        inode_set_length(inode, end);
+    return length;
+}
+
+/* truncate_data
+ *   DESCRIPTION: Cut a file down to a length and free the blocks past it,
+ *                and the indirect blocks no longer needed
+ *   INPUTS: inode -- the inode number
+ *           length -- the new length, not more than the current one
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: modify the bitmap and the inode
+ */
+int32_t truncate_data (uint32_t inode, uint32_t length)
+{
+    uint32_t old_blocks, new_blocks, i;
+    if (inode >= in_num || length > inode_length(inode))
+        return -1;
+    if (length != 0 && BITMAP_TEST(compmap, inode))       // only removal cuts a compressed file
+        return -1;
+    old_blocks = (inode_length(inode) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    new_blocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    for (i = new_blocks; i < old_blocks; i++)
+        data_block_free(inode_get_block(inode, i));
+    // the indirect blocks are counted in the order inode_meta_block numbers them
+    for (i = inode_meta_blocks(new_blocks); i < inode_meta_blocks(old_blocks); i++)
+        data_block_free(inode_meta_block(inode, i));
+    extent_invalidate(inode);
+    inode_set_length(inode, length);
+    return 0;
+}
+
+/* clone_data
+ *   DESCRIPTION: Make one file a copy of another by sharing its data blocks;
+ *                a shared block is only copied when one of the files writes it
+ *   INPUTS: src -- the inode to copy
+ *           dst -- the inode to overwrite
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: dst loses its old blocks, but keeps them when the clone is
+ *                 refused up front; may take indirect blocks from the bitmap
+ */
+int32_t clone_data (uint32_t src, uint32_t dst)
+{
+    uint32_t length, block_num, i;
+    int32_t block;
+    if (src >= in_num || dst >= in_num)
+        return -1;
+    if (src == dst)
+        return 0;
+    length = inode_length(src);
+    block_num = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    //only the indirect blocks are new, check them all before dst loses anything
+    if (inode_meta_blocks(block_num) > db_num - bitmap_counter)
+        return -1;
+    for (i = 0; i < block_num; i++)
+        if ((block = inode_get_block(src, i)) == -1 || block_refs[block] == BLOCK_REF_MAX)
+            return -1;
+    if (truncate_data(dst, 0) == -1)
+        return -1;
+    for (i = 0; i < block_num; i++)
     {
-        data_block_ptr[(inode_ptr[inode_find].data_blocks)[used_db_num-1]].data[i] = ((uint8_t*)buf)[(used_db_num-1)*BLOCK_SIZE+i];
+        block = inode_get_block(src, i);
+        if (inode_set_block(dst, i, block, 1) == -1)
+        {
+            //give back what dst holds so far
+            inode_set_length(dst, i * BLOCK_SIZE);
+            truncate_data(dst, 0);
+            return -1;
+        }
+        block_refs[block]++;
     }
-    inode_ptr[inode_find].length_in_B = length_written;
-    return length_written;
+    inode_set_length(dst, length);
+    return 0;
+}
+
+/* file_clone
+ *   DESCRIPTION: Copy a regular file onto another without copying its data
+ *   INPUTS: src -- the path of the file to copy
+ *           dst -- the path of an existing regular file to overwrite
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: see clone_data
+ */
+int32_t file_clone (const uint8_t* src, const uint8_t* dst)
+{
+    dentry_t from, to;
+    if (path_lookup(src, &from) == -1 || path_lookup(dst, &to) == -1)
+        return -1;
+    if (from.file_type != 2 || to.file_type != 2)
+        return -1;
+    return clone_data(from.inode_num, to.inode_num);
 }
 
 /* dir_open
@@ -480,143 +2460,189 @@ int32_t dir_read (int32_t fd, void* buf, int32_t nbytes)
     int32_t pid = get_pid();
     process_control_block_t* pcb = get_pcb_by_pid(pid);
     int32_t cnt;
-    cnt = read_directory(buf, pcb->fds[fd].file_position);
+    cnt = read_directory_in(pcb->fds[fd]->inode, buf, pcb->fds[fd]->file_position);
     if (cnt == -1)
         return -1;
-    pcb->fds[fd].file_position++;
+    pcb->fds[fd]->file_position++;
     return cnt;
 }
 
-/* dir_write
- *   DESCRIPTION: Write the directory
+/* dir_seek
+ *   DESCRIPTION: Move to an entry of the directory, the next dir_read or
+ *                getdents starts there
  *   INPUTS: fd -- the file descriptor
- *           buf -- the buffer to store the data
- *           nbytes -- the number of bytes to write
+ *           offset -- the signed distance in entries
+ *           whence -- SEEK_SET, SEEK_CUR or SEEK_END
  *   OUTPUTS: none
- *   RETURN VALUE: -1
- *   SIDE EFFECTS: none
+ *   RETURN VALUE: the new entry index, -1 on failure
+ *   SIDE EFFECTS: modify the file position
  */
-int32_t dir_write (int32_t fd, const void* buf, int32_t nbytes)
+int32_t dir_seek (int32_t fd, int32_t offset, int32_t whence)
 {
-    int32_t i, j, cnt;
-    //check there is an inode and an data block available and check there is dir entry available
-    // int32_t pid = get_pid();
-    // process_control_block_t* pcb = get_pcb_by_pid(pid);
-    if(inodemap_counter >= in_num || bitmap_counter >= db_num || dir_num >= MAX_DIR_ENTRIES)
+    int32_t pid = get_pid();
+    process_control_block_t* pcb = get_pcb_by_pid(pid);
+    uint32_t dir = pcb->fds[fd]->inode;
+    int32_t pos;
+    pos = seek_target(pcb->fds[fd]->file_position, offset, whence,
+                      (dir == ROOT_DIR_INODE) ? dir_num : inode_length(dir) / sizeof(dentry_t));
+    if (pos == -1)
         return -1;
-    //if buf contain more than 32 bytes, return -1 nbytes are not valid
-    for (cnt = 0; cnt < 1024; cnt++)
+    pcb->fds[fd]->file_position = pos;
+    return pos;
+}
+
+/* dir_getdents
+ *   DESCRIPTION: Read as many entries of the directory as fit in the buffer
+ *   INPUTS: fd -- the file descriptor
+ *           buf -- the buffer to store the dirent_t records
+ *           nbytes -- the size of the buffer
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of bytes filled, 0 at the end
+ *   SIDE EFFECTS: advance the file position by the number of records
+ */
+int32_t dir_getdents (int32_t fd, void* buf, int32_t nbytes)
+{
+    int32_t pid = get_pid();
+    process_control_block_t* pcb = get_pcb_by_pid(pid);
+    dirent_t* record = (dirent_t*)buf;
+    dentry_t dentry;
+    int32_t cnt;
+    for (cnt = 0; (cnt + 1) * (int32_t)sizeof(dirent_t) <= nbytes; cnt++)
     {
-        if(((uint8_t*)buf)[cnt] == '\0')
+        if (dir_entry_by_index(pcb->fds[fd]->inode, pcb->fds[fd]->file_position, &dentry) == -1)
             break;
-        if(cnt == FILENAME_MAX_SIZE)
+        memcpy(record[cnt].file_name, dentry.file_name, FILENAME_MAX_SIZE);
+        record[cnt].file_type = dentry.file_type;
+        record[cnt].inode_num = dentry.inode_num;
+        //rtc and "." share inode 0, which holds no data
+        record[cnt].length = (dentry.file_type == 0 || dentry.inode_num == ROOT_DIR_INODE) ? 0 : file_length(dentry.inode_num);
+        pcb->fds[fd]->file_position++;
+    }
+    return cnt * sizeof(dirent_t);
+}
+
+/* subdir_remove
+ *   DESCRIPTION: Take an entry out of a subdirectory, the last entry moves into its place
+ *   INPUTS: dir -- the inode of the directory
+ *           name -- the name of the entry
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if not found or on a disk error
+ *   SIDE EFFECTS: modify the directory
+ */
+static int32_t subdir_remove (uint32_t dir, const uint8_t* name)
+{
+    dentry_t dentry;
+    int32_t i, last;
+    last = inode_length(dir) / sizeof(dentry_t) - 1;
+    if ((i = subdir_find(dir, name, &dentry)) == -1)
+        return -1;
+    if (i != last)
+    {
+        if (dir_entry_by_index(dir, last, &dentry) == -1 ||
+            write_data(dir, i * sizeof(dentry_t), (uint8_t*)&dentry, sizeof(dentry_t)) != sizeof(dentry_t))
             return -1;
     }
+    return truncate_data(dir, last * sizeof(dentry_t));
+}
+
+/* dir_write
+ *   DESCRIPTION: Create or remove an entry of a directory
+ *   INPUTS: fd -- the file descriptor
+ *           buf -- the path of the entry
+ *           nbytes -- DIR_WRITE_REMOVE to remove it, DIR_WRITE_MKDIR to
+ *                     create a directory, anything else creates a file
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: modify the directory, the bitmaps and the dentry cache
+ */
+int32_t dir_write (int32_t fd, const void* buf, int32_t nbytes)
+{
+    int32_t i, rm_index;
+    dentry_t parent, entry;
+    uint8_t name[FILENAME_MAX_SIZE + 1];
+    // int32_t pid = get_pid();
+    // process_control_block_t* pcb = get_pcb_by_pid(pid);
+    //the last component names the entry, the rest must be a directory
+    if (buf == NULL || path_parent(buf, &parent, name) == -1)
+        return -1;
 
-    // if nbytes is -299, it means we want to remove the file
-    if(nbytes == -299)
+    if(nbytes == DIR_WRITE_REMOVE)
     {
         // remove the dir entry
-        //if it is the last dir entry, just set the inode bitmap to 0
-        dentry_t rm_dentry;
-        int32_t rm_index;
-        read_dentry_by_name(buf, &rm_dentry);
-        rm_index = return_dentry_index(buf, &rm_dentry);
-        if(rm_index == dir_num-1)
+        if (dir_lookup(parent.inode_num, name, &entry) == -1)
+            return -1;
+        //a directory goes only once it is empty, the root never
+        if (entry.file_type == 1 && (entry.inode_num == ROOT_DIR_INODE || inode_length(entry.inode_num) != 0))
+            return -1;
+        dcache_remove(parent.inode_num, name);
+        //the dentry goes first, so a failure never leaves it on a freed inode
+        if (parent.inode_num != ROOT_DIR_INODE)
         {
-            //update db bitmap
-            for(i=0; i <= inode_ptr[rm_dentry.inode_num].length_in_B/BLOCK_SIZE; i++)
+            if (subdir_remove(parent.inode_num, name) == -1)
+                return -1;
+        }
+        else
+        {
+            //move the last dir entry into the hole, nothing else shifts
+            rm_index = dentry_lookup_hashed(name);
+            if (rm_index == -1)
+                return -1;
+            trie_remove(name);
+            dentry_hash_remove(rm_index);
+            dir_num--;
+            if (rm_index != dir_num)
             {
-                bitmap[inode_ptr[rm_dentry.inode_num].data_blocks[i]] = 0;
-                bitmap_counter--;
+                dentry_hash_remove(dir_num);
+                dentry_ptr[rm_index] = dentry_ptr[dir_num];
+                dentry_hash_insert(rm_index);
             }
-            //update inode bitmap
-            inodemap[rm_dentry.inode_num] = 0;
-            inodemap_counter--;
-            dir_num--;
-            // boot_block_ptr->num_dir_entries=dir_num;
+            memset(&dentry_ptr[dir_num], 0, sizeof(dentry_t));
             boot_block_ptr->num_dir_entries=dir_num;
-            return 0;
-        }
-        //if it is not the last dir entry, move all the following dir entries one step forward
-        //update db bitmap for rm one
-        for(i=0; i <= inode_ptr[rm_dentry.inode_num].length_in_B/BLOCK_SIZE; i++)
-        {
-            bitmap[inode_ptr[rm_dentry.inode_num].data_blocks[i]] = 0;
-            bitmap_counter--;
+            fs_meta_dirty(boot_block_ptr);
         }
-        //update inode bitmap
-        inodemap[rm_dentry.inode_num] = 0;
-        inodemap_counter--;
-        //move all the following dir entries one step forward
-        dentry_t next_dentry;
-        for(i=rm_index; i<dir_num; i++)
+        //"rtc" shares inode 0 with the root, keep it
+        if (entry.inode_num != ROOT_DIR_INODE)
         {
-            read_dentry_by_index(i+1, &next_dentry);
-            dentry_ptr[i].inode_num = next_dentry.inode_num;
-            dentry_ptr[i].file_type = next_dentry.file_type;
-            for(j=0; j<32; j++)
-            {
-                dentry_ptr[i].file_name[j] = next_dentry.file_name[j];
-            }
-            //update next denrty
-            read_dentry_by_index(i+1, &next_dentry);
+            //update db bitmap
+            truncate_data(entry.inode_num, 0);
+            //update inode bitmap
+            inode_free(entry.inode_num);
         }
-        dir_num--;
-        boot_block_ptr->num_dir_entries=dir_num;       
         return 0;
-
-        //if it is not the last dir entry, move the last dir entry to the rm dir entry
-        // dentry_t last_dentry;
-        // read_dentry_by_index(dir_num-1, &last_dentry);
-        // //update db bitmap for rm one
-        // for(i=0; i <= inode_ptr[rm_dentry.inode_num].length_in_B/BLOCK_SIZE; i++)
-        // {
-        //     bitmap[inode_ptr[rm_dentry.inode_num].data_blocks[i]] = 0;
-        //     bitmap_counter--;
-        // }
-        // //update inode bitmap
-        // inodemap[rm_dentry.inode_num] = 0;
-        // inodemap_counter--;
-        // dir_num--;
-        // boot_block_ptr->num_dir_entries=dir_num;        
-        // //set the rm one to the last one
-        // dentry_ptr[rm_index].inode_num = last_dentry.inode_num;
-        // dentry_ptr[rm_index].file_type = last_dentry.file_type;
-        // for(j=0; j<cnt; j++)
-        // {
-        //     dentry_ptr[rm_index].file_name[j] = last_dentry.file_name[j];
-        // }
-        // return 0;
     }
 
+    //the name must be new and the root has room for MAX_DIR_ENTRIES only
+    if (dir_lookup(parent.inode_num, name, &entry) == 0)
+        return -1;
+    if (parent.inode_num == ROOT_DIR_INODE && dir_num >= MAX_DIR_ENTRIES)
+        return -1;
     //find an available inode
-    for(i=0; i<in_num; i++)
+    i = inode_alloc();
+    if (i == -1)
+        return -1;
+    //initialize the inode
+    inode_set_length(i, 0);
+    extent_invalidate(i);
+    //fill in the dentry with the file name, inode number and file type(1 or 2)
+    memset(&entry, 0, sizeof(dentry_t));
+    memcpy(entry.file_name, name, strlen((int8_t*)name));
+    entry.file_type = (nbytes == DIR_WRITE_MKDIR) ? 1 : 2;
+    entry.inode_num = i;
+    if (parent.inode_num != ROOT_DIR_INODE)
     {
-        if(inodemap[i] == 0)
+        if (write_data(parent.inode_num, inode_length(parent.inode_num), (uint8_t*)&entry, sizeof(dentry_t)) != sizeof(dentry_t))
         {
-            inodemap[i] = 1;
-            inodemap_counter++;
-            // pcb->fds[fd].inode = i;
-            break;
+            inode_free(i);
+            return -1;
         }
+        return 0;
     }
-    //initialize the inode
-    inode_ptr[i].length_in_B = 0;
-    //fill in the dentry with the file name and inode number and file type(2)
-    dentry_ptr[dir_num].inode_num = i;
-    dentry_ptr[dir_num].file_type = 2;
-    //clear filename buffer
-    for(j=0; j<32; j++)
-    {
-        dentry_ptr[dir_num].file_name[j] = '\0';
-    }
-    for(j=0; j<cnt; j++)
-    {
-        dentry_ptr[dir_num].file_name[j] = ((uint8_t*)buf)[j];
-    }
+    dentry_ptr[dir_num] = entry;
+    dentry_hash_insert(dir_num);
+    trie_insert(entry.file_name);
     dir_num++;
     boot_block_ptr->num_dir_entries=dir_num;
+    fs_meta_dirty(boot_block_ptr);
     return 0;
 
 }
@@ -665,87 +2691,44 @@ int32_t tab_func(int32_t flag)
     }
     
 
-    //read all directory
-	uint32_t possible_file_num;
-	file_name_t file_name_pool[MAX_DIR_ENTRIES];	
-    file_name_t possible_file_name_pool[MAX_DIR_ENTRIES];
-        // 
-    // if (terminal[terminal_idx].buf_cnt ==0) return 0;
-        // tab in the middle of the command, return 0 
+    //the matches come from the trie, nothing is copied per keypress
+    uint32_t possible_file_num;
+    uint8_t file_name[FILENAME_MAX_SIZE + 1];
+    // tab in the middle of the command, return 0 
     if (terminal[terminal_idx].buf_cnt != terminal[terminal_idx].curr_cur) return 0;
 
-    possible_file_num = 0;
-
-
-    for (i=0; i<dir_num; i++)
-	{
-		if(-1 == read_directory(file_name_pool[i].name, i))
-			continue;
-        // putc('\n');
-		// puts(file_name_pool[i].name);
-	}
-
-    //search 
-    for (i=0; i<dir_num; i++)
-    {
-        if (cmd_counter >0)
-        {
-            if (strncmp((int8_t*)cmd_buf, (int8_t*)file_name_pool[i].name, cmd_counter) == 0)
-            {
-                strncpy((int8_t*)possible_file_name_pool[possible_file_num].name, (int8_t*)file_name_pool[i].name, FILENAME_MAX_SIZE);
-                possible_file_num++;
-            }
-        }
-        if (cmd_counter == 0) 
-        {
-            strncpy((int8_t*)possible_file_name_pool[possible_file_num].name, (int8_t*)file_name_pool[i].name, FILENAME_MAX_SIZE);
-            possible_file_num++;
-        }
-    }
+    possible_file_num = trie_prefix((uint8_t*)cmd_buf, cmd_counter, file_name);
     if ( possible_file_num == 0) return 0;
     if (flag == 0)
     {
-        // only one file found
-        // if (possible_file_num == 1)
-        // {
-            //calculate the length in the buffer
+        //first tab: expand to the longest common prefix, or to the first
+        //match when all of them are longer than what is typed already
         search_list_index = 0;
-        uint32_t total_file_length = strlen( (int8_t*)possible_file_name_pool[0].name);
-        if (total_file_length>32) total_file_length =32;
-        uint32_t legnth_to_fill = total_file_length - cmd_counter;
-
-        last_modify_length = legnth_to_fill;
-
-        for (i=0; i<legnth_to_fill; i++)
+        if (strlen((int8_t*)file_name) == cmd_counter)
         {
-            buf[terminal[terminal_idx].buf_cnt] = possible_file_name_pool[0].name[i+cmd_counter];
-            terminal[terminal_idx].buf_cnt++;
-            terminal[terminal_idx].curr_cur++;
-            putc(possible_file_name_pool[0].name[i+cmd_counter]);
+            trie_match((uint8_t*)cmd_buf, cmd_counter, 0, file_name);
+            search_list_index = 1 % possible_file_num;
         }
-        // }
-        search_list_index = (search_list_index+1) % possible_file_num;
-        return 0;
-        
     }
-    if (flag == 1)
+    else
     {
-        uint32_t total_file_length = strlen( (int8_t*)possible_file_name_pool[search_list_index].name);
-        if (total_file_length>32) total_file_length =32;
-        uint32_t legnth_to_fill = total_file_length - cmd_counter;
+        //next tabs: cycle through the matches
+        search_list_index %= possible_file_num;
+        trie_match((uint8_t*)cmd_buf, cmd_counter, search_list_index, file_name);
+        search_list_index = (search_list_index+1) % possible_file_num;
+    }
+    uint32_t legnth_to_fill = strlen((int8_t*)file_name) - cmd_counter;
+    if (terminal[terminal_idx].buf_cnt + legnth_to_fill >= BUF_SIZE)     // keep the newline slot
+        legnth_to_fill = BUF_SIZE - 1 - terminal[terminal_idx].buf_cnt;
 
-        last_modify_length = legnth_to_fill;
+    last_modify_length = legnth_to_fill;
 
-        for (i=0; i<legnth_to_fill; i++)
-        {
-            buf[terminal[terminal_idx].buf_cnt] = possible_file_name_pool[search_list_index].name[i+cmd_counter];
-            terminal[terminal_idx].buf_cnt++;
-            terminal[terminal_idx].curr_cur++;
-            putc(possible_file_name_pool[search_list_index].name[i+cmd_counter]);
-        }
-        // }
-        search_list_index = (search_list_index+1) % possible_file_num;
-        return 0;
+    for (i=0; i<legnth_to_fill; i++)
+    {
+        buf[terminal[terminal_idx].buf_cnt] = file_name[i+cmd_counter];
+        terminal[terminal_idx].buf_cnt++;
+        terminal[terminal_idx].curr_cur++;
+        putc(file_name[i+cmd_counter]);
     }
     return 0;
     
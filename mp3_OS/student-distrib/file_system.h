@@ -1,13 +1,22 @@
 #ifndef _FILE_SYSTEM_H
 #define _FILE_SYSTEM_H
 
-#include "system_call.h"
 #include "types.h"
+
+// sequential access detection for readahead, ahead of system_call.h which embeds it in file descriptors
+typedef struct readahead_t
+{
+    uint32_t next;                   // offset the next read starts at if sequential
+    uint32_t window;                 // blocks to prefetch, 0 for random access
+    uint32_t queued;                 // file blocks below this are already queued
+} readahead_t;
+
+#include "system_call.h"
 #include "lib.h"
 
-//write
-# define DB_NUM 59
-# define INODE_NUM 64
+//write: most data blocks and inodes an image can have, the rest are never allocated
+# define DB_NUM 16384
+# define INODE_NUM 1024
 
 # define MAX_DIR_ENTRIES 63
 # define DENTRY_OFFSET 64
@@ -20,7 +29,68 @@
 # define FILETYPE_SIZE 4
 # define LENGTH_SIZE 4
 
-// bitmap for file system
+// hash index over the dentry names
+# define DENTRY_HASH_SIZE 128           // power of 2, about twice MAX_DIR_ENTRIES
+# define DENTRY_HASH_NONE -1            // end of a bucket chain
+
+// prefix trie over the root names, for tab completion
+# define TRIE_NODES 2048                // MAX_DIR_ENTRIES names of FILENAME_MAX_SIZE, and the root
+# define TRIE_NONE -1
+
+// directories: a subdirectory is an inode whose data is an array of dentry_t
+# define ROOT_DIR_INODE 0               // "." in the boot block, no subdirectory uses inode 0
+# define PATH_MAX_SIZE 128
+# define PATH_MAX_DEPTH 8               // deepest nesting file_system_init walks
+# define DIR_WRITE_REMOVE -299          // dir_write nbytes: remove the named entry
+# define DIR_WRITE_MKDIR -298           // dir_write nbytes: create a directory
+
+// dentry cache keyed by (parent directory inode, name)
+# define DCACHE_SIZE 256                // power of 2
+# define DCACHE_EMPTY 0xFFFFFFFF
+
+// version 2 image: packed inodes with indirect blocks, marked by fs_magic in the boot block
+# define FS_MAGIC_V2 0x32534633        // "3FS2"
+# define INODE2_SIZE 64
+# define INODE2_PER_BLOCK (BLOCK_SIZE / INODE2_SIZE)
+# define INODE2_DIRECT 12
+# define BLOCK_PTRS (BLOCK_SIZE / 4)    // block numbers held by one indirect block
+# define INODE2_SINGLE_END (INODE2_DIRECT + BLOCK_PTRS)     // first block reached by the double indirect
+
+// extent cache: the last contiguous run of blocks looked up, per inode slot
+# define EXTENT_CACHE_SIZE 16           // power of 2
+# define EXTENT_MAX_BLOCKS 256          // longest run one lookup builds
+
+// disk-backed image: the boot block and inodes stay in memory, data blocks go through the buffer cache
+# define FS_META_BLOCKS 128             // boot block and inode blocks, 512kb
+# define FS_SYNC_TICKS 50               // PIT ticks between write-backs
+# define FS_META_FLUSH_MAX 8            // metadata blocks one tick may write back
+
+// readahead of sequential reads on a disk-backed image, in blocks
+# define RA_WINDOW_MIN 2                // first window of a stream
+# define RA_WINDOW_MAX 32               // doubled on each sequential read up to this
+# define RA_QUEUE_SIZE 64               // power of 2
+# define RA_TICK_BLOCKS 8               // blocks the PIT prefetches per tick
+
+// copy-on-write clones: data blocks owned by more than one file
+# define BLOCK_REF_MAX 0xFFFF          // most extra owners one block can have
+
+// per-block CRC32C, kept in a run of data blocks the boot block points at
+# define CRC_PER_BLOCK (BLOCK_SIZE / 4) // checksums held by one table block
+# define CRC_SCRUB_BLOCKS 4             // blocks the PIT verifies per tick
+
+// compressed files: every 4kb of the file is an LZ4 block of its own, read only
+# define FILE_TYPE_COMPRESSED 3
+# define LZ_MAGIC 0x315A4C33            // "3LZ1"
+# define LZ_HEADER_SIZE 8               // magic and length, then one offset per block and the end
+# define LZ_CACHE_SIZE 8                // decompressed blocks kept, power of 2
+# define LZ_MIN_MATCH 4
+
+// bitmap for file system: one bit per data block / inode, 1 is in use
+# define BITMAP_WORD_BITS 32
+# define BITMAP_WORDS(n) (((n) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+# define BITMAP_TEST(map, bit)  ((map)[(bit) / BITMAP_WORD_BITS] & (1U << ((bit) % BITMAP_WORD_BITS)))
+# define BITMAP_SET(map, bit)   ((map)[(bit) / BITMAP_WORD_BITS] |= (1U << ((bit) % BITMAP_WORD_BITS)))
+# define BITMAP_CLEAR(map, bit) ((map)[(bit) / BITMAP_WORD_BITS] &= ~(1U << ((bit) % BITMAP_WORD_BITS)))
 
 typedef struct dentry_t
 {
@@ -35,7 +105,10 @@ typedef struct boot_block_t
     uint32_t num_dir_entries;
     uint32_t num_inodes;
     uint32_t num_data_blocks;
-    uint8_t  reserved[52];           // 52 bytes reserved
+    uint32_t fs_magic;               // FS_MAGIC_V2 for the version 2 inode format
+    uint32_t crc_start;              // first data block of the checksum table
+    uint32_t crc_blocks;             // blocks in the table, 0 if the image has none
+    uint8_t  reserved[40];           // 40 bytes reserved
     dentry_t dir_entries[DENTRY_LIST_SIZE];
 } boot_block_t;
 
@@ -45,6 +118,70 @@ typedef struct inode_t
     uint32_t data_blocks[MAX_DATA_BLOCK_SIZE];
 } inode_t;
 
+typedef struct inode2_t
+{
+    uint32_t length_in_B;
+    uint32_t direct[INODE2_DIRECT];
+    uint32_t indirect;               // block of BLOCK_PTRS block numbers
+    uint32_t double_indirect;        // block of BLOCK_PTRS indirect blocks
+    uint32_t reserved;
+} inode2_t;
+
+typedef struct extent_t
+{
+    uint32_t inode;                  // INODE_NUM when the slot is empty
+    uint32_t file_block;             // first block index in the file
+    uint32_t data_block;             // where that block sits on the image
+    uint32_t count;                  // blocks in the run
+} extent_t;
+
+// one record of a batched directory read
+typedef struct dirent_t
+{
+    uint8_t  file_name[FILENAME_MAX_SIZE];  // NUL padded, not terminated at 32 bytes
+    uint32_t file_type;
+    uint32_t inode_num;
+    uint32_t length;                         // in bytes, 0 for rtc and the root
+} dirent_t;
+
+// the data of a compressed file starts with this, block b is stored at
+// bytes [offset[b], offset[b+1]), and raw when that is the whole block
+typedef struct lz_header_t
+{
+    uint32_t magic;                  // LZ_MAGIC
+    uint32_t length;                 // uncompressed length in bytes
+} lz_header_t;
+
+typedef struct lz_cache_t
+{
+    uint32_t inode;                  // INODE_NUM when the slot is empty
+    uint32_t block;
+    uint8_t  data[BLOCK_SIZE];
+} lz_cache_t;
+
+typedef struct ra_request_t
+{
+    uint32_t inode;
+    uint32_t file_block;
+} ra_request_t;
+
+typedef struct trie_node_t
+{
+    int16_t  child;                  // first child, the children are sorted by ch
+    int16_t  sibling;                // next child of the parent, or next free node
+    uint16_t count;                  // names ending at or under this node
+    uint8_t  ch;
+    uint8_t  terminal;               // 1 if a name ends here
+} trie_node_t;
+
+typedef struct dcache_entry_t
+{
+    uint32_t parent;                 // DCACHE_EMPTY when the slot is unused
+    uint32_t file_type;
+    uint32_t inode_num;
+    uint8_t  file_name[FILENAME_MAX_SIZE];
+} dcache_entry_t;
+
 typedef struct data_block_t
 {
     uint8_t data[BLOCK_SIZE];
@@ -56,22 +193,56 @@ typedef struct file_name_t
 } file_name_t;
 
 
+extern uint32_t fs_disk;            // 1 when the image is read from the ATA disk
+extern uint32_t bitmap_counter;     // data blocks in use
+extern uint32_t fs_crc_on;          // 1 when the image carries a checksum table
+extern uint32_t fs_crc_verify;      // 1 to check every block read against its checksum
+extern uint32_t crc_errors;         // mismatches seen by reads and the scrub
+extern uint32_t crc_scrubbed;       // blocks the scrub has checked
+extern uint32_t lz_hits;            // compressed block reads served decompressed
+extern uint32_t lz_misses;
+
 void    file_system_init (uint32_t start_addr);
+int32_t file_system_init_disk (void);
+void    file_system_tick (void);
+int32_t file_system_sync (void);
 int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry);
 int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry);
+int32_t return_dentry_index (const uint8_t* fname, dentry_t* dentry);
+int32_t dentry_lookup_hashed (const uint8_t* fname);
+int32_t dentry_lookup_linear (const uint8_t* fname);
+int32_t trie_prefix (const uint8_t* prefix, uint32_t len, uint8_t* lcp);
+int32_t trie_match (const uint8_t* prefix, uint32_t len, uint32_t k, uint8_t* name);
+int32_t path_lookup (const uint8_t* path, dentry_t* dentry);
+int32_t dir_entry_by_index (uint32_t dir, uint32_t index, dentry_t* dentry);
 int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
+uint32_t inode_length (uint32_t inode);
+uint32_t file_length (uint32_t inode);
+int32_t lz_decompress (const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len);
+uint8_t* inode_block_addr (uint32_t inode, uint32_t block);
 int32_t read_directory(uint8_t* buf, uint32_t index);
-int32_t write_data (uint32_t inode, uint8_t* buf, uint32_t length);
+int32_t read_directory_in(uint32_t dir, uint8_t* buf, uint32_t index);
+int32_t write_data (uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length);
+int32_t truncate_data (uint32_t inode, uint32_t length);
+int32_t clone_data (uint32_t src, uint32_t dst);
+int32_t file_clone (const uint8_t* src, const uint8_t* dst);
+void    read_ahead_reset (readahead_t* ra);
+void    read_ahead (readahead_t* ra, uint32_t inode, uint32_t offset, uint32_t length);
 // System call functions
 int32_t file_open (const uint8_t* filename);
 int32_t file_close (int32_t fd);
 int32_t file_read (int32_t fd, void* buf, int32_t nbytes);
 int32_t file_write (int32_t fd, const void* buf, int32_t nbytes);
+int32_t file_seek (int32_t fd, int32_t offset, int32_t whence);
+int32_t file_pread (int32_t fd, void* buf, int32_t nbytes, uint32_t offset);
+int32_t file_pwrite (int32_t fd, const void* buf, int32_t nbytes, uint32_t offset);
 
 int32_t dir_open (const uint8_t* filename);
 int32_t dir_close (int32_t fd);
 int32_t dir_read (int32_t fd, void* buf, int32_t nbytes);
 int32_t dir_write (int32_t fd, const void* buf, int32_t nbytes);
+int32_t dir_seek (int32_t fd, int32_t offset, int32_t whence);
+int32_t dir_getdents (int32_t fd, void* buf, int32_t nbytes);
 
 int32_t tab_func(int32_t flag);
 
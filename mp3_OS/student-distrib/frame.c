@@ -0,0 +1,207 @@
+#include "frame.h"
+
+// per frame: FRAME_FREE | order at the head of a free block, 0 otherwise
+static uint8_t frame_state[FRAME_NUM];
+static uint32_t free_head[FRAME_MAX_ORDER + 1];     // physical address, 0 if the list is empty
+// per frame: references past the first, from address spaces that share it copy on write
+static uint8_t frame_refs[FRAME_NUM];
+
+uint32_t frame_free_count;
+uint32_t frame_total;
+
+/*
+ * frame_push
+ *   DESCRIPTION: Put a free block at the head of the list of its order
+ *   INPUTS: addr -- physical address of the block
+ *           order -- log2 of its size in frames
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the links into the block
+ */
+static void frame_push(uint32_t addr, uint32_t order){
+    frame_node_t* node = (frame_node_t*)addr;
+    node->next = free_head[order];
+    node->prev = 0;
+    if (free_head[order] != 0)
+        ((frame_node_t*)free_head[order])->prev = addr;
+    free_head[order] = addr;
+    frame_state[(addr - FRAME_START) / FRAME_SIZE] = FRAME_FREE | order;
+}
+
+/*
+ * frame_unlink
+ *   DESCRIPTION: Take a free block out of the list of its order
+ *   INPUTS: addr -- physical address of the block
+ *           order -- log2 of its size in frames
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the block is no longer marked free
+ */
+static void frame_unlink(uint32_t addr, uint32_t order){
+    frame_node_t* node = (frame_node_t*)addr;
+    if (node->prev == 0)
+        free_head[order] = node->next;
+    else
+        ((frame_node_t*)node->prev)->next = node->next;
+    if (node->next != 0)
+        ((frame_node_t*)node->next)->prev = node->prev;
+    frame_state[(addr - FRAME_START) / FRAME_SIZE] = 0;
+}
+
+/*
+ * frame_in_module
+ *   DESCRIPTION: Check whether a frame holds part of a boot module
+ *   INPUTS: mbi -- the multiboot information
+ *           addr -- physical address of the frame
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if a module overlaps the frame, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+static uint32_t frame_in_module(multiboot_info_t* mbi, uint32_t addr){
+    module_t* mod = (module_t*)mbi->mods_addr;
+    uint32_t i;
+    if (!(mbi->flags & (1 << 3)))
+        return 0;
+    for (i = 0; i < mbi->mods_count; i++, mod++) {
+        if (addr < mod->mod_end && addr + FRAME_SIZE > mod->mod_start)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * frame_init
+ *   DESCRIPTION: Give the allocator the RAM of the multiboot memory map
+ *                between FRAME_START and FRAME_END, less the boot modules
+ *   INPUTS: mbi -- the multiboot information
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: runs before paging is on and writes the free lists into
+ *                 the frames themselves
+ */
+void frame_init(multiboot_info_t* mbi){
+    memory_map_t* mmap;
+    uint32_t start, end, addr;
+    frame_free_count = 0;
+    frame_total = 0;
+    if (!(mbi->flags & (1 << 6)))
+        return;
+    for (mmap = (memory_map_t*)mbi->mmap_addr;
+         (uint32_t)mmap < mbi->mmap_addr + mbi->mmap_length;
+         mmap = (memory_map_t*)((uint32_t)mmap + mmap->size + sizeof(mmap->size))) {
+        if (mmap->type != FRAME_MMAP_RAM || mmap->base_addr_high != 0 || mmap->base_addr_low >= FRAME_END)
+            continue;
+        start = mmap->base_addr_low;
+        // anything past FRAME_END is left out
+        if (mmap->length_high != 0 || mmap->length_low > FRAME_END - start)
+            end = FRAME_END;
+        else
+            end = start + mmap->length_low;
+        if (start < FRAME_START)
+            start = FRAME_START;
+        start = (start + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+        end &= ~(FRAME_SIZE - 1);
+        for (addr = start; addr < end; addr += FRAME_SIZE) {
+            if (frame_in_module(mbi, addr))
+                continue;
+            frame_free(addr, 0);
+            frame_total++;
+        }
+    }
+}
+
+/*
+ * frame_alloc
+ *   DESCRIPTION: Take a block of 2^order frames, splitting a bigger one if needed
+ *   INPUTS: order -- log2 of the size in frames
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address of the block, aligned to its size; 0 if
+ *                 there is no block that big
+ *   SIDE EFFECTS: the kernel reaches the block at the same address; its
+ *                 content is left as it was
+ */
+uint32_t frame_alloc(uint32_t order){
+    uint32_t flags, k, addr;
+    if (order > FRAME_MAX_ORDER)
+        return 0;
+    cli_and_save(flags);
+    for (k = order; k <= FRAME_MAX_ORDER && free_head[k] == 0; k++);
+    if (k > FRAME_MAX_ORDER) {
+        restore_flags(flags);
+        return 0;
+    }
+    addr = free_head[k];
+    frame_unlink(addr, k);
+    // give the upper halves back until the block is the size asked for
+    while (k > order) {
+        k--;
+        frame_push(addr + (FRAME_SIZE << k), k);
+    }
+    frame_free_count -= 1 << order;
+    restore_flags(flags);
+    return addr;
+}
+
+/*
+ * frame_free
+ *   DESCRIPTION: Give a block back, merging it with its buddy while the buddy is free
+ *   INPUTS: addr -- physical address from frame_alloc
+ *           order -- the order it was allocated with
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: a shared frame only loses one reference
+ */
+void frame_free(uint32_t addr, uint32_t order){
+    uint32_t flags, buddy;
+    if (addr < FRAME_START || addr >= FRAME_END || order > FRAME_MAX_ORDER)
+        return;
+    cli_and_save(flags);
+    if (order == 0 && frame_refs[(addr - FRAME_START) / FRAME_SIZE] != 0) {
+        frame_refs[(addr - FRAME_START) / FRAME_SIZE]--;
+        restore_flags(flags);
+        return;
+    }
+    frame_free_count += 1 << order;
+    while (order < FRAME_MAX_ORDER) {
+        buddy = FRAME_START + (((addr - FRAME_START) / FRAME_SIZE) ^ (1 << order)) * FRAME_SIZE;
+        if (buddy >= FRAME_END || frame_state[(buddy - FRAME_START) / FRAME_SIZE] != (FRAME_FREE | order))
+            break;
+        frame_unlink(buddy, order);
+        if (buddy < addr)
+            addr = buddy;
+        order++;
+    }
+    frame_push(addr, order);
+    restore_flags(flags);
+}
+
+/*
+ * frame_share
+ *   DESCRIPTION: Take one more reference to a frame, for a second address space
+ *   INPUTS: addr -- physical address of an allocated 4kb frame
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frame_free must be called once more before the frame is free
+ */
+void frame_share(uint32_t addr){
+    uint32_t flags;
+    if (addr < FRAME_START || addr >= FRAME_END)
+        return;
+    cli_and_save(flags);
+    frame_refs[(addr - FRAME_START) / FRAME_SIZE]++;
+    restore_flags(flags);
+}
+
+/*
+ * frame_shared
+ *   DESCRIPTION: Check whether more than one address space holds a frame
+ *   INPUTS: addr -- physical address of an allocated 4kb frame
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it is shared, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+uint32_t frame_shared(uint32_t addr){
+    if (addr < FRAME_START || addr >= FRAME_END)
+        return 0;
+    return frame_refs[(addr - FRAME_START) / FRAME_SIZE] != 0;
+}
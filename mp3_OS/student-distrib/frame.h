@@ -0,0 +1,33 @@
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include "types.h"
+#include "lib.h"
+#include "multiboot.h"
+
+// physical 4kb page frames above the kernel page, handed out by a buddy allocator
+#define FRAME_SIZE          4096
+#define FRAME_MAX_ORDER     10          // blocks of 2^order frames, up to 4mb
+#define FRAME_START         0x00800000  // the first 8mb are the video and kernel pages
+#define FRAME_END           0x08000000  // user space starts here, the kernel maps the frames 1:1 below it
+#define FRAME_NUM           ((FRAME_END - FRAME_START) / FRAME_SIZE)
+#define FRAME_FREE          0x80        // frame_state: head of a free block, the order in the low bits
+#define FRAME_MMAP_RAM      1           // multiboot memory map type of usable RAM
+
+// the links of a free block, kept in its first frame
+typedef struct frame_node_t
+{
+    uint32_t next;                      // physical address, 0 at the end
+    uint32_t prev;
+} frame_node_t;
+
+void     frame_init(multiboot_info_t* mbi);
+uint32_t frame_alloc(uint32_t order);
+void     frame_free(uint32_t addr, uint32_t order);
+void     frame_share(uint32_t addr);
+uint32_t frame_shared(uint32_t addr);
+
+extern uint32_t frame_free_count;       // 4kb frames on the free lists
+extern uint32_t frame_total;            // 4kb frames the memory map gave the allocator
+
+#endif
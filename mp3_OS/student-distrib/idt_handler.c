@@ -1,4 +1,5 @@
 #include "idt_handler.h"
+#include "page.h"
 
 // exceptions
 // print exceptions to report errors
@@ -37,13 +38,30 @@ void invalid_task_state_seg_handler()   {cli(); send_signal(SIG_SEGFAULT);  sti(
 void seg_not_present_handler()          {cli(); send_signal(SIG_SEGFAULT);  sti();}
 void stack_seg_handler()                {cli(); send_signal(SIG_SEGFAULT);  sti();}
 void general_protection_handler()       {cli(); send_signal(SIG_SEGFAULT);  sti();}
-void page_fault_handler()               {cli(); send_signal(SIG_SEGFAULT);  sti();}
 void reserved_handler()                 {cli(); send_signal(SIG_SEGFAULT);  sti();}
 void floating_point_handler()           {cli(); send_signal(SIG_SEGFAULT);  sti();}
 void alignment_check_handler()          {cli(); send_signal(SIG_SEGFAULT);  sti();}
 void machine_check_handler()            {cli(); send_signal(SIG_SEGFAULT);  sti();}
 void simd_floating_point_handler()      {cli(); send_signal(SIG_SEGFAULT);  sti();}
 
+/* 
+ * page_fault_handler: copy a shared page on its first write, map user pages
+ *                     on demand, any other fault is a SIG_SEGFAULT
+ * Input: none
+ * Output: none
+ * Side effect: the faulting instruction is restarted if the page got mapped;
+ *              may fault from the kernel with interrupts off, so restore the flags
+*/
+void page_fault_handler()
+{
+    uint32_t flags, addr;
+    cli_and_save(flags);
+    asm volatile("movl %%cr2, %0" : "=r" (addr));
+    if (page_cow_fault(addr) == -1 && page_demand_fault(addr) == -1)
+        send_signal(SIG_SEGFAULT);
+    restore_flags(flags);
+}
+
 
 
 
@@ -12,7 +12,10 @@
 #include "keyboard.h"
 #include "rtc.h"
 #include "page.h"
+#include "frame.h"
+#include "slab.h"
 #include "file_system.h"
+#include "ata.h"
 #include "PIT.h"
 #include "system_call.h"
 #include "scheduler.h"
@@ -29,6 +32,7 @@ void entry(unsigned long magic, unsigned long addr) {
 
     multiboot_info_t *mbi;
     uint32_t file_addr;
+    uint32_t drive;
     /* Clear the screen. */
     clear();
 
@@ -147,13 +151,27 @@ void entry(unsigned long magic, unsigned long addr) {
     
     /* Init IDT */
     idt_init();
+    /* Init page frames, before paging is on so the free lists can be written into them */
+    frame_init(mbi);
+    printf("%u page frames, %uKB\n", frame_total, frame_total * 4);
     /* Init paging */
     page_init();
+    /* Init the kernel object caches */
+    slab_init();
+    process_cache_init();
     /* Init the PIC */
     i8259_init();
     /* Initialize devices, memory, filesystem, enable device interrupts on the
      * PIC, any other initialization stuff... */
     file_system_init(file_addr);
+    /* Use the image on a disk instead when there is one (qemu -hdb filesys_img),
+     * the boot disk fails the boot block check */
+    for (drive = ATA_MASTER; drive <= ATA_SLAVE; drive++) {
+        if (ata_init(drive) == 0 && file_system_init_disk() == 0) {
+            printf("file system on ATA disk %d, %u sectors\n", drive, ata_sectors);
+            break;
+        }
+    }
     /* Init terminal */
     terminal_init();
     /* Init keyboard */
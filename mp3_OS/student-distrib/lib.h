@@ -209,4 +209,17 @@ do {                                    \
     );                                  \
 } while (0)
 
+/* Read time-stamp counter
+ * Returns the low 32 bits of the TSC; callers measure intervals by
+ * subtraction, so an interval must stay below 2^32 cycles */
+static inline uint32_t rdtsc(void) {
+    uint32_t low, high;
+    asm volatile ("rdtsc"
+            : "=a"(low), "=d"(high)
+            :
+            : "memory"
+    );
+    return low;
+}
+
 #endif /* _LIB_H */
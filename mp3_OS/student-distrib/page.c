@@ -1,5 +1,18 @@
 #include "page.h"
 #include "system_call.h"
+#include "frame.h"
+
+// 4kb page tables for the 4mb user program page, one frame for each live pid
+page_table_entry_t* user_page_table[PROCESS_COUNT];
+// 4kb page tables for the file mapping window, one frame for each live pid
+page_table_entry_t* user_page_table_mmap[PROCESS_COUNT];
+// 4kb page tables for the heap window, one frame for each live pid
+page_table_entry_t* user_page_table_heap[PROCESS_COUNT];
+uint32_t mmap_next_page[PROCESS_COUNT];     // first unused page in the mapping window
+// io ring frame of each pid, shared with user space at USER_VIRT_RING; 0 until io_setup
+static uint32_t io_ring_frame[PROCESS_COUNT];
+uint32_t page_user_pid;             // pid whose user page table is mapped now
+uint32_t page_in_total;             // pages filled from the file system image since boot
 
 /* 
  * page_init: initialize the page table
@@ -25,23 +38,30 @@ void page_init()
     uint32_t page_table_addr = (uint32_t)page_table_0;            // pt addr
     uint32_t page_directory_addr = (uint32_t)page_directory;    // pd addr
 
-    page_table_0[video_memory_  >> 12].val = (video_memory_ & 0xFFFFF000) | 0x3;    //pt entry
-    SET_PTE(page_table_0, (uint32_t)VIDEO_BACKUP_0, (uint32_t)VIDEO_BACKUP_0, 0, 1);
-    SET_PTE(page_table_0, (uint32_t)VIDEO_BACKUP_1, (uint32_t)VIDEO_BACKUP_1, 0, 1);
-    SET_PTE(page_table_0, (uint32_t)VIDEO_BACKUP_2, (uint32_t)VIDEO_BACKUP_2, 0, 1);
+    // the kernel mappings are global, a cr3 load for a new process keeps them in the TLB
+    page_table_0[video_memory_  >> 12].val = (video_memory_ & 0xFFFFF000) | 0x103;  //pt entry
+    SET_PTE_GLOBAL(page_table_0, (uint32_t)VIDEO_BACKUP_0, (uint32_t)VIDEO_BACKUP_0);
+    SET_PTE_GLOBAL(page_table_0, (uint32_t)VIDEO_BACKUP_1, (uint32_t)VIDEO_BACKUP_1);
+    SET_PTE_GLOBAL(page_table_0, (uint32_t)VIDEO_BACKUP_2, (uint32_t)VIDEO_BACKUP_2);
     page_directory[0].val = (page_table_addr & 0xFFFFF000) | 0x3;                   //pd entry(pt)   RW = 1, present=1
     page_directory[1].val = (page_directory_addr & 0xFFFFF000) | 0x183;             //pd entry(kernel page)   phys=4MB, PS=1, prev=0, rw=1, present=1,G=1
+    // the page frames, 1:1 and kernel only, so the kernel can fill them before user space maps them
+    for(i = FRAME_START >> 22; i < FRAME_END >> 22; i++)
+    {
+        page_directory[i].val = (i << 22) | 0x183;                                    // PS=1, rw=1, present=1, G=1
+    }
     // cr3 : page directory addr
-    // cr4 : allow 4 mb page (enable PSE)
-    // cr0 : set paging (PG)
+    // cr4 : allow 4 mb page (enable PSE), keep global pages across cr3 loads (PGE)
+    // cr0 : set paging (PG), and write protect (WP) so the kernel faults on
+    //       copy on write pages too when it fills a user buffer
     asm volatile(
         "movl  %0, %%eax;           \
          movl  %%eax, %%cr3;        \
          movl  %%cr4, %%eax;        \
-         orl   $0x00000010, %%eax;  \
+         orl   $0x00000090, %%eax;  \
          movl  %%eax, %%cr4;        \
          movl  %%cr0, %%eax;        \
-         orl   $0x80000000, %%eax;  \
+         orl   $0x80010000, %%eax;  \
          movl  %%eax, %%cr0;"
         : /*no output*/
         : "r" (&page_directory)
@@ -59,12 +79,299 @@ uint32_t cr3;
  * Side effect: change the cr3 
 */
 void page_init_by_idx(uint32_t pid) {
-    uint32_t* phys_addr = (uint32_t*)(pid * USER_MEM_SIZE + USER_PHYS_START);
     uint32_t* virt_addr = (uint32_t*) USER_VIRT;
-    SET_PDE(page_directory, (uint32_t)phys_addr, (uint32_t)virt_addr);
+    SET_PDE_PT(page_directory, (uint32_t)user_page_table[pid], (uint32_t)virt_addr, 1, 1);
+    SET_PDE_PT(page_directory, (uint32_t)user_page_table_mmap[pid], USER_VIRT_MMAP, 1, 1);
+    SET_PDE_PT(page_directory, (uint32_t)user_page_table_heap[pid], USER_VIRT_HEAP, 1, 1);
+    page_user_pid = pid;
     change_cr3();
 }
 
+/* 
+ * page_user_create: take the page tables of a pid from the frame allocator
+ * Input: pid
+ * Output: none
+ * Return value: 0 if successful, -1 if there are no frames left
+ * Side effect: every user page of the pid starts not present
+*/
+int32_t page_user_create(uint32_t pid) {
+    user_page_table[pid] = (page_table_entry_t*)frame_alloc(0);
+    user_page_table_mmap[pid] = (page_table_entry_t*)frame_alloc(0);
+    user_page_table_heap[pid] = (page_table_entry_t*)frame_alloc(0);
+    if(user_page_table[pid] == NULL || user_page_table_mmap[pid] == NULL || user_page_table_heap[pid] == NULL)
+    {
+        page_user_destroy(pid);
+        return -1;
+    }
+    memset(user_page_table[pid], 0, PAGE_SIZE_4KB);
+    memset(user_page_table_mmap[pid], 0, PAGE_SIZE_4KB);
+    memset(user_page_table_heap[pid], 0, PAGE_SIZE_4KB);
+    mmap_next_page[pid] = 0;
+    return 0;
+}
+
+/* 
+ * page_table_free: give back a page table and every frame it maps
+ * Input: table - pointer to the table pointer of a pid
+ * Output: none
+ * Return value: none
+ * Side effect: the table pointer is NULL afterwards
+*/
+static void page_table_free(page_table_entry_t** table) {
+    int i;
+    if(*table == NULL)
+        return;
+    for(i=0; i < PT_ENTRY_NUM; i++)
+    {
+        if((*table)[i].present)
+            frame_free((*table)[i].val & PAGE_ADDR_MASK, 0);
+    }
+    frame_free((uint32_t)*table, 0);
+    *table = NULL;
+}
+
+/* 
+ * page_user_destroy: give every frame of a pid back, after it halts or before it loads a new program
+ * Input: pid
+ * Output: none
+ * Return value: none
+ * Side effect: the user pages, the heap, the io ring and the page tables of
+ *              the pid are freed; the mmap window only points into the file
+ *              system image, so those pages are just dropped.  The caller
+ *              must not run the pid until page_user_create, and flushes the
+ *              TLB through page_init_by_idx
+*/
+void page_user_destroy(uint32_t pid) {
+    page_table_free(&user_page_table[pid]);
+    page_table_free(&user_page_table_heap[pid]);
+    if(user_page_table_mmap[pid] != NULL)
+    {
+        frame_free((uint32_t)user_page_table_mmap[pid], 0);
+        user_page_table_mmap[pid] = NULL;
+    }
+    if(io_ring_frame[pid] != 0)
+    {
+        frame_free(io_ring_frame[pid], 0);
+        io_ring_frame[pid] = 0;
+    }
+}
+
+/* 
+ * page_heap_trim: give back the heap pages of a pid above a new break
+ * Input: pid, heap_brk - the new break, at or above USER_VIRT_HEAP
+ * Output: none
+ * Return value: none
+ * Side effect: every page that starts at or after heap_brk is unmapped and
+ *              its frame freed and dropped from the TLB
+*/
+void page_heap_trim(uint32_t pid, uint32_t heap_brk) {
+    uint32_t i;
+    for(i = (heap_brk - USER_VIRT_HEAP + PAGE_SIZE_4KB - 1) >> 12; i < PT_ENTRY_NUM; i++)
+    {
+        if(!user_page_table_heap[pid][i].present)
+            continue;
+        frame_free(user_page_table_heap[pid][i].val & PAGE_ADDR_MASK, 0);
+        user_page_table_heap[pid][i].val = 0;
+        page_invlpg(USER_VIRT_HEAP + (i << 12));
+    }
+}
+
+/* 
+ * page_table_share: map every page of one table into another, copy on write
+ * Input: from - table of the parent, to - empty table of the child
+ * Output: none
+ * Return value: none
+ * Side effect: writable pages become read only in both until the first
+ *              write; the caller flushes the TLB of the parent
+*/
+static void page_table_share(page_table_entry_t* from, page_table_entry_t* to) {
+    int i;
+    for(i=0; i < PT_ENTRY_NUM; i++)
+    {
+        if(!from[i].present)
+            continue;
+        if(from[i].val & PTE_RW)
+            from[i].val = (from[i].val & ~PTE_RW) | PTE_COW;
+        to[i] = from[i];
+        frame_share(from[i].val & PAGE_ADDR_MASK);
+    }
+}
+
+/* 
+ * page_user_fork: give a child pid the address space of its parent
+ * Input: parent, child - pids, the child has no page tables yet
+ * Output: none
+ * Return value: 0 if successful, -1 if there are no frames left
+ * Side effect: the program and heap pages are shared copy on write, the
+ *              file mappings are shared as they are read only; the io ring
+ *              stays with the parent
+*/
+int32_t page_user_fork(uint32_t parent, uint32_t child) {
+    int i;
+    if(page_user_create(child) == -1)
+        return -1;
+    page_table_share(user_page_table[parent], user_page_table[child]);
+    page_table_share(user_page_table_heap[parent], user_page_table_heap[child]);
+    for(i=0; i < MMAP_WINDOW_PAGES; i++)
+        user_page_table_mmap[child][i] = user_page_table_mmap[parent][i];
+    mmap_next_page[child] = mmap_next_page[parent];
+    change_cr3();       // the parent lost write access
+    return 0;
+}
+
+/* 
+ * page_cow_fault: give the current pid its own copy of a shared page on a write
+ * Input: addr - the faulting linear address (cr2)
+ * Output: none
+ * Return value: 0 if the page is writable now, -1 if it is not a copy on
+ *               write page or there are no frames left
+ * Side effect: the last pid holding the frame just gets write access back
+*/
+int32_t page_cow_fault(uint32_t addr) {
+    page_table_entry_t* pte;
+    uint32_t old_frame, new_frame;
+
+    if(addr >= USER_VIRT && addr < USER_VIRT + USER_MEM_SIZE)
+        pte = &user_page_table[page_user_pid][(addr & 0x003ff000) >> 12];
+    else if(addr >= USER_VIRT_HEAP && addr < USER_VIRT_HEAP + USER_MEM_SIZE)
+        pte = &user_page_table_heap[page_user_pid][(addr & 0x003ff000) >> 12];
+    else
+        return -1;
+    if(!pte->present || !(pte->val & PTE_COW))
+        return -1;
+
+    old_frame = pte->val & PAGE_ADDR_MASK;
+    if(frame_shared(old_frame))
+    {
+        new_frame = frame_alloc(0);
+        if(new_frame == 0)                                          // out of memory
+            return -1;
+        memcpy((uint8_t*)new_frame, (uint8_t*)old_frame, PAGE_SIZE_4KB);
+        frame_free(old_frame, 0);                                   // drop this pid's reference
+        pte->val = (pte->val & ~PAGE_ADDR_MASK) | new_frame;
+    }
+    pte->val = (pte->val & ~PTE_COW) | PTE_RW;
+    page_invlpg(addr & PAGE_ADDR_MASK);
+    return 0;
+}
+
+/* 
+ * page_mmap_reserve: take a run of unused pages in the mapping window of the current pid
+ * Input: page_num - number of 4kb pages
+ * Output: none
+ * Return value: the virtual address of the first page, 0 if the window is full
+ * Side effect: none until the pages are mapped with page_mmap_ro
+*/
+uint32_t page_mmap_reserve(uint32_t page_num) {
+    uint32_t virt_addr;
+    if(page_num > MMAP_WINDOW_PAGES - mmap_next_page[page_user_pid])
+        return 0;
+    virt_addr = USER_VIRT_MMAP + mmap_next_page[page_user_pid] * PAGE_SIZE_4KB;
+    mmap_next_page[page_user_pid] += page_num;
+    return virt_addr;
+}
+
+/* 
+ * page_mmap_ro: map one page of the mapping window read only for the current pid
+ * Input: virt_addr - page in the window, phys_addr - 4kb aligned physical page
+ * Output: none
+ * Return value: none
+ * Side effect: the page was not present, so no TLB flush is needed
+*/
+void page_mmap_ro(uint32_t virt_addr, uint32_t phys_addr) {
+    SET_PTE_RO(user_page_table_mmap[page_user_pid], phys_addr, virt_addr, 1, 1);
+}
+
+/* 
+ * page_ring_map: map the io ring page of the current pid into user space
+ * Input: none
+ * Output: none
+ * Return value: the kernel address of the page, user space sees it at
+ *               USER_VIRT_RING; NULL if there are no frames left
+ * Side effect: the page is read/write for user space until the pid halts
+ *              or executes again
+*/
+uint8_t* page_ring_map(void) {
+    if(io_ring_frame[page_user_pid] == 0)
+    {
+        io_ring_frame[page_user_pid] = frame_alloc(0);
+        if(io_ring_frame[page_user_pid] == 0)
+            return NULL;
+    }
+    SET_PTE(user_page_table_mmap[page_user_pid], io_ring_frame[page_user_pid], USER_VIRT_RING, 1, 1);
+    return (uint8_t*)io_ring_frame[page_user_pid];
+}
+
+/* 
+ * page_ring: find the io ring page of the current pid
+ * Input: none
+ * Output: none
+ * Return value: the kernel address of the page, NULL if it is not mapped
+ * Side effect: none
+*/
+uint8_t* page_ring(void) {
+    if(!(user_page_table_mmap[page_user_pid][PT_ENTRY_NUM - 1].val & 0x1))
+        return NULL;
+    return (uint8_t*)io_ring_frame[page_user_pid];
+}
+
+/* 
+ * page_demand_fault: map a missing user page on first touch
+ * Input: addr - the faulting linear address (cr2)
+ * Output: none
+ * Return value: 0 if the page is mapped now, -1 if it is a real fault
+ * Side effect: take a frame for the page, fill it with the program image
+ *              from the file system and zero the rest, then map it; a heap
+ *              page below the break is just zeroed
+*/
+int32_t page_demand_fault(uint32_t addr) {
+    uint32_t page, image_offset, phys_addr;
+    int32_t bytes_read;
+    process_control_block_t* pcb;
+
+    if(addr >= USER_VIRT_HEAP && addr < USER_VIRT_HEAP + USER_MEM_SIZE)
+    {
+        // below the break of the pid, the page was never touched
+        if(addr >= get_pcb_by_pid(page_user_pid)->heap_brk || user_page_table_heap[page_user_pid][(addr & 0x003ff000) >> 12].present)
+            return -1;
+        phys_addr = frame_alloc(0);
+        if(phys_addr == 0)                                          // out of memory
+            return -1;
+        memset((uint8_t*)phys_addr, 0, PAGE_SIZE_4KB);
+        SET_PTE(user_page_table_heap[page_user_pid], phys_addr, addr & PAGE_ADDR_MASK, 1, 1);
+        return 0;
+    }
+    if(addr < USER_VIRT || addr >= USER_VIRT + USER_MEM_SIZE)      // not in the user program page
+        return -1;
+    if(user_page_table[page_user_pid][(addr & 0x003ff000) >> 12].present)   // protection fault
+        return -1;
+
+    page = addr & PAGE_ADDR_MASK;
+    phys_addr = frame_alloc(0);
+    if(phys_addr == 0)                                              // out of memory
+        return -1;
+
+    // copy the part of the program image that falls into this page
+    bytes_read = 0;
+    pcb = get_pcb_by_pid(page_user_pid);
+    if(page >= USER_PROGRAM_VIRT_ADDR && page < USER_STACK)
+    {
+        image_offset = page - USER_PROGRAM_VIRT_ADDR;
+        if(image_offset < pcb->program_length)
+        {
+            bytes_read = read_data(pcb->program_inode, image_offset, (uint8_t*)phys_addr, PAGE_SIZE_4KB);
+            if(bytes_read == -1)
+                bytes_read = 0;
+            read_ahead(&pcb->program_ra, pcb->program_inode, image_offset, bytes_read);
+            pcb->page_in_count++;
+            page_in_total++;
+        }
+    }
+    memset((uint8_t*)phys_addr + bytes_read, 0, PAGE_SIZE_4KB - bytes_read);
+    SET_PTE(user_page_table[page_user_pid], phys_addr, page, 1, 1);
+    return 0;
+}
+
 /* 
  * page_video_map: set PTE, PDE of page_table_video
  * Input: start, pid
@@ -87,6 +394,7 @@ void page_video_map(uint8_t ** start, uint32_t pid) {
 */
 void page_video_unmount(uint32_t pid) {
     SET_PTE(user_page_table_video, VIDEO_MEMORY, (uint32_t)USER_VIRT_VIDEO, 1, 0);
+    page_invlpg(USER_VIRT_VIDEO);
     // SET_PDE_PT(page_directory, (uint32_t)user_page_table_video, (uint32_t)USER_VIRT_VIDEO, 1, 0);
 
 }
@@ -96,7 +404,7 @@ void page_video_unmount(uint32_t pid) {
  * Input: pid
  * Output: none
  * Return value: none
- * Side effect: change the cr3 
+ * Side effect: invalidate the two video pages in the TLB
 */
 void switch_video_map_paging(int32_t pid){
     int32_t program_term, curr_term;
@@ -113,7 +421,7 @@ void switch_video_map_paging(int32_t pid){
         user_video_indicator = pcb->user_video_indicator;
     }
     if(curr_term == program_term){  // if current terminal, map to video memory
-        SET_PTE(page_table_0, (uint32_t)VIDEO_MEMORY, (uint32_t)VIDEO_MEMORY, 0, 1);
+        SET_PTE_GLOBAL(page_table_0, (uint32_t)VIDEO_MEMORY, (uint32_t)VIDEO_MEMORY);
         SET_PTE(user_page_table_video, (uint32_t)VIDEO_MEMORY, USER_VIRT_VIDEO, 1, user_video_indicator);
         // page_table_0[VIDEO_MEMORY >> 12].val = (VIDEO_MEMORY & 0xFFFFF000) | 0x1;
     }
@@ -121,22 +429,23 @@ void switch_video_map_paging(int32_t pid){
         switch (program_term)       // if not current terminal, map to backup video memory
         {
         case 0:
-            SET_PTE(page_table_0, (uint32_t)VIDEO_BACKUP_0, (uint32_t)VIDEO_MEMORY, 0, 1);
+            SET_PTE_GLOBAL(page_table_0, (uint32_t)VIDEO_BACKUP_0, (uint32_t)VIDEO_MEMORY);
             SET_PTE(user_page_table_video, (uint32_t)VIDEO_BACKUP_0, USER_VIRT_VIDEO, 1, user_video_indicator);
             break;
         case 1:
-            SET_PTE(page_table_0, (uint32_t)VIDEO_BACKUP_1, (uint32_t)VIDEO_MEMORY, 0, 1);
+            SET_PTE_GLOBAL(page_table_0, (uint32_t)VIDEO_BACKUP_1, (uint32_t)VIDEO_MEMORY);
             SET_PTE(user_page_table_video, (uint32_t)VIDEO_BACKUP_1, USER_VIRT_VIDEO, 1, user_video_indicator);
             break;
         case 2:
-            SET_PTE(page_table_0, (uint32_t)VIDEO_BACKUP_2, (uint32_t)VIDEO_MEMORY, 0, 1);
+            SET_PTE_GLOBAL(page_table_0, (uint32_t)VIDEO_BACKUP_2, (uint32_t)VIDEO_MEMORY);
             SET_PTE(user_page_table_video, (uint32_t)VIDEO_BACKUP_2, USER_VIRT_VIDEO, 1, user_video_indicator);
             break;
         default:
             break;
         }
     }
-    change_cr3();       // flush TLB
+    page_invlpg(VIDEO_MEMORY);      // only these two pages changed, the rest of the TLB stays
+    page_invlpg(USER_VIRT_VIDEO);
 }
 
 /* 
@@ -148,8 +457,8 @@ void switch_video_map_paging(int32_t pid){
  *              not changing program
 */
 void update_video_mapping() {
-    SET_PTE(page_table_0, (uint32_t)VIDEO_MEMORY, (uint32_t)VIDEO_MEMORY, 0, 1);
-    change_cr3();
+    SET_PTE_GLOBAL(page_table_0, (uint32_t)VIDEO_MEMORY, (uint32_t)VIDEO_MEMORY);
+    page_invlpg(VIDEO_MEMORY);
 }
 
 /* 
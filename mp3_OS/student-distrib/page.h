@@ -24,10 +24,18 @@
 
 #define KERNEL_MEMORY   0x00400000      // 4MB
 
-#define USER_PHYS_START 0x00800000
 #define USER_VIRT       0x08000000
 #define USER_VIRT_VIDEO 0x08400000
+#define USER_VIRT_MMAP  0x08800000      // 4mb window for read-only file mappings
+#define USER_VIRT_HEAP  0x08C00000      // 4mb window grown by brk, paged in on first touch
 #define USER_MEM_SIZE   0x00400000
+#define PAGE_SIZE_4KB   0x00001000
+#define USER_VIRT_RING  (USER_VIRT_MMAP + USER_MEM_SIZE - PAGE_SIZE_4KB)   // last page of the window: the io ring
+#define MMAP_WINDOW_PAGES (PT_ENTRY_NUM - 1)                               // pages left to mmap
+#define PAGE_ADDR_MASK  0xFFFFF000      // bit 31-12
+#define PTE_RW          0x00000002
+#define PTE_GLOBAL      0x00000100      // kept in the TLB across cr3 loads once CR4.PGE is on
+#define PTE_COW         0x00000200      // AVL bit: read only until the first write copies the frame
 
 
 /* This is a page director entry. */
@@ -89,6 +97,21 @@ void switch_video_map_paging(int32_t pid);
 void update_video_mapping();
 void restore_video_mapping(int32_t pid);
 void change_cr3();
+int32_t page_user_create(uint32_t pid);
+void page_user_destroy(uint32_t pid);
+void page_heap_trim(uint32_t pid, uint32_t heap_brk);
+int32_t page_user_fork(uint32_t parent, uint32_t child);
+int32_t page_cow_fault(uint32_t addr);
+int32_t page_demand_fault(uint32_t addr);
+uint32_t page_mmap_reserve(uint32_t page_num);
+void page_mmap_ro(uint32_t virt_addr, uint32_t phys_addr);
+uint8_t* page_ring_map(void);
+uint8_t* page_ring(void);
+
+extern uint32_t page_in_total;
+extern uint32_t page_user_pid;
+extern uint32_t mmap_next_page[];
+extern page_table_entry_t* user_page_table_heap[];
 
 
 
@@ -102,10 +125,25 @@ void change_cr3();
     (pd)[(vir_addr) >> 22].val = (((phys_addr) & 0xFFFFF000) | 0x02 | (priv)<<2 | (present));  \
 } while(0)
 
+// 0xFFFFF000: bit 31-12; read only
+#define SET_PTE_RO(pt, phys_addr, vir_addr, priv, present) do { \
+    (pt)[((vir_addr)&0x003ff000) >> 12].val = (((phys_addr) & 0xFFFFF000) | (priv)<<2 | (present)); \
+} while(0)
+
 // 0xFFFFF000: bit 31-12; 0x02 : 0000 0010 (r/w)
 #define SET_PTE(pt, phys_addr, vir_addr, priv, present) do { \
     (pt)[((vir_addr)&0x003ff000) >> 12].val = (((phys_addr) & 0xFFFFF000) | 0x02 | (priv)<<2 | (present)); \
 } while(0)
 
+// 0xFFFFF000: bit 31-12; 0x103 : global, r/w, present, kernel only; flush it with page_invlpg
+#define SET_PTE_GLOBAL(pt, phys_addr, vir_addr) do { \
+    (pt)[((vir_addr)&0x003ff000) >> 12].val = (((phys_addr) & 0xFFFFF000) | 0x103); \
+} while(0)
+
+/* drop the TLB entry of one page, global or not */
+static inline void page_invlpg(uint32_t virt_addr) {
+    asm volatile("invlpg (%0)" : : "r" (virt_addr) : "memory");
+}
+
 // #endif /* ASM */
 #endif /* _PAGE_H */
@@ -56,7 +56,7 @@ void switch_schedule()
 
     // prepare for context switch (in new process)
     tss.ss0  = (uint16_t)KERNEL_DS;
-    tss.esp0 = (uint32_t)(get_pcb_by_pid(pid_forward-1) - 4);
+    tss.esp0 = get_kernel_stack_bottom_by_pid(pid_forward);
     process_control_block_t* pcb_forward = get_pcb_by_pid(pid_forward);
 
     // reload context
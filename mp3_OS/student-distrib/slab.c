@@ -0,0 +1,235 @@
+#include "slab.h"
+
+static kmem_cache_t kmem_caches[SLAB_CACHE_MAX];
+static uint32_t kmem_cache_count;
+static kmem_cache_t* kmalloc_caches[KMALLOC_CLASSES];
+// per frame: KMALLOC_LARGE | order at the head of a kmalloc block too big for a slab, 0 otherwise
+static uint8_t slab_large[FRAME_NUM];
+static int8_t kmalloc_names[KMALLOC_CLASSES][16];
+
+/*
+ * slab_push
+ *   DESCRIPTION: Put a slab at the head of one of the lists of its cache
+ *   INPUTS: head -- the list
+ *           slab -- the slab
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void slab_push(slab_t** head, slab_t* slab){
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL)
+        (*head)->prev = slab;
+    *head = slab;
+}
+
+/*
+ * slab_unlink
+ *   DESCRIPTION: Take a slab out of the list it is on
+ *   INPUTS: head -- the list
+ *           slab -- the slab
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void slab_unlink(slab_t** head, slab_t* slab){
+    if (slab->prev == NULL)
+        *head = slab->next;
+    else
+        slab->prev->next = slab->next;
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+}
+
+/*
+ * slab_create
+ *   DESCRIPTION: Take a frame and cut it into free objects of a cache
+ *   INPUTS: cache -- the cache
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new slab, on no list yet; NULL if there are no frames left
+ *   SIDE EFFECTS: none
+ */
+static slab_t* slab_create(kmem_cache_t* cache){
+    slab_t* slab = (slab_t*)frame_alloc(0);
+    uint8_t* obj;
+    uint32_t i;
+    if (slab == NULL)
+        return NULL;
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free = NULL;
+    // link the objects back to front so the first one is handed out first
+    obj = (uint8_t*)slab + ((sizeof(slab_t) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1));
+    for (i = cache->per_slab; i > 0; i--) {
+        *(void**)(obj + (i - 1) * cache->obj_size) = slab->free;
+        slab->free = obj + (i - 1) * cache->obj_size;
+    }
+    cache->slabs++;
+    return slab;
+}
+
+/*
+ * slab_init
+ *   DESCRIPTION: Make the kmalloc caches, one for each power of two size
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: no frames are taken until the first allocation
+ */
+void slab_init(void){
+    uint32_t k;
+    int8_t* name;
+    for (k = 0; k < KMALLOC_CLASSES; k++) {
+        name = kmalloc_names[k];
+        strcpy(name, "kmalloc-");
+        itoa(1 << (KMALLOC_MIN_SHIFT + k), name + strlen(name), 10);
+        kmalloc_caches[k] = kmem_cache_create(name, 1 << (KMALLOC_MIN_SHIFT + k));
+    }
+}
+
+/*
+ * kmem_cache_create
+ *   DESCRIPTION: Make a cache of objects of one size
+ *   INPUTS: name -- kept, not copied
+ *           size -- bytes in an object, at most what fits in a slab after its header
+ *   OUTPUTS: none
+ *   RETURN VALUE: the cache, NULL if there are SLAB_CACHE_MAX already or size does not fit
+ *   SIDE EFFECTS: caches live until the kernel stops
+ */
+kmem_cache_t* kmem_cache_create(const int8_t* name, uint32_t size){
+    kmem_cache_t* cache;
+    uint32_t room = SLAB_SIZE - ((sizeof(slab_t) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1));
+    size = (size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+    if (size < sizeof(void*))
+        size = sizeof(void*);
+    if (kmem_cache_count == SLAB_CACHE_MAX || size > room)
+        return NULL;
+    cache = &kmem_caches[kmem_cache_count++];
+    memset(cache, 0, sizeof(kmem_cache_t));
+    cache->name = name;
+    cache->obj_size = size;
+    cache->per_slab = room / size;
+    return cache;
+}
+
+/*
+ * kmem_cache_alloc
+ *   DESCRIPTION: Take an object from a cache in constant time
+ *   INPUTS: cache -- the cache
+ *   OUTPUTS: none
+ *   RETURN VALUE: the object, its content left as it was; NULL if a new
+ *                 slab was needed and there are no frames left
+ *   SIDE EFFECTS: may take a frame for a new slab
+ */
+void* kmem_cache_alloc(kmem_cache_t* cache){
+    uint32_t flags;
+    slab_t* slab;
+    void* obj;
+    cli_and_save(flags);
+    slab = cache->partial;
+    if (slab == NULL) {
+        if (cache->empty != NULL) {
+            slab = cache->empty;
+            cache->empty = NULL;
+        } else if ((slab = slab_create(cache)) == NULL) {
+            restore_flags(flags);
+            return NULL;
+        }
+        slab_push(&cache->partial, slab);
+    }
+    obj = slab->free;
+    slab->free = *(void**)obj;
+    if (++slab->inuse == cache->per_slab) {
+        slab_unlink(&cache->partial, slab);
+        slab_push(&cache->full, slab);
+    }
+    cache->objs++;
+    restore_flags(flags);
+    return obj;
+}
+
+/*
+ * kmem_cache_free
+ *   DESCRIPTION: Give an object back to its cache in constant time
+ *   INPUTS: cache -- the cache it came from
+ *           obj -- the object
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: a slab left with no objects is kept as the spare, or its
+ *                 frame is freed when there is a spare already
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* obj){
+    uint32_t flags;
+    slab_t* slab = (slab_t*)((uint32_t)obj & ~(SLAB_SIZE - 1));
+    if (obj == NULL || slab->cache != cache)
+        return;
+    cli_and_save(flags);
+    if (slab->inuse == cache->per_slab) {
+        slab_unlink(&cache->full, slab);
+        slab_push(&cache->partial, slab);
+    }
+    *(void**)obj = slab->free;
+    slab->free = obj;
+    cache->objs--;
+    if (--slab->inuse == 0) {
+        slab_unlink(&cache->partial, slab);
+        if (cache->empty == NULL) {
+            cache->empty = slab;
+        } else {
+            frame_free((uint32_t)slab, 0);
+            cache->slabs--;
+        }
+    }
+    restore_flags(flags);
+}
+
+/*
+ * kmalloc
+ *   DESCRIPTION: Allocate kernel memory from the cache of the next power of
+ *                two, or whole frames past KMALLOC_MAX
+ *   INPUTS: size -- bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: the memory, SLAB_ALIGN aligned and not zeroed; NULL if
+ *                 there is not enough left
+ *   SIDE EFFECTS: none
+ */
+void* kmalloc(uint32_t size){
+    uint32_t k, addr;
+    if (size == 0)
+        return NULL;
+    if (size <= KMALLOC_MAX) {
+        for (k = 0; (1U << (KMALLOC_MIN_SHIFT + k)) < size; k++);
+        return kmem_cache_alloc(kmalloc_caches[k]);
+    }
+    for (k = 0; k <= FRAME_MAX_ORDER && (FRAME_SIZE << k) < size; k++);
+    addr = frame_alloc(k);
+    if (addr == 0)
+        return NULL;
+    slab_large[(addr - FRAME_START) / FRAME_SIZE] = KMALLOC_LARGE | k;
+    return (void*)addr;
+}
+
+/*
+ * kfree
+ *   DESCRIPTION: Give back memory from kmalloc or any kmem cache
+ *   INPUTS: ptr -- the memory, NULL is ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void kfree(void* ptr){
+    uint32_t addr = (uint32_t)ptr, frame;
+    if (addr < FRAME_START || addr >= FRAME_END)
+        return;
+    // slab objects are never at the start of a frame, the header is
+    if ((addr & (SLAB_SIZE - 1)) == 0) {
+        frame = (addr - FRAME_START) / FRAME_SIZE;
+        if (slab_large[frame] & KMALLOC_LARGE) {
+            frame_free(addr, slab_large[frame] & ~KMALLOC_LARGE);
+            slab_large[frame] = 0;
+        }
+        return;
+    }
+    kmem_cache_free(((slab_t*)(addr & ~(SLAB_SIZE - 1)))->cache, ptr);
+}
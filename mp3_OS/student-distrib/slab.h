@@ -0,0 +1,46 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include "types.h"
+#include "lib.h"
+#include "frame.h"
+
+// kernel objects carved out of page frames, one cache per type
+#define SLAB_SIZE           FRAME_SIZE  // a slab is one frame, its header at the start
+#define SLAB_ALIGN          8
+#define SLAB_CACHE_MAX      16
+#define KMALLOC_MIN_SHIFT   5           // the kmalloc caches hold 32 .. 2048 bytes
+#define KMALLOC_CLASSES     7
+#define KMALLOC_MAX         (1 << (KMALLOC_MIN_SHIFT + KMALLOC_CLASSES - 1))
+#define KMALLOC_LARGE       0x80        // slab_large: head of a kmalloc block of frames, the order in the low bits
+
+// the header of a slab; free objects are linked through their first word
+typedef struct slab_t
+{
+    struct slab_t* next;
+    struct slab_t* prev;
+    struct kmem_cache_t* cache;
+    void* free;                         // first free object, NULL when the slab is full
+    uint32_t inuse;
+} slab_t;
+
+typedef struct kmem_cache_t
+{
+    const int8_t* name;
+    uint32_t obj_size;                  // rounded up to SLAB_ALIGN
+    uint32_t per_slab;
+    slab_t* partial;                    // slabs with used and free objects, allocations come from here
+    slab_t* full;
+    slab_t* empty;                      // one spare slab, so a cache at the edge of a slab does not churn frames
+    uint32_t slabs;                     // frames held, the spare included
+    uint32_t objs;                      // objects handed out
+} kmem_cache_t;
+
+void          slab_init(void);
+kmem_cache_t* kmem_cache_create(const int8_t* name, uint32_t size);
+void*         kmem_cache_alloc(kmem_cache_t* cache);
+void          kmem_cache_free(kmem_cache_t* cache, void* obj);
+void*         kmalloc(uint32_t size);
+void          kfree(void* ptr);
+
+#endif
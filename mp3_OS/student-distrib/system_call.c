@@ -4,9 +4,18 @@
 #include "terminal.h"
 #include "scheduler.h"
 #include "signal.h"
+#include "frame.h"
+#include "slab.h"
 
 file_descriptor_t file_descriptor_table[MAX_FD_ENTRIES];
 uint32_t process_ids[PROCESS_COUNT] = {0};
+// open files of every process, shared by the fds that dup them
+static kmem_cache_t* open_file_cache;
+uint32_t open_file_count;
+// pcb of each live pid; the kernel stacks stay at the top of the kernel page
+static kmem_cache_t* pcb_cache;
+static process_control_block_t* pcb_table[PROCESS_COUNT];
+static process_control_block_t boot_pcb;    // stands in for a pid with no process, the boot stack's one
 // static int32_t shell_count = 0;
 
 #define MB_EIGHT 0x800000 
@@ -46,31 +55,309 @@ void fd_operations_table_init() {
     file_fops_table.fclose = file_close;
     file_fops_table.fread  = file_read;
     file_fops_table.fwrite = file_write;
+    file_fops_table.fseek  = file_seek;
+    file_fops_table.fpread = file_pread;
+    file_fops_table.fpwrite = file_pwrite;
 
     dir_fops_table.fopen  = dir_open;
     dir_fops_table.fclose = dir_close;
     dir_fops_table.fread  = dir_read;
     dir_fops_table.fwrite = dir_write;
+    dir_fops_table.fseek  = dir_seek;
+    dir_fops_table.fpread = bad_call;       // entries are read in order
+    dir_fops_table.fpwrite = bad_call;
 
     rtc_fops_table.fopen  = rtc_open;
     rtc_fops_table.fclose = rtc_close;
     rtc_fops_table.fread  = rtc_read;
     rtc_fops_table.fwrite = rtc_write;
+    rtc_fops_table.fseek  = bad_call;       // devices have no position
+    rtc_fops_table.fpread = bad_call;
+    rtc_fops_table.fpwrite = bad_call;
 
     stdin_fops_table.fopen  = bad_call;     // you might not open, close or write to stdin
     stdin_fops_table.fclose = bad_call;
     stdin_fops_table.fread  = terminal_read;
     stdin_fops_table.fwrite = bad_call;
+    stdin_fops_table.fseek  = bad_call;
+    stdin_fops_table.fpread = bad_call;
+    stdin_fops_table.fpwrite = bad_call;
 
     stdout_fops_table.fopen  = bad_call;    // you might not open, close or read from stdout
     stdout_fops_table.fclose = bad_call;
     stdout_fops_table.fread  = bad_call;
     stdout_fops_table.fwrite = terminal_write;
+    stdout_fops_table.fseek  = bad_call;
+    stdout_fops_table.fpread = bad_call;
+    stdout_fops_table.fpwrite = bad_call;
 
     file_descriptor_table[0].fops_table_ptr = &stdin_fops_table;
     file_descriptor_table[1].fops_table_ptr = &stdout_fops_table;
     file_descriptor_table[0].flags = 1;
     file_descriptor_table[1].flags = 1;
+    file_descriptor_table[0].refs = 1;      // held by the kernel, never freed
+    file_descriptor_table[1].refs = 1;
+}
+
+
+
+/* 
+ * process_cache_init: make the caches of pcbs and open files
+ * Input: none
+ * Output: none
+ * Return value: none
+ * Side effect: after slab_init, before the first execute
+*/
+void process_cache_init() {
+    pcb_cache = kmem_cache_create((int8_t*)"pcb", sizeof(process_control_block_t));
+    open_file_cache = kmem_cache_create((int8_t*)"open file", sizeof(file_descriptor_t));
+}
+
+
+
+/* 
+ * slot_find: find the lowest clear bit of a two level bitmap
+ * Input: full - bit w is set when used[w] is all ones
+ *        used - one bit per slot
+ *        words - words in used, at most 32
+ * Output: none
+ * Return value: the slot, -1 if every slot is used
+ * Side effect: none
+*/
+static int32_t slot_find(uint32_t full, const uint32_t* used, uint32_t words)
+{
+    uint32_t w;
+    if (full == 0xFFFFFFFF)
+        return -1;
+    w = __builtin_ctz(~full);
+    if (w >= words)
+        return -1;
+    return w * 32 + __builtin_ctz(~used[w]);
+}
+
+/* 
+ * slot_set: mark a slot used in a two level bitmap
+ * Input: full, used - the bitmap, slot - the slot
+ * Output: none
+ * Return value: none
+ * Side effect: may mark the word full
+*/
+static void slot_set(uint32_t* full, uint32_t* used, uint32_t slot)
+{
+    used[slot / 32] |= 1U << (slot % 32);
+    if (used[slot / 32] == 0xFFFFFFFF)
+        *full |= 1U << (slot / 32);
+}
+
+/* 
+ * slot_clear: mark a slot free in a two level bitmap
+ * Input: full, used - the bitmap, slot - the slot
+ * Output: none
+ * Return value: none
+ * Side effect: the word is not full any more
+*/
+static void slot_clear(uint32_t* full, uint32_t* used, uint32_t slot)
+{
+    used[slot / 32] &= ~(1U << (slot % 32));
+    *full &= ~(1U << (slot / 32));
+}
+
+/* 
+ * open_file_alloc: take an open file from its cache
+ * Input: none
+ * Output: none
+ * Return value: the open file with one reference, NULL if OPEN_FILE_MAX
+ *               are open or there is no memory left
+ * Side effect: none
+*/
+static file_descriptor_t* open_file_alloc(void)
+{
+    uint32_t flags;
+    file_descriptor_t* file = NULL;
+    cli_and_save(flags);
+    if (open_file_count < OPEN_FILE_MAX && (file = kmem_cache_alloc(open_file_cache)) != NULL)
+        open_file_count++;
+    restore_flags(flags);
+    if (file == NULL)
+        return NULL;
+    memset(file, 0, sizeof(file_descriptor_t));
+    file->flags = 1;
+    file->refs = 1;
+    return file;
+}
+
+/* 
+ * open_file_free: put an open file back into its cache
+ * Input: file - an open file from open_file_alloc
+ * Output: none
+ * Return value: none
+ * Side effect: none
+*/
+static void open_file_free(file_descriptor_t* file)
+{
+    uint32_t flags;
+    file->flags = 0;
+    cli_and_save(flags);
+    kmem_cache_free(open_file_cache, file);
+    open_file_count--;
+    restore_flags(flags);
+}
+
+/* 
+ * fd_table_init: give a new process stdin and stdout and nothing else
+ * Input: pcb - the new process
+ *        parent - its parent, whose fds 0 and 1 are shared; NULL for the terminals
+ * Output: none
+ * Return value: none
+ * Side effect: the table starts in the pcb
+*/
+void fd_table_init(process_control_block_t* pcb, process_control_block_t* parent)
+{
+    int32_t i;
+    pcb->fds = pcb->fd_inline;
+    pcb->fd_size = MAX_FD_ENTRIES;
+    pcb->fd_full = 0;
+    memset(pcb->fd_used, 0, sizeof(pcb->fd_used));
+    for (i = 0; i < MAX_FD_ENTRIES; i++)
+        pcb->fd_inline[i] = NULL;
+    for (i = 0; i < 2; i++)
+    {
+        if (parent != NULL && fd_file(parent, i) != NULL)
+            pcb->fds[i] = parent->fds[i];
+        else
+            pcb->fds[i] = &file_descriptor_table[i];
+        pcb->fds[i]->refs++;
+        slot_set(&pcb->fd_full, pcb->fd_used, i);
+    }
+}
+
+/* 
+ * fd_file: look up an fd of a process
+ * Input: pcb - the process, fd - the fd
+ * Output: none
+ * Return value: the open file, NULL if the fd is not open
+ * Side effect: none
+*/
+file_descriptor_t* fd_file(process_control_block_t* pcb, int32_t fd)
+{
+    if (fd < 0 || fd >= (int32_t)pcb->fd_size || !(pcb->fd_used[fd / 32] & (1U << (fd % 32))))
+        return NULL;
+    return pcb->fds[fd];
+}
+
+/* 
+ * fd_grow: make room in the fd table for an fd
+ * Input: pcb - the process, fd - below FD_MAX
+ * Output: none
+ * Return value: 0 if successful, -1 if there are no frames left
+ * Side effect: the table moves from the pcb to a page frame of its own the
+ *              first time fd is past the pcb slots
+*/
+static int32_t fd_grow(process_control_block_t* pcb, int32_t fd)
+{
+    file_descriptor_t** page;
+    int32_t i;
+    if (fd < (int32_t)pcb->fd_size)
+        return 0;
+    page = (file_descriptor_t**)frame_alloc(0);
+    if (page == NULL)
+        return -1;
+    for (i = 0; i < MAX_FD_ENTRIES; i++)
+        page[i] = pcb->fd_inline[i];
+    pcb->fds = page;
+    pcb->fd_size = FD_MAX;
+    return 0;
+}
+
+/* 
+ * fd_install: point an fd at an open file
+ * Input: pcb - the process, fd - a free slot below FD_MAX, file - the open file
+ * Output: none
+ * Return value: fd, -1 if the table cannot grow to hold it
+ * Side effect: the caller holds a reference for fd
+*/
+static int32_t fd_install(process_control_block_t* pcb, int32_t fd, file_descriptor_t* file)
+{
+    if (fd_grow(pcb, fd) == -1)
+        return -1;
+    pcb->fds[fd] = file;
+    slot_set(&pcb->fd_full, pcb->fd_used, fd);
+    return fd;
+}
+
+/* 
+ * fd_release: drop an fd, closing the open file with its last reference
+ * Input: pcb - the process, fd - an fd in use
+ * Output: none
+ * Return value: what fclose returns, 0 if other fds still share the file
+ * Side effect: the slot is free again
+*/
+static int32_t fd_release(process_control_block_t* pcb, int32_t fd)
+{
+    file_descriptor_t* file = pcb->fds[fd];
+    int32_t ret = 0;
+    if (--file->refs == 0)
+    {
+        ret = file->fops_table_ptr->fclose(fd);
+        open_file_free(file);
+    }
+    pcb->fds[fd] = NULL;
+    slot_clear(&pcb->fd_full, pcb->fd_used, fd);
+    return ret;
+}
+
+/* 
+ * fd_table_close: drop every fd of a halting process
+ * Input: pcb - the process
+ * Output: none
+ * Return value: none
+ * Side effect: files with no other fds are closed, and a grown table
+ *              goes back into the pcb
+*/
+void fd_table_close(process_control_block_t* pcb)
+{
+    uint32_t w, bits;
+    for (w = 0; w < FD_WORDS; w++)
+    {
+        for (bits = pcb->fd_used[w]; bits != 0; bits &= bits - 1)
+            fd_release(pcb, w * 32 + __builtin_ctz(bits));
+    }
+    if (pcb->fds != pcb->fd_inline)
+        frame_free((uint32_t)pcb->fds, 0);
+    pcb->fds = pcb->fd_inline;
+    pcb->fd_size = MAX_FD_ENTRIES;
+}
+
+
+/* 
+ * fd_table_fork: give a forked child every fd of its parent
+ * Input: pcb - the child, parent - the process that forks
+ * Output: none
+ * Return value: 0 if successful, -1 if the table cannot grow
+ * Side effect: each open file gains a reference; parent and child share
+ *              the file positions
+*/
+int32_t fd_table_fork(process_control_block_t* pcb, process_control_block_t* parent)
+{
+    uint32_t w, bits;
+    int32_t fd;
+    fd_table_init(pcb, parent);
+    for (w = 0; w < FD_WORDS; w++)
+    {
+        for (bits = parent->fd_used[w]; bits != 0; bits &= bits - 1)
+        {
+            fd = w * 32 + __builtin_ctz(bits);
+            if (fd < 2)                             // shared by fd_table_init
+                continue;
+            if (fd_install(pcb, fd, parent->fds[fd]) == -1)
+            {
+                fd_table_close(pcb);
+                return -1;
+            }
+            parent->fds[fd]->refs++;
+        }
+    }
+    return 0;
 }
 
 
@@ -89,35 +376,34 @@ int32_t halt(uint8_t status)
 {
     uint32_t return_value = (uint32_t)status; // initialize as interrupt happens to halt
     if(return_value == 255) return_value = 256;
-    uint32_t i;
     process_control_block_t* pcb_now= get_pcb();
     uint32_t pid_current = pcb_now->pid_now;
     process_ids[pid_current]=0; 
+    // close relevant FDs, the first shells too before they restart
+    fd_table_close(pcb_now);
     if(pid_current==0 || pid_current==1 || pid_current==2){
         printf("cannot halt first shell, restarting\n");
         process_ids[pid_current]=0;
         uint8_t* process= (uint8_t *)"shell"; // we choose to reboot the shell
         execute(process);
     }
-   
-    // close relevant FDs
-    for (i=2; i < MAX_FD_ENTRIES; ++i){
-        if(!pcb_now->fds[i].flags)
-            continue; // if the file is not open
-        close(i);
-        // close the file
-    }
+
 
     // restore parent paging
     // shell_page_init((uint32_t*)SHELL_PHYS_ADDR, (uint32_t*)USER_VIRT_ADDR);
-    process_control_block_t * pcb_prev= (process_control_block_t *)(MB_EIGHT-(pcb_now->pid_prev+1)*KB_EIGHT); // get the parent pcb (here we must have a prev)
+    process_control_block_t * pcb_prev= get_pcb_by_pid(pcb_now->pid_prev); // get the parent pcb (here we must have a prev)
     uint32_t prev_pid=pcb_prev->pid_now;
+    int32_t ebp_parent = pcb_now->ebp_inuse;    // the pcb is freed before the jump
+    int32_t esp_parent = pcb_now->esp_inuse;
     page_init_by_idx(prev_pid);
+    page_user_destroy(pid_current);             // the frames of the halted program
     page_video_unmount(pid_current);
     scheduler_queue[pcb_now->terminal_num] = pcb_now->pid_prev; // remove the pid from the scheduler queue
+    pcb_table[pid_current] = NULL;
+    kmem_cache_free(pcb_cache, pcb_now);
 
     // prepare context switch
-    tss.esp0 = MB_EIGHT-prev_pid*KB_EIGHT-4;
+    tss.esp0 = get_kernel_stack_bottom_by_pid(prev_pid);
     tss.ss0 = KERNEL_DS;
     // jump to execute return
     asm volatile(
@@ -128,8 +414,8 @@ int32_t halt(uint8_t status)
           ret            "
         :
         : "r" ((int32_t)return_value), \
-          "r" (pcb_now->ebp_inuse), \
-          "r" (pcb_now->esp_inuse) \
+          "r" (ebp_parent), \
+          "r" (esp_parent) \
         : "eax", "ebp", "esp");
         
     return 0;
@@ -149,7 +435,7 @@ int32_t execute(const uint8_t* command)
     int32_t pid, i, j, length;
     uint8_t buf[4] = {'\0'};
     uint8_t argument[BUF_SIZE]={'\0'};
-    uint8_t filename[32] = {'\0'};
+    uint8_t filename[PATH_MAX_SIZE + 1] = {'\0'};
     // uint8_t start_addr[4] = {'\0'};
 
     /* read the file name of the program to be executed */
@@ -161,6 +447,8 @@ int32_t execute(const uint8_t* command)
             i++;
             break;
         }
+        if (i == PATH_MAX_SIZE)     // the program path is too long
+            return -1;
         filename[i] = command[i];
     }
 
@@ -185,39 +473,50 @@ int32_t execute(const uint8_t* command)
     read_data(file_dentry.inode_num, 24, (uint8_t*)(&start_addr), 4);           // read the starting address of the program
 
     /* find a free pid */
-    for(pid=0; pid<PROCESS_COUNT; pid++) {
-        if((process_ids[pid])&&(pid == PROCESS_COUNT-1)) { // then no more pcb can be occupied
-            printf("max 6 programs!\n");
+    for(pid=0; pid<PROCESS_COUNT && process_ids[pid]; pid++);
+    if(pid == PROCESS_COUNT) {                  // then no more pcb can be occupied
+        printf("no free pid, %d programs running!\n", PROCESS_COUNT);
+        return -1;
+    }
+    process_ids[pid] = 1;                       // set the current pcb to be in use
+    if(pcb_table[pid] == NULL) {                // a first shell restarting in place keeps its pcb
+        pcb_table[pid] = kmem_cache_alloc(pcb_cache);
+        if(pcb_table[pid] == NULL) {
+            printf("out of memory!\n");
+            process_ids[pid] = 0;
             return -1;
         }
-        else if(!process_ids[pid]) {            // if the pcb is not in use
-            process_ids[pid]=1 - process_ids[pid];
-            break;
-        }
+        memset(pcb_table[pid], 0, sizeof(process_control_block_t));
     }
-    process_ids[pid] = 1;                       // set the current pcb to be in use
 
-    /* map user page */
+    /* user page tables from the frame allocator, the program is paged in by the page fault handler on first touch */
+    page_user_destroy((uint32_t)pid);           // a first shell restarting in place
+    if(page_user_create((uint32_t)pid) == -1) {
+        printf("out of memory!\n");
+        kmem_cache_free(pcb_cache, pcb_table[pid]);
+        pcb_table[pid] = NULL;
+        process_ids[pid] = 0;
+        return -1;
+    }
     page_init_by_idx((uint32_t)pid);            // set up the pages
     
-    /* copy the program to virtual address */
-    read_data(file_dentry.inode_num, 0, (uint8_t*)USER_PROGRAM_VIRT_ADDR, USER_STACK-USER_PROGRAM_VIRT_ADDR);
-    
     /* create PCB */
-    process_control_block_t* pcb_inuse = (process_control_block_t *)(MB_EIGHT-(pid+1)*KB_EIGHT); // pid is the first free pid
+    process_control_block_t* pcb_inuse = pcb_table[pid]; // pid is the first free pid
     pcb_inuse->pid_now = pid;                   // set the current pcb id and enable the process array
     pcb_inuse->user_video_indicator = 0;        // set user_bideo_indicator to 0
+    pcb_inuse->program_inode = file_dentry.inode_num;
+    pcb_inuse->program_length = file_length(file_dentry.inode_num);
+    pcb_inuse->page_in_count = 0;
+    pcb_inuse->heap_brk = USER_VIRT_HEAP;       // empty heap
+    read_ahead_reset(&pcb_inuse->program_ra);
     
-    /* initialize the file_descriptor_table for stdin and stdout */
-    pcb_inuse->fds[0].fops_table_ptr = &stdin_fops_table;
-    pcb_inuse->fds[1].fops_table_ptr = &stdout_fops_table;
-    pcb_inuse->fds[0].flags = 1;
-    pcb_inuse->fds[1].flags = 1;
-
     /* store the parent pid */
     if(pid!=0 && pid!=1 && pid!=2) pcb_inuse->pid_prev = get_pid(); // get_pid() is pid of the parent
     else pcb_inuse->pid_prev = INITIALIZATION_REQUIRED;             // set a impossible value for taking the parent of the first shell
 
+    /* stdin and stdout, shared with the parent */
+    fd_table_init(pcb_inuse, (pid!=0 && pid!=1 && pid!=2) ? get_pcb_by_pid(pcb_inuse->pid_prev) : NULL);
+
     /* store the terminal number that the process is running on */
     pcb_inuse->terminal_num = get_terminal_num(pid);
     
@@ -247,7 +546,7 @@ int32_t execute(const uint8_t* command)
     pcb_inuse->esp_inuse= reg_esp;
     
     /* fill in TSS, prepare for context switch */
-    tss.esp0 = (MB_EIGHT-(pid)*KB_EIGHT) - 4;           // store the current esp and ss
+    tss.esp0 = get_kernel_stack_bottom_by_pid(pid);     // store the current esp and ss
     tss.ss0  = KERNEL_DS;
 
     sti();
@@ -271,6 +570,64 @@ int32_t execute(const uint8_t* command)
 }
 
 
+/* 
+ * user_buf_ok: check a buffer lies in the program page or below the heap break
+ * Input: buf - user address, nbytes - its length, not negative
+ * Output: none
+ * Return value: 1 if the kernel may touch the whole buffer, otherwise 0
+ * Side effect: none
+ */
+static int32_t user_buf_ok(const void* buf, int32_t nbytes)
+{
+    uint32_t start = (uint32_t)buf;
+    uint32_t heap_brk = get_pcb_by_pid(get_pid())->heap_brk;
+    if (start >= USER_VIRT_ADDR && start <= USER_STACK && (uint32_t)nbytes <= USER_STACK - start)
+        return 1;
+    if (start >= USER_VIRT_HEAP && start <= heap_brk && (uint32_t)nbytes <= heap_brk - start)
+        return 1;
+    return 0;
+}
+
+
+/* 
+ * user_src_ok: check a buffer the kernel only reads from, which may also be
+ *              in the pages mmap has handed out
+ * Input: buf - user address, nbytes - its length, not negative
+ * Output: none
+ * Return value: 1 if the kernel may read the whole buffer, otherwise 0
+ * Side effect: none
+ */
+static int32_t user_src_ok(const void* buf, int32_t nbytes)
+{
+    uint32_t start = (uint32_t)buf;
+    uint32_t end = USER_VIRT_MMAP + mmap_next_page[get_pid()] * PAGE_SIZE_4KB;
+    if (start >= USER_VIRT_MMAP && start <= end && (uint32_t)nbytes <= end - start)
+        return 1;
+    return user_buf_ok(buf, nbytes);
+}
+
+
+/* 
+ * user_str_ok: check a string lies where user_buf_ok allows, NUL included
+ * Input: str - user address, max - most characters before the NUL
+ * Output: none
+ * Return value: 1 if the kernel may read the whole string, otherwise 0
+ * Side effect: none
+ */
+static int32_t user_str_ok(const uint8_t* str, uint32_t max)
+{
+    uint32_t len;
+    for (len = 0; len <= max; len++)
+    {
+        if (!user_buf_ok(str, len + 1))
+            return 0;
+        if (str[len] == '\0')
+            return 1;
+    }
+    return 0;
+}
+
+
 /* 
  * read: read from files
  * Input: fd - index in file descriptor
@@ -286,11 +643,11 @@ int32_t read(int32_t fd, void* buf, int32_t nbytes)
     process_control_block_t* pcb = get_pcb_by_pid(pid);
     //printf("read\n");
     if (fd == 1) return -1; // can't read stdout
-    if (fd < 0 || fd >= MAX_FD_ENTRIES)         // invalid fd
+    if (fd_file(pcb, fd) == NULL)   // fd not in use
         return -1;
-    if (pcb->fds[fd].flags == 0)   // fd not in use
+    if (!user_buf_ok(buf, nbytes))  // never into a read only mapping or the kernel
         return -1;
-    return pcb->fds[fd].fops_table_ptr->fread(fd, buf, nbytes);
+    return pcb->fds[fd]->fops_table_ptr->fread(fd, buf, nbytes);
 }
 
 
@@ -308,11 +665,12 @@ int32_t write(int32_t fd, const void* buf, int32_t nbytes)
     //if (fd==0) return -1; // can't write to stdin
     int32_t pid = get_pid();
     process_control_block_t* pcb = get_pcb_by_pid(pid);
-    if (fd <= 0 || fd >= MAX_FD_ENTRIES)         // invalid fd 
+    if (fd == 0) return -1; // can't write stdin
+    if (fd_file(pcb, fd) == NULL)   // fd not in use
         return -1;
-    if (pcb->fds[fd].flags == 0)   // fd not in use
+    if (!user_src_ok(buf, nbytes))   // a mapped file may be written out directly
         return -1;
-    return pcb->fds[fd].fops_table_ptr->fwrite(fd, buf, nbytes);
+    return pcb->fds[fd]->fops_table_ptr->fwrite(fd, buf, nbytes);
 }
 
 
@@ -329,48 +687,54 @@ int32_t open(const uint8_t* filename)
     int32_t i;
     int32_t pid = get_pid();
     process_control_block_t* pcb = get_pcb_by_pid(pid);
+    fops_table_t* fops_table_ptr;
+    file_descriptor_t* file;
     if (read_dentry_by_name(filename, &dentry) == -1)   // return -1 if file not found
         return -1;
-    // traverse file descriptor table to find an available entry
-    // FLAG
-    for (i = 2; i < MAX_FD_ENTRIES; i++) 
-    {
-        if (pcb->fds[i].flags == 0) 
-        {
-            pcb->fds[i].flags = 1;
-            break;
-        }
-    }
-    if (i == MAX_FD_ENTRIES)    // return -1 if no available entry
-        return -1;
     
     // FILE OPERATIONS TABLE
     switch (dentry.file_type) 
     {
         case 0:     // RTC file
-            pcb->fds[i].fops_table_ptr = &rtc_fops_table;
+            fops_table_ptr = &rtc_fops_table;
             break;
         case 1:     // Directory file
-            pcb->fds[i].fops_table_ptr = &dir_fops_table;
+            fops_table_ptr = &dir_fops_table;
             break;
         case 2:     // Regular file
-            pcb->fds[i].fops_table_ptr = &file_fops_table;
+        case FILE_TYPE_COMPRESSED:
+            fops_table_ptr = &file_fops_table;
             break;
         default:
             return -1;
     }
 
+    // the lowest free fd, and an open file for it
+    i = slot_find(pcb->fd_full, pcb->fd_used, FD_WORDS);
+    if (i == -1)                // return -1 if no available entry
+        return -1;
+    file = open_file_alloc();
+    if (file == NULL)
+        return -1;
+    file->fops_table_ptr = fops_table_ptr;
+    if (fd_install(pcb, i, file) == -1)
+    {
+        open_file_free(file);
+        return -1;
+    }
+
     // call fopen()
-    pcb->fds[i].fops_table_ptr->fopen(filename);
+    file->fops_table_ptr->fopen(filename);
 
-    // INODE
-    if (dentry.file_type == 2)
-        pcb->fds[i].inode = dentry.inode_num;
+    // INODE: the file, or the directory to list
+    if (dentry.file_type != 0)
+        file->inode = dentry.inode_num;
     else
-        pcb->fds[i].inode = 0;
+        file->inode = 0;
 
     // FILE POSITION
-    pcb->fds[i].file_position = 0;
+    file->file_position = 0;
+    read_ahead_reset(&file->ra);
 
     return i;
 }
@@ -387,12 +751,9 @@ int32_t close(int32_t fd)
 {
     int32_t pid = get_pid();
     process_control_block_t* pcb = get_pcb_by_pid(pid);
-    if (fd < 2 || fd >= MAX_FD_ENTRIES)         // invalid fd
-        return -1;
-    if (pcb->fds[fd].flags == 0)   // fd not in use
+    if (fd < 2 || fd_file(pcb, fd) == NULL)     // invalid fd, or not in use
         return -1;
-    pcb->fds[fd].flags = 0;
-    return pcb->fds[fd].fops_table_ptr->fclose(fd);
+    return fd_release(pcb, fd);
 }
 
 
@@ -494,70 +855,76 @@ int32_t sigreturn(void)
 
 
 /* 
- * malloc: allocate a certain amount of memory
- * Input: size - the size of the memory
+ * sbrk: move the heap break of the current process by an increment
+ * Input: increment - bytes to grow the heap by, negative to shrink it
  * Output: none
- * Return value: the address of the allocated memory
- * Side effect: none
+ * Return value: the old break, the start of the new memory; -1 if the
+ *               break would leave the heap window
+ * Side effect: see brk
  */
-int32_t malloc (int32_t size)
+int32_t sbrk (int32_t increment)
 {
-    // int32_t pid = get_pid();
-    // process_control_block_t* pcb = get_pcb_by_pid(pid);
-    if (size <= 0) return -1;
-    int32_t i;
-    for (i = 0; i < MAX_FD_ENTRIES; i++) {
-        // if (pcb->malloc_array[i].flags == 0) {
-        //     pcb->malloc_array[i].flags = 1;
-        //     pcb->malloc_array[i].size = size;
-        //     return (int32_t)(&(pcb->malloc_array[i].data));
-        // }
-    }
-    return -1;
+    process_control_block_t* pcb = get_pcb_by_pid(get_pid());
+    uint32_t old_brk = pcb->heap_brk;
+    if (increment > 0 && (uint32_t)increment > USER_VIRT_HEAP + USER_MEM_SIZE - old_brk)
+        return -1;
+    if (increment < 0 && -(uint32_t)increment > old_brk - USER_VIRT_HEAP)
+        return -1;
+    if (brk((void*)(old_brk + increment)) == -1)
+        return -1;
+    return (int32_t)old_brk;
 }
 
 
 /* 
- * free: free a certain amount of memory
- * Input: ptr - the address of the memory
+ * brk: set the heap break of the current process
+ * Input: addr - the new break, inside the heap window at USER_VIRT_HEAP
  * Output: none
  * Return value: 0 if successful, otherwise -1
- * Side effect: none
+ * Side effect: new heap pages are paged in zeroed on first touch; pages
+ *              above a lower break are freed at once
  */
-int32_t free (void* ptr)
+int32_t brk (void* addr)
 {
-    // int32_t pid = get_pid();
-    // process_control_block_t* pcb = get_pcb_by_pid(pid);
-    if (ptr == NULL) return -1;
-    int32_t i;
-    for (i = 0; i < MAX_FD_ENTRIES; i++) {
-        // if (ptr == (void*)(&(pcb->malloc_array[i].data))) {
-        //     pcb->malloc_array[i].flags = 0;
-        //     return 0;
-        // }
-    }
-    return -1;
+    process_control_block_t* pcb = get_pcb_by_pid(get_pid());
+    uint32_t new_brk = (uint32_t)addr;
+    if (new_brk < USER_VIRT_HEAP || new_brk > USER_VIRT_HEAP + USER_MEM_SIZE)
+        return -1;
+    if (new_brk < pcb->heap_brk)
+        page_heap_trim(pcb->pid_now, new_brk);
+    pcb->heap_brk = new_brk;
+    return 0;
 }
 
 
 /* 
  * ioctl: perform device-specific operations
  * Input: cmd - the command to be performed
- *        arg - the pointer of the command
+ *        arg - the pointer of the command, or the fd for the file commands
  * Output: none
  * Return value: 0 if successful, otherwise -1
  * Side effect: none
  */
 int32_t ioctl(unsigned long cmd, unsigned long arg)
 {
+    process_control_block_t* pcb = get_pcb_by_pid(get_pid());
     switch (cmd)
     {
-    case 0:
+    case IOCTL_PRINT_COLOR:
         print_color();
         break;
-    case 1:
+    case IOCTL_SET_COLOR:
         return setcolor((uint8_t*) arg);
         break;
+    case IOCTL_APPEND:
+        if (fd_file(pcb, (int32_t)arg) == NULL || pcb->fds[arg]->fops_table_ptr != &file_fops_table)
+            return -1;
+        pcb->fds[arg]->flags |= FD_APPEND;
+        return 0;
+    case IOCTL_TRUNCATE:
+        if (fd_file(pcb, (int32_t)arg) == NULL || pcb->fds[arg]->fops_table_ptr != &file_fops_table)
+            return -1;
+        return truncate_data(pcb->fds[arg]->inode, pcb->fds[arg]->file_position);
     default:
         break;
     }
@@ -567,6 +934,418 @@ int32_t ioctl(unsigned long cmd, unsigned long arg)
 
 
 
+/* 
+ * mmap: map the data blocks of an open file read only into user space
+ * Input: fd - file descriptor of a regular file
+ *        start - user pointer that receives the address of the mapping
+ * Output: none
+ * Return value: the length of the file if successful, otherwise -1
+ * Side effect: the file can be scanned in place without copying; the pages
+ *              end with the rest of the last block and stay until the next
+ *              execute in this pid
+ */
+int32_t mmap(int32_t fd, uint8_t** start)
+{
+    int32_t pid = get_pid();
+    process_control_block_t* pcb = get_pcb_by_pid(pid);
+    uint32_t length, block_num, virt_addr, i;
+    uint8_t* block_addr;
+    if (fd_file(pcb, fd) == NULL || pcb->fds[fd]->fops_table_ptr != &file_fops_table)   // only regular files
+        return -1;
+    if ((start > (uint8_t**) (USER_STACK-4)) || (start < (uint8_t**) USER_VIRT_ADDR))
+        return -1;
+    length = inode_length(pcb->fds[fd]->inode);
+    block_num = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (block_num == 0)
+    {
+        *start = NULL;
+        return 0;
+    }
+    // a disk image or a compressed file has no blocks that stay put, check before taking pages
+    for (i = 0; i < block_num; i++)
+        if (inode_block_addr(pcb->fds[fd]->inode, i) == NULL)
+            return -1;
+    virt_addr = page_mmap_reserve(block_num);
+    if (virt_addr == 0)                         // mapping window is full
+        return -1;
+    for (i = 0; i < block_num; i++)
+    {
+        block_addr = inode_block_addr(pcb->fds[fd]->inode, i);
+        page_mmap_ro(virt_addr + i * BLOCK_SIZE, (uint32_t)block_addr);
+    }
+    *start = (uint8_t*)virt_addr;
+    return length;
+}
+
+
+
+
+
+
+/* 
+ * getdents: read many directory entries in one call
+ * Input: fd - file descriptor of a directory
+ *        buf - user buffer for dirent_t records
+ *        nbytes - size of the buffer
+ * Output: none
+ * Return value: number of bytes filled, 0 at the end of the directory, -1 on failure
+ * Side effect: advance the file position of the fd
+ */
+int32_t getdents(int32_t fd, void* buf, int32_t nbytes)
+{
+    int32_t pid = get_pid();
+    process_control_block_t* pcb = get_pcb_by_pid(pid);
+    if (fd_file(pcb, fd) == NULL || pcb->fds[fd]->fops_table_ptr != &dir_fops_table)   // only directories
+        return -1;
+    if (nbytes < (int32_t)sizeof(dirent_t))
+        return -1;
+    if (!user_buf_ok(buf, nbytes))
+        return -1;
+    return dir_getdents(fd, buf, nbytes);
+}
+
+
+
+/* 
+ * fclone: copy a file onto another, the data blocks are shared until one of them is written
+ * Input: src - path of the regular file to copy
+ *        dst - path of an existing regular file to overwrite
+ * Output: none
+ * Return value: 0 on success, -1 on failure
+ * Side effect: replace the content of dst
+ */
+int32_t fclone(const uint8_t* src, const uint8_t* dst)
+{
+    if (!user_str_ok(src, PATH_MAX_SIZE) || !user_str_ok(dst, PATH_MAX_SIZE))
+        return -1;
+    return file_clone(src, dst);
+}
+
+
+
+/* 
+ * lseek: move the file position of an open file
+ * Input: fd - index in file descriptor
+ *        offset - bytes for a file, entries for a directory
+ *        whence - SEEK_SET, SEEK_CUR or SEEK_END
+ * Output: none
+ * Return value: the new position, -1 on failure or for a device
+ * Side effect: the next read or write starts there
+ */
+int32_t lseek(int32_t fd, int32_t offset, int32_t whence)
+{
+    int32_t pid = get_pid();
+    process_control_block_t* pcb = get_pcb_by_pid(pid);
+    if (fd_file(pcb, fd) == NULL)   // fd not in use
+        return -1;
+    return pcb->fds[fd]->fops_table_ptr->fseek(fd, offset, whence);
+}
+
+
+
+/* 
+ * pread: read from an offset without moving the file position
+ * Input: fd - index in file descriptor
+ *        buf - the buffer to load the data
+ *        nbytes - the length of the buffer
+ *        offset - where to read in the file
+ * Output: none
+ * Return value: the bytes read, 0 past the end, -1 on failure
+ * Side effect: none
+ */
+int32_t pread(int32_t fd, void* buf, int32_t nbytes, uint32_t offset)
+{
+    int32_t pid = get_pid();
+    process_control_block_t* pcb = get_pcb_by_pid(pid);
+    if (fd_file(pcb, fd) == NULL || nbytes < 0)     // fd not in use
+        return -1;
+    if (!user_buf_ok(buf, nbytes))
+        return -1;
+    return pcb->fds[fd]->fops_table_ptr->fpread(fd, buf, nbytes, offset);
+}
+
+
+
+/* 
+ * pwrite: write at an offset without moving the file position
+ * Input: fd - index in file descriptor
+ *        buf - the data to write
+ *        nbytes - the length of the data
+ *        offset - where to write in the file, past the end leaves a zero filled hole
+ * Output: none
+ * Return value: the bytes written, -1 on failure
+ * Side effect: may grow the file
+ */
+int32_t pwrite(int32_t fd, const void* buf, int32_t nbytes, uint32_t offset)
+{
+    int32_t pid = get_pid();
+    process_control_block_t* pcb = get_pcb_by_pid(pid);
+    if (fd_file(pcb, fd) == NULL || nbytes < 0)     // fd not in use
+        return -1;
+    if (!user_buf_ok(buf, nbytes))
+        return -1;
+    return pcb->fds[fd]->fops_table_ptr->fpwrite(fd, buf, nbytes, offset);
+}
+
+
+
+/* 
+ * io_setup: map an empty io ring into user space
+ * Input: ring - user pointer that receives the address of the ring
+ * Output: none
+ * Return value: 0 if successful, otherwise -1
+ * Side effect: a second call empties the ring again; the ring stays until
+ *              the next execute in this pid
+ */
+int32_t io_setup(io_ring_t** ring)
+{
+    io_ring_t* kernel_ring;
+    if ((ring > (io_ring_t**) (USER_STACK-4)) || (ring < (io_ring_t**) USER_VIRT_ADDR))
+        return -1;
+    kernel_ring = (io_ring_t*)page_ring_map();
+    if (kernel_ring == NULL)
+        return -1;
+    memset(kernel_ring, 0, sizeof(io_ring_t));
+    *ring = (io_ring_t*)USER_VIRT_RING;
+    return 0;
+}
+
+
+
+/* 
+ * io_run: run one submission as the system call it names
+ * Input: sqe - kernel copy of the submission
+ * Output: none
+ * Return value: the result of the call, -1 for a bad opcode or buffer
+ * Side effect: same as the call
+ */
+static int32_t io_run(io_sqe_t* sqe)
+{
+    uint8_t* buf = (uint8_t*)sqe->buf;
+    switch (sqe->opcode)
+    {
+        case IO_OP_NOP:
+            return 0;
+        case IO_OP_OPEN:
+            if (!user_str_ok(buf, PATH_MAX_SIZE))
+                return -1;
+            return open(buf);
+        case IO_OP_CLOSE:
+            return close(sqe->fd);
+        case IO_OP_READ:
+        case IO_OP_WRITE:
+        case IO_OP_PREAD:
+        case IO_OP_PWRITE:
+            if (sqe->nbytes < 0 || !user_buf_ok(buf, sqe->nbytes))
+                return -1;
+            break;
+        default:
+            return -1;
+    }
+    if (sqe->opcode == IO_OP_READ)
+        return read(sqe->fd, buf, sqe->nbytes);
+    if (sqe->opcode == IO_OP_WRITE)
+        return write(sqe->fd, buf, sqe->nbytes);
+    if (sqe->opcode == IO_OP_PREAD)
+        return pread(sqe->fd, buf, sqe->nbytes, sqe->offset);
+    return pwrite(sqe->fd, buf, sqe->nbytes, sqe->offset);
+}
+
+
+
+/* 
+ * io_enter: run the queued submissions of the io ring
+ * Input: to_submit - most submissions to run
+ * Output: none
+ * Return value: the submissions consumed, -1 if there is no ring or it is corrupt
+ * Side effect: the submissions run in ring order before this returns, so one
+ *              may use a buffer filled by an earlier one; a terminal read
+ *              blocks here as it would in read.  Stops early when the
+ *              completion queue is full.
+ */
+int32_t io_enter(int32_t to_submit)
+{
+    io_ring_t* ring = (io_ring_t*)page_ring();
+    io_sqe_t sqe;
+    io_cqe_t* cqe;
+    uint32_t head, tail;
+    int32_t done = 0;
+    if (ring == NULL || to_submit < 0)
+        return -1;
+    head = ring->sq_head;
+    tail = ring->sq_tail;
+    if (tail - head > IO_RING_SQ_SIZE)          // the program moved sq_head
+        return -1;
+    while (head != tail && done < to_submit)
+    {
+        if (ring->cq_tail - ring->cq_head >= IO_RING_CQ_SIZE)
+            break;
+        sqe = ring->sq[head & (IO_RING_SQ_SIZE - 1)];
+        cqe = &ring->cq[ring->cq_tail & (IO_RING_CQ_SIZE - 1)];
+        cqe->result = io_run(&sqe);
+        cqe->user_data = sqe.user_data;
+        ring->cq_tail++;
+        ring->sq_head = ++head;
+        done++;
+    }
+    return done;
+}
+
+
+
+/* 
+ * dup: open a second fd on an open file
+ * Input: fd - the fd to copy
+ * Output: none
+ * Return value: the lowest free fd, -1 on failure
+ * Side effect: both fds share the file position and flags
+ */
+int32_t dup(int32_t fd)
+{
+    int32_t pid = get_pid();
+    process_control_block_t* pcb = get_pcb_by_pid(pid);
+    int32_t new_fd;
+    if (fd_file(pcb, fd) == NULL)   // fd not in use
+        return -1;
+    new_fd = slot_find(pcb->fd_full, pcb->fd_used, FD_WORDS);
+    if (new_fd == -1 || fd_install(pcb, new_fd, pcb->fds[fd]) == -1)
+        return -1;
+    pcb->fds[fd]->refs++;
+    return new_fd;
+}
+
+
+
+/* 
+ * dup2: point a chosen fd at an open file
+ * Input: fd - the fd to copy
+ *        new_fd - the fd to set, closed first if it is open
+ * Output: none
+ * Return value: new_fd, -1 on failure
+ * Side effect: both fds share the file position and flags; dup2 onto 0 or 1
+ *              redirects the program and the programs it executes
+ */
+int32_t dup2(int32_t fd, int32_t new_fd)
+{
+    int32_t pid = get_pid();
+    process_control_block_t* pcb = get_pcb_by_pid(pid);
+    file_descriptor_t* file = fd_file(pcb, fd);
+    if (file == NULL || new_fd < 0 || new_fd >= FD_MAX)
+        return -1;
+    if (fd == new_fd)
+        return new_fd;
+    if (fd_grow(pcb, new_fd) == -1)
+        return -1;
+    file->refs++;
+    if (fd_file(pcb, new_fd) != NULL)
+        fd_release(pcb, new_fd);
+    return fd_install(pcb, new_fd, file);
+}
+
+
+
+/* 
+ * fork_enter: run a forked child until it halts
+ * Input: child - pcb of the child
+ *        context - the registers the child returns to user space with,
+ *                  at the top of its kernel stack
+ * Output: none
+ * Return value: the status of the child, halt returns here
+ * Side effect: the child starts in sys_call_linkage as if its fork returned 0
+ */
+static int32_t __attribute__((noinline)) fork_enter(process_control_block_t* child, hw_context_t* context)
+{
+    /* store current esp & ebp, halt of the child jumps back with them */
+    register uint32_t reg_ebp asm("ebp");
+    child->ebp_inuse = reg_ebp;
+    register uint32_t reg_esp asm("esp");
+    child->esp_inuse = reg_esp;
+    asm volatile (
+       "movl %0, %%esp ;\
+        jmp fork_return ;"
+        :
+        : "r" (context)
+        : "memory");
+    return -1;
+}
+
+
+
+/* 
+ * fork: copy the current process into a new pid, copy on write
+ * Input: none
+ * Output: none
+ * Return value: the pid of the child in the parent, once the child halted
+ *               as with execute; 0 in the child; -1 on failure
+ * Side effect: the child gets the program and heap pages of the parent,
+ *              shared until one of them writes, its fds, signal handlers
+ *              and terminal; it takes the place of the parent in the
+ *              scheduler until it halts
+ */
+int32_t fork(void)
+{
+    cli();
+    int32_t pid;
+    int32_t parent_pid = get_pid();
+    process_control_block_t* parent = get_pcb_by_pid(parent_pid);
+    process_control_block_t* child;
+    hw_context_t* context;
+
+    if (parent_pid < 0 || parent_pid >= PROCESS_COUNT || !process_ids[parent_pid])
+    {
+        sti();
+        return -1;
+    }
+    for(pid=0; pid<PROCESS_COUNT && process_ids[pid]; pid++);
+    if(pid == PROCESS_COUNT) {
+        printf("no free pid, %d programs running!\n", PROCESS_COUNT);
+        sti();
+        return -1;
+    }
+    child = pcb_table[pid];
+    if (child == NULL)
+        child = kmem_cache_alloc(pcb_cache);
+    page_user_destroy((uint32_t)pid);           // as in execute
+    if (child == NULL || page_user_fork(parent_pid, pid) == -1)
+    {
+        page_user_destroy(pid);
+        kmem_cache_free(pcb_cache, child);
+        pcb_table[pid] = NULL;
+        sti();
+        return -1;
+    }
+    pcb_table[pid] = child;
+    memcpy(child, parent, sizeof(process_control_block_t));
+    child->pid_now = pid;
+    child->pid_prev = parent_pid;
+    memset(child->signals, 0, sizeof(child->signals));
+    memset(child->sa_mask, 0, sizeof(child->sa_mask));
+    child->page_in_count = 0;
+    read_ahead_reset(&child->program_ra);
+    if (fd_table_fork(child, parent) == -1)
+    {
+        page_user_destroy(pid);                 // the parent gets write access back on its next write
+        pcb_table[pid] = NULL;
+        kmem_cache_free(pcb_cache, child);
+        sti();
+        return -1;
+    }
+    process_ids[pid] = 1;
+    scheduler_queue[child->terminal_num] = pid;
+
+    /* the child leaves the kernel with the registers of the parent's fork call */
+    context = (hw_context_t*)(get_kernel_stack_bottom_by_pid(pid) - sizeof(hw_context_t));
+    memcpy(context, (hw_context_t*)(get_kernel_stack_bottom() - sizeof(hw_context_t)), sizeof(hw_context_t));
+    context->EAX = 0;
+    page_init_by_idx(pid);
+    tss.esp0 = get_kernel_stack_bottom_by_pid(pid);
+    tss.ss0  = KERNEL_DS;
+    fork_enter(child, context);
+    return pid;
+}
+
+
+
 /* ---------- HELPER FUNCTIONS BELOW ---------- */
 
 
@@ -591,21 +1370,21 @@ int32_t get_pid(void){
  * Side effect: none
 */
 process_control_block_t* get_pcb(void){
-    int32_t pid = get_pid();
-    return (process_control_block_t*) (MB_EIGHT-(pid+1)*KB_EIGHT);
+    return get_pcb_by_pid(get_pid());
 }
 
 /* 
  * get_pcb_by_pid: get the pcb by a given pid
  * Input: pid
  * Output: none
- * Return value: the pcb by a certain pid
+ * Return value: the pcb by a certain pid; a spare pcb when no process
+ *               runs in the pid, such as the boot stack before the shells
  * Side effect: none
 */
 process_control_block_t* get_pcb_by_pid(int32_t pid){
-    if (pid == -1)
-        return (process_control_block_t*)MB_EIGHT;
-    return (process_control_block_t*) (MB_EIGHT-(pid+1)*KB_EIGHT);
+    if (pid < 0 || pid >= PROCESS_COUNT || pcb_table[pid] == NULL)
+        return &boot_pcb;
+    return pcb_table[pid];
 }
 
 /* 
@@ -632,6 +1411,16 @@ int32_t get_terminal_num(int32_t pid){
  * Side effect: none
 */
 int32_t get_kernel_stack_bottom(void){
-    int32_t pid = get_pid();
+    return get_kernel_stack_bottom_by_pid(get_pid());
+}
+
+/* 
+ * get_kernel_stack_bottom_by_pid: get the kernel stack bottom of a given pid
+ * Input: pid
+ * Output: none
+ * Return value: the kernel stack bottom, for tss.esp0
+ * Side effect: none
+*/
+int32_t get_kernel_stack_bottom_by_pid(int32_t pid){
     return (MB_EIGHT - pid*KB_EIGHT - 4);
 }
@@ -7,8 +7,11 @@
 #include "rtc.h"
 #include "terminal.h"
 
-#define MAX_FD_ENTRIES  8
-#define PROCESS_COUNT   6
+#define MAX_FD_ENTRIES  8               // fd slots kept in the pcb
+#define FD_MAX          1024            // slots once the table grows into a page of its own
+#define FD_WORDS        (FD_MAX / 32)   // words of the fd bitmap, one bit per slot
+#define OPEN_FILE_MAX   512             // open files shared by every process
+#define PROCESS_COUNT   64              // pid slots, a kernel stack each at the top of the kernel page
 #define BUF_SIZE        128
 #define SIGNAL_NUM      5
 
@@ -23,13 +26,69 @@ typedef struct fops_table_t {
     int32_t (*fclose)(int32_t fd);
     int32_t (*fread)(int32_t fd, void* buf, int32_t nbytes);
     int32_t (*fwrite)(int32_t fd, const void* buf, int32_t nbytes);
+    int32_t (*fseek)(int32_t fd, int32_t offset, int32_t whence);
+    int32_t (*fpread)(int32_t fd, void* buf, int32_t nbytes, uint32_t offset);
+    int32_t (*fpwrite)(int32_t fd, const void* buf, int32_t nbytes, uint32_t offset);
 } fops_table_t;
 
+// lseek whence
+#define SEEK_SET        0
+#define SEEK_CUR        1
+#define SEEK_END        2
+
+#define FD_APPEND       0x2             // flags bit: every write goes to the end of the file
+
+// ioctl commands
+#define IOCTL_PRINT_COLOR   0
+#define IOCTL_SET_COLOR     1
+#define IOCTL_APPEND        2           // arg: fd, switch the file to append mode
+#define IOCTL_TRUNCATE      3           // arg: fd, cut the file at its file position
+
+// io ring: one page per pid shared with user space; the program queues
+// submissions at sq_tail, io_enter runs them in order and posts completions at cq_tail
+#define IO_RING_SQ_SIZE 64              // power of 2
+#define IO_RING_CQ_SIZE 128             // power of 2
+
+// io ring opcodes
+#define IO_OP_NOP       0
+#define IO_OP_READ      1
+#define IO_OP_WRITE     2
+#define IO_OP_OPEN      3               // buf: the file name, fd unused
+#define IO_OP_CLOSE     4
+#define IO_OP_PREAD     5
+#define IO_OP_PWRITE    6
+
+typedef struct io_sqe_t {
+    uint32_t opcode;
+    int32_t  fd;
+    void*    buf;
+    int32_t  nbytes;
+    uint32_t offset;                    // pread and pwrite only
+    uint32_t user_data;                 // handed back in the completion
+} io_sqe_t;
+
+typedef struct io_cqe_t {
+    uint32_t user_data;
+    int32_t  result;                    // what the system call would have returned
+} io_cqe_t;
+
+typedef struct io_ring_t {
+    uint32_t sq_head;                   // moved by the kernel, the indexes run free
+    uint32_t sq_tail;                   // moved by the program
+    uint32_t cq_head;                   // moved by the program
+    uint32_t cq_tail;                   // moved by the kernel
+    io_sqe_t sq[IO_RING_SQ_SIZE];
+    io_cqe_t cq[IO_RING_CQ_SIZE];
+} io_ring_t;
+
+// an open file; dup and execute share one between fds through refs
 typedef struct file_descriptor_t {
     fops_table_t* fops_table_ptr;
     uint32_t inode;
     uint32_t file_position;
     uint32_t flags;
+    readahead_t ra;
+    uint32_t refs;                      // fds pointing here
 } file_descriptor_t;
 
 
@@ -37,6 +96,7 @@ extern uint32_t process_ids[PROCESS_COUNT];
 extern file_descriptor_t file_descriptor_table[MAX_FD_ENTRIES];
 extern int32_t shell_count;
 void fd_operations_table_init();
+void process_cache_init();
 
 typedef struct process_control_block
 {
@@ -52,7 +112,16 @@ typedef struct process_control_block
     int8_t signals[SIGNAL_NUM];
     int8_t sa_mask[SIGNAL_NUM];
     void*  sigaction[SIGNAL_NUM];
-    file_descriptor_t fds[8];
+    file_descriptor_t** fds;            // fd_inline, or the fd page of the pid once more are open
+    file_descriptor_t* fd_inline[MAX_FD_ENTRIES];
+    uint32_t fd_size;                   // slots in fds
+    uint32_t fd_full;                   // bit w: word w of fd_used has no clear bit
+    uint32_t fd_used[FD_WORDS];
+    uint32_t program_inode;             // image the user pages are filled from
+    uint32_t program_length;
+    uint32_t page_in_count;             // pages filled from the image on first touch
+    readahead_t program_ra;             // readahead of the image as pages fault in
+    uint32_t heap_brk;                  // end of the heap, USER_VIRT_HEAP when it is empty
 } process_control_block_t;
 
 int32_t halt(uint8_t status);
@@ -65,18 +134,36 @@ int32_t getargs(uint8_t* buf, int32_t nbytes);
 int32_t vidmap(uint8_t** screen_start);
 int32_t set_handler(int32_t signum, void* handler_address);
 int32_t sigreturn(void);
-int32_t malloc (int32_t size);
-int32_t free (void* ptr);
+int32_t sbrk (int32_t increment);
+int32_t brk (void* addr);
 int32_t ioctl(unsigned long cmd, unsigned long arg);
+int32_t mmap(int32_t fd, uint8_t** start);
+int32_t getdents(int32_t fd, void* buf, int32_t nbytes);
+int32_t fclone(const uint8_t* src, const uint8_t* dst);
+int32_t lseek(int32_t fd, int32_t offset, int32_t whence);
+int32_t pread(int32_t fd, void* buf, int32_t nbytes, uint32_t offset);
+int32_t pwrite(int32_t fd, const void* buf, int32_t nbytes, uint32_t offset);
+int32_t io_setup(io_ring_t** ring);
+int32_t io_enter(int32_t to_submit);
+int32_t dup(int32_t fd);
+int32_t dup2(int32_t fd, int32_t new_fd);
+int32_t fork(void);
 
 
 
 int32_t get_pid(void);
 int32_t get_kernel_stack_bottom(void);
+int32_t get_kernel_stack_bottom_by_pid(int32_t pid);
 int32_t get_terminal_num(int32_t pid);
 
 
 
+void fd_table_init(process_control_block_t* pcb, process_control_block_t* parent);
+void fd_table_close(process_control_block_t* pcb);
+int32_t fd_table_fork(process_control_block_t* pcb, process_control_block_t* parent);
+file_descriptor_t* fd_file(process_control_block_t* pcb, int32_t fd);
+extern uint32_t open_file_count;
+
 process_control_block_t* get_pcb(void);
 process_control_block_t* get_pcb_by_pid(int32_t pid);
 
@@ -4,6 +4,8 @@
 
 #include "debug.h"
 #include "file_system.h"
+#include "bcache.h"
+#include "crc32c.h"
 #include "i8259.h"
 #include "idt.h"
 #include "idt_handler.h"
@@ -12,6 +14,8 @@
 #include "keyboard.h"
 #include "multiboot.h"
 #include "page.h"
+#include "frame.h"
+#include "slab.h"
 #include "rtc.h"
 #include "terminal.h"
 
@@ -24,6 +28,9 @@
 #define KERNEL_START 0x400000
 #define KERNEL_SIZE 0x400000
 #define MAX_DIRECTORY_NUM 63
+#define HASH_BENCH_ROUNDS 100
+#define TLB_BENCH_ROUNDS  1000
+#define TLB_BENCH_PAGES   8		// 4mb frame pages touched after each flush
 
 /* format these macros as you see fit */
 #define TEST_HEADER 	\
@@ -626,6 +633,763 @@ int dir_write_test(){
 	return FAIL;
 }
 
+/*dentry_hash_bench
+ * 
+ * Look up every file name through the hash index and through the linear
+ * scan, check both give the same index and print the cycles per lookup
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None
+ * Coverage: File System
+ * Files: file_system.c/h
+*/
+int dentry_hash_bench(){
+	TEST_HEADER;
+	uint8_t  names[MAX_DIRECTORY_NUM][FILENAME_MAX_SIZE+1];	// names with a terminating NUL
+	dentry_t dentry;
+	int32_t  i, round, count;
+	uint32_t start, hashed_cycles, linear_cycles;
+	int result = PASS;
+
+	for (count=0; count<MAX_DIRECTORY_NUM; count++)
+	{
+		if (-1 == read_dentry_by_index(count, &dentry))
+			break;
+		memcpy(names[count], dentry.file_name, FILENAME_MAX_SIZE);
+		names[count][FILENAME_MAX_SIZE] = '\0';
+	}
+	if (count == 0)
+		return FAIL;
+
+	start = rdtsc();
+	for (round=0; round<HASH_BENCH_ROUNDS; round++)
+		for (i=0; i<count; i++)
+			if (dentry_lookup_hashed(names[i]) != i)
+				result = FAIL;
+	hashed_cycles = rdtsc() - start;
+
+	start = rdtsc();
+	for (round=0; round<HASH_BENCH_ROUNDS; round++)
+		for (i=0; i<count; i++)
+			if (dentry_lookup_linear(names[i]) != i)
+				result = FAIL;
+	linear_cycles = rdtsc() - start;
+
+	printf("%d entries, hashed: %u cycles/lookup, linear: %u cycles/lookup\n", count,
+			hashed_cycles / (HASH_BENCH_ROUNDS*count), linear_cycles / (HASH_BENCH_ROUNDS*count));
+	return result;
+}
+
+/*write_data_test
+ * 
+ * Create a file, overwrite it in the middle, append past the end with a
+ * hole, cut it short and check the bytes read back each time
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes the file "write_data_test"
+ * Coverage: File System
+ * Files: file_system.c/h
+*/
+int write_data_test(){
+	TEST_HEADER;
+	uint8_t name[] = "write_data_test";
+	uint8_t buf[16];
+	dentry_t dentry;
+	int result = PASS;
+
+	if (-1 == dir_write(0, name, 0) || -1 == read_dentry_by_name(name, &dentry))
+		return FAIL;
+	if (write_data(dentry.inode_num, 0, (uint8_t*)"hello", 5) != 5)		// new file
+		result = FAIL;
+	if (write_data(dentry.inode_num, 3, (uint8_t*)"XY", 2) != 2)		// in place
+		result = FAIL;
+	if (write_data(dentry.inode_num, 8, (uint8_t*)"!", 1) != 1)		// hole of 3 bytes
+		result = FAIL;
+	if (read_data(dentry.inode_num, 0, buf, 16) != 9 || strncmp((int8_t*)buf, "helXY", 5) != 0)
+		result = FAIL;
+	if (buf[5] != 0 || buf[6] != 0 || buf[7] != 0 || buf[8] != '!')
+		result = FAIL;
+	if (truncate_data(dentry.inode_num, 2) != 0 || inode_length(dentry.inode_num) != 2)
+		result = FAIL;
+	if (dir_write(0, name, -299) == -1)
+		result = FAIL;
+	return result;
+}
+
+/*path_lookup_test
+ * 
+ * Make a subdirectory with a file in it, resolve the file by path and
+ * list the subdirectory, then remove both
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes "path_test" and "path_test/inner"
+ * Coverage: File System
+ * Files: file_system.c/h
+*/
+int path_lookup_test(){
+	TEST_HEADER;
+	dentry_t dir, file;
+	uint8_t buf[FILENAME_MAX_SIZE];
+	int result = PASS;
+
+	if (-1 == dir_write(0, "path_test", DIR_WRITE_MKDIR) || -1 == dir_write(0, "path_test/inner", 0))
+		return FAIL;
+	if (read_dentry_by_name((uint8_t*)"path_test", &dir) == -1 || dir.file_type != 1)
+		result = FAIL;
+	if (read_dentry_by_name((uint8_t*)"/path_test/./inner", &file) == -1 || file.file_type != 2)
+		result = FAIL;
+	if (read_directory_in(dir.inode_num, buf, 0) != 5 || strncmp((int8_t*)buf, "inner", 5) != 0)
+		result = FAIL;
+	if (dir_write(0, "path_test", DIR_WRITE_REMOVE) != -1)		// not empty yet
+		result = FAIL;
+	if (dir_write(0, "path_test/inner", DIR_WRITE_REMOVE) == -1 || dir_write(0, "path_test", DIR_WRITE_REMOVE) == -1)
+		result = FAIL;
+	return result;
+}
+
+/*bcache_test
+ * 
+ * With the image on the ATA disk, read a file twice; the second read must
+ * be served from the buffer cache without a single miss
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: none, passes trivially on the module image
+ * Coverage: File System, Buffer Cache
+ * Files: file_system.c/h, bcache.c/h
+*/
+int bcache_test(){
+	TEST_HEADER;
+	dentry_t dentry;
+	uint8_t buf[8192];
+	uint32_t misses;
+
+	if (!fs_disk)
+		return PASS;
+	if (read_dentry_by_name((uint8_t*)"frame0.txt", &dentry) == -1)
+		return FAIL;
+	if (read_data(dentry.inode_num, 0, buf, sizeof(buf)) <= 0)
+		return FAIL;
+	misses = bcache_misses;
+	if (read_data(dentry.inode_num, 0, buf, sizeof(buf)) <= 0)
+		return FAIL;
+	return (misses == bcache_misses) ? PASS : FAIL;
+}
+
+/*readahead_test
+ * 
+ * Feed read_ahead a sequential stream and then a seek; the window must
+ * start at RA_WINDOW_MIN, double, and drop to 0 after the seek
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: queues blocks of frame0.txt, passes trivially on the module image
+ * Coverage: File System
+ * Files: file_system.c/h
+*/
+int readahead_test(){
+	TEST_HEADER;
+	dentry_t dentry;
+	readahead_t ra;
+
+	if (!fs_disk)
+		return PASS;
+	if (read_dentry_by_name((uint8_t*)"frame0.txt", &dentry) == -1)
+		return FAIL;
+	read_ahead_reset(&ra);
+	read_ahead(&ra, dentry.inode_num, 0, 100);
+	if (ra.window != RA_WINDOW_MIN)
+		return FAIL;
+	read_ahead(&ra, dentry.inode_num, 100, 100);
+	if (ra.window != 2 * RA_WINDOW_MIN)
+		return FAIL;
+	read_ahead(&ra, dentry.inode_num, 50, 100);
+	return (ra.window == 0) ? PASS : FAIL;
+}
+
+/*trie_test
+ * 
+ * Complete "fr" to its longest common prefix and pick the second match,
+ * then check a created file shows up in the trie and goes with its removal
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes "frozen.txt"
+ * Coverage: File System, Tab Completion
+ * Files: file_system.c/h
+*/
+int trie_test(){
+	TEST_HEADER;
+	uint8_t name[FILENAME_MAX_SIZE + 1];
+	int result = PASS;
+
+	if (trie_prefix((uint8_t*)"fr", 2, name) != 2 || strncmp((int8_t*)name, "frame", 6) != 0)
+		result = FAIL;
+	if (trie_match((uint8_t*)"fr", 2, 1, name) == -1 || strncmp((int8_t*)name, "frame1.txt", 11) != 0)
+		result = FAIL;
+	if (dir_write(0, "frozen.txt", 0) == -1)
+		return FAIL;
+	if (trie_prefix((uint8_t*)"fr", 2, name) != 3 || strncmp((int8_t*)name, "fr", 3) != 0)
+		result = FAIL;
+	if (dir_write(0, "frozen.txt", DIR_WRITE_REMOVE) == -1 || trie_prefix((uint8_t*)"fro", 3, name) != 0)
+		result = FAIL;
+	return result;
+}
+
+/*dir_remove_swap_test
+ * 
+ * Remove an entry from the middle of the root; the last entry must take
+ * its index and still be found by the hashed lookup
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes "swap_a" and "swap_b"
+ * Coverage: File System
+ * Files: file_system.c/h
+*/
+int dir_remove_swap_test(){
+	TEST_HEADER;
+	int32_t index;
+	int result = PASS;
+
+	if (dir_write(0, "swap_a", 0) == -1 || dir_write(0, "swap_b", 0) == -1)
+		return FAIL;
+	index = dentry_lookup_hashed((uint8_t*)"swap_a");
+	if (dir_write(0, "swap_a", DIR_WRITE_REMOVE) == -1)
+		result = FAIL;
+	if (dentry_lookup_hashed((uint8_t*)"swap_b") != index || dentry_lookup_linear((uint8_t*)"swap_b") != index)
+		result = FAIL;
+	if (dir_write(0, "swap_b", DIR_WRITE_REMOVE) == -1)
+		result = FAIL;
+	return result;
+}
+
+/*clone_test
+ * 
+ * Clone a file, then write the clone; the original must keep its data
+ * and removing both must give every shared block back
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes "clone_a" and "clone_b"
+ * Coverage: File System
+ * Files: file_system.c/h
+*/
+int clone_test(){
+	TEST_HEADER;
+	dentry_t a, b;
+	uint8_t buf[8];
+	uint32_t used;
+	int result = PASS;
+
+	if (dir_write(0, "clone_a", 0) == -1 || dir_write(0, "clone_b", 0) == -1)
+		return FAIL;
+	read_dentry_by_name((uint8_t*)"clone_a", &a);
+	read_dentry_by_name((uint8_t*)"clone_b", &b);
+	write_data(a.inode_num, 0, (uint8_t*)"original", 8);
+	used = bitmap_counter;
+	if (file_clone((uint8_t*)"clone_a", (uint8_t*)"clone_b") == -1 || bitmap_counter != used)
+		result = FAIL;
+	if (write_data(b.inode_num, 0, (uint8_t*)"changed!", 8) != 8 || bitmap_counter != used + 1)
+		result = FAIL;
+	if (read_data(a.inode_num, 0, buf, 8) != 8 || strncmp((int8_t*)buf, "original", 8) != 0)
+		result = FAIL;
+	if (read_data(b.inode_num, 0, buf, 8) != 8 || strncmp((int8_t*)buf, "changed!", 8) != 0)
+		result = FAIL;
+	dir_write(0, "clone_a", DIR_WRITE_REMOVE);
+	dir_write(0, "clone_b", DIR_WRITE_REMOVE);
+	if (bitmap_counter != used - 1)
+		result = FAIL;
+	return result;
+}
+
+/*crc_test
+ * 
+ * Check both CRC32C paths against the standard check value, then, on an
+ * image built with a checksum table, that a written file reads back
+ * through verify-on-read and the scrub finds nothing wrong
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes "crc_a"
+ * Coverage: File System
+ * Files: file_system.c/h, crc32c.c/h
+*/
+int crc_test(){
+	TEST_HEADER;
+	dentry_t d;
+	uint8_t buf[16];
+	uint32_t i, errors;
+	int result = PASS;
+
+	crc32c_init();
+	if (crc32c_sw(0, (uint8_t*)"123456789", 9) != 0xE3069283)
+		result = FAIL;
+	if (crc32c_sse42 && crc32c_hw(0, (uint8_t*)"123456789", 9) != 0xE3069283)
+		result = FAIL;
+	if (!fs_crc_on)
+		return result;
+	errors = crc_errors;
+	if (dir_write(0, "crc_a", 0) == -1 || read_dentry_by_name((uint8_t*)"crc_a", &d) == -1)
+		return FAIL;
+	if (write_data(d.inode_num, 0, (uint8_t*)"checksummed", 11) != 11)
+		result = FAIL;
+	if (read_data(d.inode_num, 0, buf, 11) != 11 || strncmp((int8_t*)buf, "checksummed", 11) != 0)
+		result = FAIL;
+	for (i = 0; i < 100; i++)
+		file_system_tick();
+	if (crc_errors != errors)
+		result = FAIL;
+	dir_write(0, "crc_a", DIR_WRITE_REMOVE);
+	return result;
+}
+
+/*lz_test
+ * 
+ * Expand a hand built LZ4 block with an overlapping match, reject one
+ * whose match reaches before the output, and check that a compressed
+ * file in the image reads back and refuses writes
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None
+ * Coverage: File System
+ * Files: file_system.c/h
+*/
+int lz_test(){
+	TEST_HEADER;
+	uint8_t block[] = {0x32, 'a', 'b', 'c', 0x03, 0x00, 0x10, '!'};
+	uint8_t bad[] = {0x10, 'a', 0x02, 0x00};
+	uint8_t out[16];
+	dentry_t d;
+	uint32_t i;
+	int result = PASS;
+
+	if (lz_decompress(block, sizeof(block), out, sizeof(out)) != 10 || strncmp((int8_t*)out, "abcabcabc!", 10) != 0)
+		result = FAIL;
+	if (lz_decompress(bad, sizeof(bad), out, sizeof(out)) != -1)
+		result = FAIL;
+	if (lz_decompress(block, sizeof(block), out, 9) != -1)
+		result = FAIL;
+	for (i = 0; read_dentry_by_index(i, &d) == 0; i++)
+	{
+		if (d.file_type != FILE_TYPE_COMPRESSED)
+			continue;
+		if (file_length(d.inode_num) > 0 && read_data(d.inode_num, 0, out, sizeof(out)) <= 0)
+			result = FAIL;
+		if (write_data(d.inode_num, 0, out, 1) != -1)
+			result = FAIL;
+	}
+	return result;
+}
+
+/*seek_test
+ * 
+ * Open "frame0.txt" in a fresh fd table, seek around it and read at
+ * offsets; pread must match read_data and leave the file position alone
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: uses the fd table of the current pcb and puts it back
+ * Coverage: File System, System Call
+ * Files: file_system.c/h
+*/
+int seek_test(){
+	TEST_HEADER;
+	process_control_block_t* pcb = get_pcb_by_pid(get_pid());
+	process_control_block_t saved = *pcb;
+	dentry_t d;
+	uint8_t a[8], b[8];
+	int32_t fd;
+	int result = PASS;
+
+	if (read_dentry_by_name((uint8_t*)"frame0.txt", &d) == -1)
+		return FAIL;
+	fd_table_init(pcb, NULL);
+	fd = open((uint8_t*)"frame0.txt");
+	if (fd == -1)
+		result = FAIL;
+	else
+	{
+		if (file_seek(fd, 24, SEEK_SET) != 24 || file_seek(fd, -4, SEEK_CUR) != 20 || file_seek(fd, -21, SEEK_CUR) != -1)
+			result = FAIL;
+		if (file_seek(fd, 0, SEEK_END) != (int32_t)file_length(d.inode_num) || file_read(fd, a, 8) != 0)
+			result = FAIL;
+		if (file_pread(fd, a, 8, 20) != 8 || read_data(d.inode_num, 20, b, 8) != 8 || strncmp((int8_t*)a, (int8_t*)b, 8) != 0)
+			result = FAIL;
+		if (pcb->fds[fd]->file_position != file_length(d.inode_num))
+			result = FAIL;
+	}
+	fd_table_close(pcb);
+	*pcb = saved;
+	return result;
+}
+
+/*fd_test
+ * 
+ * Open "frame0.txt" past the slots of the pcb, dup and dup2 an fd and
+ * check the copies share the file position, then close everything
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: uses the fd table of the current pcb and the fd page of
+ *               pid 0, and puts the pcb back
+ * Coverage: System Call
+ * Files: system_call.c/h
+*/
+int fd_test(){
+	TEST_HEADER;
+	process_control_block_t* pcb = get_pcb_by_pid(get_pid());
+	process_control_block_t saved = *pcb;
+	uint32_t before = open_file_count;
+	uint8_t a[4];
+	int32_t i;
+	int result = PASS;
+
+	fd_table_init(pcb, NULL);
+	pcb->pid_now = 0;
+	for (i = 2; i < 40; i++)
+	{
+		if (open((uint8_t*)"frame0.txt") != i)
+			result = FAIL;
+	}
+	if (pcb->fd_size != FD_MAX || open_file_count != before + 38)
+		result = FAIL;
+	if (dup(2) != 40 || dup2(2, 100) != 100 || pcb->fds[2]->refs != 3)
+		result = FAIL;
+	if (file_read(40, a, 4) != 4 || pcb->fds[2]->file_position != 4 || pcb->fds[100]->file_position != 4)
+		result = FAIL;
+	if (close(5) != 0 || fd_file(pcb, 5) != NULL || open((uint8_t*)"frame0.txt") != 5)
+		result = FAIL;
+	if (dup2(3, 100) != 100 || pcb->fds[2]->refs != 2 || close(100) != 0 || pcb->fds[3]->refs != 1)
+		result = FAIL;
+	if (close(0) != -1 || close(FD_MAX) != -1 || dup(FD_MAX - 1) != -1)
+		result = FAIL;
+	fd_table_close(pcb);
+	if (open_file_count != before)
+		result = FAIL;
+	*pcb = saved;
+	return result;
+}
+
+/*io_ring_test
+ * 
+ * Map the io ring of a spare pid by hand, queue a nop, an open of a kernel
+ * string and a bad opcode, and run them in two io_enter calls
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: none, the frames of the spare pid are freed again
+ * Coverage: System Call, Paging
+ * Files: system_call.c/h, page.c/h
+*/
+int io_ring_test(){
+	TEST_HEADER;
+	uint32_t saved_pid = page_user_pid;
+	io_ring_t* ring;
+	int result = PASS;
+
+	page_user_pid = PROCESS_COUNT - 1;		// no program runs in the last pid
+	if (page_user_create(page_user_pid) == -1 || (ring = (io_ring_t*)page_ring_map()) == NULL)
+	{
+		page_user_destroy(page_user_pid);
+		page_user_pid = saved_pid;
+		return FAIL;
+	}
+	memset(ring, 0, sizeof(io_ring_t));
+	if ((io_ring_t*)page_ring() != ring)
+		result = FAIL;
+	ring->sq[0].opcode = IO_OP_NOP;
+	ring->sq[0].user_data = 7;
+	ring->sq[1].opcode = IO_OP_OPEN;
+	ring->sq[1].buf = "frame0.txt";			// not a user pointer
+	ring->sq[1].user_data = 8;
+	ring->sq[2].opcode = 99;
+	ring->sq_tail = 3;
+	if (io_enter(2) != 2 || io_enter(8) != 1 || ring->sq_head != 3 || ring->cq_tail != 3)
+		result = FAIL;
+	if (ring->cq[0].user_data != 7 || ring->cq[0].result != 0)
+		result = FAIL;
+	if (ring->cq[1].user_data != 8 || ring->cq[1].result != -1 || ring->cq[2].result != -1)
+		result = FAIL;
+	ring->sq_tail = ring->sq_head + IO_RING_SQ_SIZE + 1;	// corrupt
+	if (io_enter(1) != -1)
+		result = FAIL;
+	page_user_destroy(page_user_pid);
+	page_user_pid = saved_pid;
+	return result;
+}
+
+/*heap_test
+ * 
+ * Give a spare pid a three page heap, fault its pages in by hand, check a
+ * page past the break is refused, then lower the break to one page
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: none, the frames of the spare pid are freed again
+ * Coverage: Paging
+ * Files: page.c/h, system_call.c/h
+*/
+int heap_test(){
+	TEST_HEADER;
+	uint32_t saved_pid = page_user_pid;
+	process_control_block_t* pcb = get_pcb_by_pid(PROCESS_COUNT - 1);
+	uint32_t saved_brk = pcb->heap_brk;
+	uint32_t before = frame_free_count;
+	int result = PASS;
+
+	page_user_pid = PROCESS_COUNT - 1;		// no program runs in the last pid
+	if (page_user_create(page_user_pid) == -1)
+	{
+		page_user_pid = saved_pid;
+		return FAIL;
+	}
+	pcb->heap_brk = USER_VIRT_HEAP + 2 * PAGE_SIZE_4KB + 1;
+	if (page_demand_fault(USER_VIRT_HEAP) != 0 || page_demand_fault(USER_VIRT_HEAP + PAGE_SIZE_4KB + 8) != 0
+	 || page_demand_fault(USER_VIRT_HEAP + 2 * PAGE_SIZE_4KB) != 0)
+		result = FAIL;
+	if (page_demand_fault(USER_VIRT_HEAP) != -1 || page_demand_fault(USER_VIRT_HEAP + 3 * PAGE_SIZE_4KB) != -1)
+		result = FAIL;
+	if (frame_free_count != before - 6)		// three page tables, three pages
+		result = FAIL;
+	page_heap_trim(page_user_pid, USER_VIRT_HEAP + 1);
+	if (frame_free_count != before - 4)
+		result = FAIL;
+	page_user_destroy(page_user_pid);
+	if (frame_free_count != before)
+		result = FAIL;
+	pcb->heap_brk = saved_brk;
+	page_user_pid = saved_pid;
+	return result;
+}
+
+/*cow_test
+ * 
+ * Fork the address space of a spare pid with one heap page into another,
+ * then write the page from the child and from the parent
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: none, the frames of both spare pids are freed again
+ * Coverage: Paging
+ * Files: page.c/h, frame.c/h
+*/
+int cow_test(){
+	TEST_HEADER;
+	uint32_t saved_pid = page_user_pid;
+	uint32_t parent = PROCESS_COUNT - 2, child = PROCESS_COUNT - 1;	// no program runs in the last pids
+	process_control_block_t* pcb = get_pcb_by_pid(parent);
+	uint32_t saved_brk = pcb->heap_brk;
+	uint32_t before = frame_free_count;
+	uint32_t frame;
+	int result = PASS;
+
+	page_user_pid = parent;
+	pcb->heap_brk = USER_VIRT_HEAP + PAGE_SIZE_4KB;
+	if (page_user_create(parent) == -1 || page_demand_fault(USER_VIRT_HEAP) != 0)
+	{
+		page_user_destroy(parent);
+		pcb->heap_brk = saved_brk;
+		page_user_pid = saved_pid;
+		return FAIL;
+	}
+	frame = user_page_table_heap[parent][0].val & PAGE_ADDR_MASK;
+	*(uint32_t*)frame = 391;
+	if (page_user_fork(parent, child) == -1)
+		result = FAIL;
+	else
+	{
+		// shared and read only in both
+		if (user_page_table_heap[child][0].val != user_page_table_heap[parent][0].val
+		 || (user_page_table_heap[child][0].val & (PTE_RW | PTE_COW)) != PTE_COW || !frame_shared(frame))
+			result = FAIL;
+		page_user_pid = child;
+		if (page_cow_fault(USER_VIRT_HEAP) != 0 || (user_page_table_heap[child][0].val & PAGE_ADDR_MASK) == frame
+		 || *(uint32_t*)(user_page_table_heap[child][0].val & PAGE_ADDR_MASK) != 391 || frame_shared(frame))
+			result = FAIL;
+		// the parent holds the last reference, so it keeps the frame
+		page_user_pid = parent;
+		if (page_cow_fault(USER_VIRT_HEAP) != 0 || (user_page_table_heap[parent][0].val & PAGE_ADDR_MASK) != frame
+		 || !(user_page_table_heap[parent][0].val & PTE_RW) || page_cow_fault(USER_VIRT_HEAP) != -1)
+			result = FAIL;
+		page_user_destroy(child);
+	}
+	page_user_destroy(parent);
+	if (frame_free_count != before)
+		result = FAIL;
+	pcb->heap_brk = saved_brk;
+	page_user_pid = saved_pid;
+	return result;
+}
+
+/* turn CR4.PGE on or off; either way the whole TLB is flushed, global pages too */
+static void tlb_set_pge(int on){
+	asm volatile(
+		"movl  %%cr4, %%eax;        \
+		 andl  $0xFFFFFF7F, %%eax;  \
+		 orl   %0, %%eax;           \
+		 movl  %%eax, %%cr4;"
+		: /*no output*/
+		: "r" (on ? 0x80 : 0)
+		: "%eax", "memory"
+	);
+}
+
+/* read one word from the kernel page, the video page and each test frame page */
+static void tlb_touch(){
+	uint32_t i;
+	(void)*(volatile uint32_t*)page_directory;
+	(void)*(volatile uint32_t*)VIDEO_MEMORY;
+	for (i = 0; i < TLB_BENCH_PAGES; i++)
+		(void)*(volatile uint32_t*)(FRAME_START + (i << 22));
+}
+
+/*tlb_bench
+ * 
+ * Reload cr3 and touch the kernel pages with CR4.PGE off and on, then remap
+ * the video page with a cr3 reload and with invlpg, print the cycles per round
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None, PGE is left on and the video page mapped to itself
+ * Coverage: Paging
+ * Files: page.c/h
+*/
+int tlb_bench(){
+	TEST_HEADER;
+	uint32_t start, flat_cycles, global_cycles, reload_cycles, invlpg_cycles;
+	uint32_t round;
+
+	tlb_set_pge(0);
+	start = rdtsc();
+	for (round=0; round<TLB_BENCH_ROUNDS; round++)
+	{
+		change_cr3();
+		tlb_touch();
+	}
+	flat_cycles = rdtsc() - start;
+
+	tlb_set_pge(1);
+	start = rdtsc();
+	for (round=0; round<TLB_BENCH_ROUNDS; round++)
+	{
+		change_cr3();
+		tlb_touch();
+	}
+	global_cycles = rdtsc() - start;
+
+	// how a terminal switch remapped the video page before and after
+	start = rdtsc();
+	for (round=0; round<TLB_BENCH_ROUNDS; round++)
+	{
+		SET_PTE(page_table_0, (uint32_t)VIDEO_MEMORY, (uint32_t)VIDEO_MEMORY, 0, 1);
+		change_cr3();
+		tlb_touch();
+	}
+	reload_cycles = rdtsc() - start;
+
+	start = rdtsc();
+	for (round=0; round<TLB_BENCH_ROUNDS; round++)
+	{
+		update_video_mapping();
+		tlb_touch();
+	}
+	invlpg_cycles = rdtsc() - start;
+
+	printf("cr3 reload: %u cycles/round without global pages, %u with\n",
+			flat_cycles / TLB_BENCH_ROUNDS, global_cycles / TLB_BENCH_ROUNDS);
+	printf("video remap: %u cycles/round by cr3 reload, %u by invlpg\n",
+			reload_cycles / TLB_BENCH_ROUNDS, invlpg_cycles / TLB_BENCH_ROUNDS);
+	return (page_table_0[VIDEO_MEMORY >> 12].val & PTE_GLOBAL) ? PASS : FAIL;
+}
+
+/*slab_test
+ * 
+ * Fill four slabs of the 64 byte kmalloc cache, free them in another order,
+ * then take and free a block too big for a slab
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: none, the cache keeps the one spare slab it had
+ * Coverage: Paging
+ * Files: slab.c/h, frame.c/h
+*/
+int slab_test(){
+	TEST_HEADER;
+	uint32_t* obj[200];
+	uint32_t before, i;
+	uint8_t* big;
+	int result = PASS;
+
+	kfree(kmalloc(64));			// the cache has its spare slab now
+	before = frame_free_count;
+	for (i = 0; i < 200; i++)
+	{
+		obj[i] = kmalloc(64);
+		if (obj[i] == NULL || ((uint32_t)obj[i] & (SLAB_ALIGN - 1)) != 0 || ((uint32_t)obj[i] & (SLAB_SIZE - 1)) == 0)
+			return FAIL;
+		obj[i][0] = i;
+		obj[i][15] = i;
+	}
+	for (i = 0; i < 200; i++)
+	{
+		if (obj[i][0] != i || obj[i][15] != i)
+			result = FAIL;
+	}
+	for (i = 0; i < 200; i += 2)
+		kfree(obj[i]);
+	for (i = 1; i < 200; i += 2)
+		kfree(obj[i]);
+	if (frame_free_count != before)
+		result = FAIL;
+	big = kmalloc(3 * FRAME_SIZE);
+	if (big == NULL || ((uint32_t)big & (FRAME_SIZE - 1)) != 0 || frame_free_count != before - 4)
+		result = FAIL;
+	kfree(big);
+	if (frame_free_count != before || kmalloc(0) != NULL)
+		result = FAIL;
+	// a pid with no process gets the spare pcb
+	if (get_pcb_by_pid(PROCESS_COUNT - 1) != get_pcb_by_pid(-1))
+		result = FAIL;
+	return result;
+}
+
+/*frame_test
+ * 
+ * Take blocks of every order from the buddy allocator, check they are
+ * aligned to their size and do not overlap, then give them back and check
+ * the buddies merge into a 4mb block again
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: none, every frame is given back
+ * Coverage: Paging
+ * Files: frame.c/h
+*/
+int frame_test(){
+	TEST_HEADER;
+	uint32_t before = frame_free_count;
+	uint32_t block[FRAME_MAX_ORDER + 1];
+	uint32_t order, big;
+	int result = PASS;
+
+	for (order = 0; order <= FRAME_MAX_ORDER; order++)
+	{
+		block[order] = frame_alloc(order);
+		if (block[order] == 0 || (block[order] - FRAME_START) % (FRAME_SIZE << order) != 0)
+			result = FAIL;
+		else
+			*(uint32_t*)block[order] = order;		// the kernel maps every frame
+	}
+	if (frame_free_count != before - ((1 << (FRAME_MAX_ORDER + 1)) - 1))
+		result = FAIL;
+	for (order = 0; order <= FRAME_MAX_ORDER; order++)
+	{
+		if (block[order] != 0 && *(uint32_t*)block[order] != order)
+			result = FAIL;
+	}
+	if (frame_alloc(FRAME_MAX_ORDER + 1) != 0)
+		result = FAIL;
+	for (order = 0; order <= FRAME_MAX_ORDER; order++)
+	{
+		if (block[order] != 0)
+			frame_free(block[order], order);
+	}
+	big = frame_alloc(FRAME_MAX_ORDER);
+	if (frame_free_count != before - (1 << FRAME_MAX_ORDER) || big == 0)
+		result = FAIL;
+	frame_free(big, FRAME_MAX_ORDER);
+	if (frame_free_count != before)
+		result = FAIL;
+	return result;
+}
+
 /* @@ Checkpoint 3 tests */
 /* @@ Checkpoint 4 tests */
 /* @@ Checkpoint 5 tests */
@@ -670,5 +1434,23 @@ void launch_tests(){
 	// TEST_OUTPUT("dir_write_test", dir_write_test());
 	// TEST_OUTPUT("dir_read_test", 	dir_read_test());
 	// TEST_OUTPUT("file_read_test", 	file_read_test());
+	// TEST_OUTPUT("dentry_hash_bench", dentry_hash_bench());
+	// TEST_OUTPUT("write_data_test", write_data_test());
+	// TEST_OUTPUT("path_lookup_test", path_lookup_test());
+	// TEST_OUTPUT("bcache_test", bcache_test());
+	// TEST_OUTPUT("readahead_test", readahead_test());
+	// TEST_OUTPUT("trie_test", trie_test());
+	// TEST_OUTPUT("dir_remove_swap_test", dir_remove_swap_test());
+	// TEST_OUTPUT("clone_test", clone_test());
+	// TEST_OUTPUT("crc_test", crc_test());
+	// TEST_OUTPUT("lz_test", lz_test());
+	// TEST_OUTPUT("seek_test", seek_test());
+	// TEST_OUTPUT("io_ring_test", io_ring_test());
+	// TEST_OUTPUT("fd_test", fd_test());
+	// TEST_OUTPUT("frame_test", frame_test());
+	// TEST_OUTPUT("heap_test", heap_test());
+	// TEST_OUTPUT("slab_test", slab_test());
+	// TEST_OUTPUT("cow_test", cow_test());
+	// TEST_OUTPUT("tlb_bench", tlb_bench());
 	// launch your tests here
 }
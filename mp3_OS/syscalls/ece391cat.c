@@ -7,6 +7,7 @@ int main ()
 {
     int32_t fd, cnt;
     uint8_t buf[1024];
+    uint8_t* map;
 
     if (0 != ece391_getargs (buf, 1024)) {
         ece391_fdputs (1, (uint8_t*)"could not read arguments\n");
@@ -18,6 +19,11 @@ int main ()
 	return 2;
     }
 
+    /* write the mapped file in one call; fall back to reading */
+    if (-1 != (cnt = ece391_mmap (fd, &map)) &&
+	(0 == cnt || -1 != ece391_write (1, map, cnt)))
+	return 0;
+
     while (0 != (cnt = ece391_read (fd, buf, 1024))) {
         if (-1 == cnt) {
 	    ece391_fdputs (1, (uint8_t*)"file read failed\n");
@@ -3,13 +3,48 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
+#define CP_CHUNK 4096
+#define CP_BATCH 16	/* chunks per trap, a read and a write each */
+
+static uint8_t chunks[CP_BATCH][CP_CHUNK];
+
+/*
+ * Copy length bytes from fd1 to fd2 through the io ring, CP_BATCH chunks a
+ * trap: each pread is queued ahead of the pwrite that sends its buffer on,
+ * and the ring runs them in order.  Leaves fd2 positioned at length.
+ */
+int32_t
+ring_copy (struct ece391_io_ring* ring, int32_t fd1, int32_t fd2, uint32_t length)
+{
+    struct ece391_cqe cqe;
+    uint32_t off, len;
+    int32_t i, ret;
+
+    ret = 0;
+    for (off = 0; off < length && 0 == ret; ) {
+        for (i = 0; i < CP_BATCH && off < length; i++, off += len) {
+            len = length - off < CP_CHUNK ? length - off : CP_CHUNK;
+            ece391_io_queue (ring, IO_OP_PREAD, fd1, chunks[i], len, off, len);
+            ece391_io_queue (ring, IO_OP_PWRITE, fd2, chunks[i], len, off, len);
+        }
+        ece391_io_enter (2 * i);
+        while (0 == ece391_io_reap (ring, &cqe))
+            if (cqe.result != (int32_t)cqe.user_data)
+                ret = -1;
+    }
+    if (0 == ret && -1 == ece391_lseek (fd2, length, SEEK_SET))
+        ret = -1;
+    return ret;
+}
+
 int main ()
 {
-    int32_t fd1, fd2, cnt;
+    struct ece391_io_ring* ring;
+    int32_t fd1, fd2, cnt, length;
     uint8_t buf[1024];
     uint8_t buf2[1024];
     uint8_t buf3[1024];
-    uint8_t buf4[10000];
+    uint8_t buf4[4096];
     uint32_t i, j;
     i = 0;
     if (0 != ece391_getargs (buf, 1024)) 
@@ -39,6 +74,9 @@ int main ()
     // ece391_fdputs (1, buf3);
     // ece391_fdputs (1, buf4);
     //
+    //share the blocks when both are regular files, they are copied on the first write
+    if (0 == ece391_fclone (buf2, buf3))
+        return 0;
     //open both files
     if (-1 == (fd1 = ece391_open (buf2))) 
     {
@@ -50,21 +88,42 @@ int main ()
         ece391_fdputs (1, (uint8_t*)"file not exists\n");
 	    return 2;
     }
-    //read the first file to a buf
-    if (0 != (cnt = ece391_read (fd1, buf4, 10000))) 
+    //batch the copy through the io ring when the length of the first file is known
+    length = ece391_lseek (fd1, 0, SEEK_END);
+    if (-1 != length && 0 == ece391_io_setup (&ring))
     {
-        if (-1 == cnt) 
-        {
-	    ece391_fdputs (1, (uint8_t*)"file read failed\n");
-	    return 3;
-        }
-        //write to the second file
-        if (-1 == ece391_write (fd2, buf4, cnt)) 
+        if (0 != ring_copy (ring, fd1, fd2, length))
         {
             ece391_fdputs (1, (uint8_t*)"file write failed\n");
             return 3;
+        }
+    }
+    else
+    {
+        if (-1 != length)
+            (void)ece391_lseek (fd1, 0, SEEK_SET);
+        //copy one block at a time; the second file is overwritten in place
+        while (0 != (cnt = ece391_read (fd1, buf4, 4096))) 
+        {
+            if (-1 == cnt) 
+            {
+                ece391_fdputs (1, (uint8_t*)"file read failed\n");
+                return 3;
+            }
+            //write to the second file
+            if (-1 == ece391_write (fd2, buf4, cnt)) 
+            {
+                ece391_fdputs (1, (uint8_t*)"file write failed\n");
+                return 3;
+            }
+        }
+    }
+    //drop the old tail of the second file
+    if (-1 == ece391_ioctl (IOCTL_TRUNCATE, fd2)) 
+    {
+        ece391_fdputs (1, (uint8_t*)"file write failed\n");
+        return 3;
     }
-	}
 
 
     return 0;
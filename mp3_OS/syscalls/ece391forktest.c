@@ -0,0 +1,44 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE 33
+
+static int32_t counter = 1;	/* in the data pages, shared until written */
+
+int main ()
+{
+    uint8_t buf[BUFSIZE];
+    int32_t* heap;
+    int32_t pid;
+
+    if (0 == (heap = ece391_malloc (sizeof (int32_t)))) {
+	ece391_fdputs (1, (uint8_t*)"malloc failed\n");
+	return 2;
+    }
+    *heap = 7;
+
+    if (-1 == (pid = ece391_fork ())) {
+	ece391_fdputs (1, (uint8_t*)"fork failed\n");
+	return 2;
+    }
+    if (0 == pid) {
+	/* each write gives the child its own copy of the page */
+	counter = 2;
+	*heap = 8;
+	if (2 != counter || 8 != *heap)
+	    return 3;
+	ece391_fdputs (1, (uint8_t*)"child: wrote its copies\n");
+	return 0;
+    }
+
+    if (1 != counter || 7 != *heap) {
+	ece391_fdputs (1, (uint8_t*)"parent memory changed by the child\n");
+	return 3;
+    }
+    ece391_fdputs (1, (uint8_t*)"fork ok, child pid ");
+    ece391_fdputs (1, ece391_itoa (pid, buf, 10));
+    ece391_fdputs (1, (uint8_t*)"\n");
+    return 0;
+}
@@ -5,14 +5,69 @@
 
 #define BUFSIZE 1024
 #define SBUFSIZE 33
+#define GREP_BATCH 16	/* files open at once */
+#define GREP_NAMES 64	/* the root holds at most 63 entries */
+
+struct grep_file {
+    uint8_t name[SBUFSIZE];
+    int32_t fd;
+    int32_t last;	/* bytes of a partial line kept at the start of data */
+    int32_t done;
+    uint8_t data[BUFSIZE+1];
+};
+
+static struct grep_file files[GREP_BATCH];
+static struct ece391_dirent ents[GREP_NAMES];
+
+/*
+ * Search the lines of data after cnt more bytes were read in behind the
+ * last partial line; a partial line at the end is moved to the start.
+ */
+void
+scan_lines (const char* s, int32_t s_len, const char* fname, uint8_t* data,
+	    int32_t* last, int32_t cnt)
+{
+    int32_t line_start, line_end, check;
+
+    *last += cnt;
+    line_start = 0;
+    while (1) {
+	line_end = line_start;
+	while (line_end < *last && '\n' != data[line_end])
+	    line_end++;
+	if ('\n' != data[line_end] && 0 != cnt && line_start != 0) {
+	    /* copy from line_start to last down to 0 and fix last */
+	    data[line_end] = '\0';
+	    ece391_strcpy (data, data + line_start);
+	    *last -= line_start;
+	    break;
+	}
+	/* search the line */
+	data[line_end] = '\0';
+	for (check = line_start; check < line_end; check++) {
+	    if (s[0] == data[check] &&
+		0 == ece391_strncmp ((uint8_t*)(data + check), (uint8_t*)s, s_len)) {
+		ece391_fdputs (1, (uint8_t*)fname);
+		ece391_fdputs (1, (uint8_t*)":");
+		ece391_fdputs (1, data + line_start);
+		ece391_fdputs (1, (uint8_t*)"\n");
+		break;
+	    }
+	}
+	line_start = line_end + 1;
+	if (line_start >= *last) {
+	    *last = 0;
+	    break;
+	}
+    }
+}
 
 int32_t
-do_one_file (const char* s, const char* fname) 
+do_one_file (const char* s, const char* fname)
 {
-    int32_t fd, cnt, last, line_start, line_end, check, s_len;
+    int32_t fd, cnt, last;
     uint8_t data[BUFSIZE+1];
 
-    s_len = ece391_strlen ((uint8_t*)s);
     if (-1 == (fd = ece391_open ((uint8_t*)fname))) {
         ece391_fdputs (1, (uint8_t*)"file open failed\n");
         return -1;
@@ -24,37 +79,7 @@ do_one_file (const char* s, const char* fname)
             ece391_fdputs (1, (uint8_t*)"file read failed\n");
             return -1;
 	}
-	last += cnt;
-	line_start = 0;
-	while (1) {
-	    line_end = line_start;
-	    while (line_end < last && '\n' != data[line_end])
-		line_end++;
-	    if ('\n' != data[line_end] && 0 != cnt && line_start != 0) {
-		/* copy from line_start to last down to 0 and fix last */
-		data[line_end] = '\0';
-		ece391_strcpy (data, data + line_start);
-		last -= line_start;
-		break;
-	    }
-	    /* search the line */
-	    data[line_end] = '\0';
-	    for (check = line_start; check < line_end; check++) {
-		if (s[0] == data[check] && 
-		    0 == ece391_strncmp ((uint8_t*)(data + check), (uint8_t*)s, s_len)) {
-		    ece391_fdputs (1, (uint8_t*)fname);
-		    ece391_fdputs (1, (uint8_t*)":");
-		    ece391_fdputs (1, data + line_start);
-		    ece391_fdputs (1, (uint8_t*)"\n");
-		    break;
-		}
-	    }
-	    line_start = line_end + 1;
-	    if (line_start >= last) {
-	        last = 0;
-		break;
-	    }
-	}
+	scan_lines (s, ece391_strlen ((uint8_t*)s), fname, data, &last, cnt);
 	if (0 == cnt)
 	    break;
     }
@@ -65,11 +90,76 @@ do_one_file (const char* s, const char* fname)
     return 0;
 }
 
+/*
+ * Search the first n files through the io ring: one trap opens them all,
+ * one trap per round reads the next piece of each, one trap closes them.
+ */
+int32_t
+do_batch (struct ece391_io_ring* ring, const char* s, int32_t n)
+{
+    struct ece391_cqe cqe;
+    struct grep_file* f;
+    int32_t i, active, ret, s_len;
+
+    s_len = ece391_strlen ((uint8_t*)s);
+    ret = 0;
+    for (i = 0; i < n; i++)
+	ece391_io_queue (ring, IO_OP_OPEN, 0, files[i].name, 0, 0, i);
+    ece391_io_enter (n);
+    active = 0;
+    while (0 == ece391_io_reap (ring, &cqe)) {
+	f = &files[cqe.user_data];
+	f->fd = cqe.result;
+	f->last = 0;
+	f->done = (-1 == cqe.result);
+	if (f->done) {
+	    ece391_fdputs (1, (uint8_t*)"file open failed\n");
+	    ret = -1;
+	} else {
+	    active++;
+	}
+    }
+
+    while (0 != active) {
+	for (i = 0; i < n; i++)
+	    if (!files[i].done)
+		ece391_io_queue (ring, IO_OP_READ, files[i].fd, files[i].data + files[i].last,
+				 BUFSIZE - files[i].last, 0, i);
+	ece391_io_enter (active);
+	while (0 == ece391_io_reap (ring, &cqe)) {
+	    f = &files[cqe.user_data];
+	    if (-1 == cqe.result) {
+		ece391_fdputs (1, (uint8_t*)"file read failed\n");
+		ret = -1;
+	    } else {
+		scan_lines (s, s_len, (char*)f->name, f->data, &f->last, cqe.result);
+	    }
+	    if (cqe.result <= 0) {
+		f->done = 1;
+		active--;
+	    }
+	}
+    }
+
+    active = 0;
+    for (i = 0; i < n; i++)
+	if (-1 != files[i].fd && 0 == ece391_io_queue (ring, IO_OP_CLOSE, files[i].fd, 0, 0, 0, i))
+	    active++;
+    ece391_io_enter (active);
+    while (0 == ece391_io_reap (ring, &cqe)) {
+	if (-1 == cqe.result) {
+	    ece391_fdputs (1, (uint8_t*)"file close failed\n");
+	    ret = -1;
+	}
+    }
+    return ret;
+}
+
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, n, i, j, batch;
     uint8_t search[BUFSIZE];
+    struct ece391_io_ring* ring;
 
     if (0 != ece391_getargs (search, BUFSIZE)) {
         ece391_fdputs (1, (uint8_t*)"could not read argument\n");
@@ -81,17 +171,42 @@ int main ()
 	return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    /* every name in one trap, then the fd is free for the files */
+    n = 0;
+    while (n < GREP_NAMES &&
+	   0 != (cnt = ece391_getdents (fd, ents + n, (GREP_NAMES - n) * sizeof (struct ece391_dirent)))) {
         if (-1 == cnt) {
 	    ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	    return 3;
 	}
-	if ('.' == buf[0]) /* a directory... */
+	n += cnt / sizeof (struct ece391_dirent);
+    }
+    (void)ece391_close (fd);
+
+    if (-1 == ece391_io_setup (&ring))
+	ring = 0;
+    batch = 0;
+    for (i = 0; i < n; i++) {
+	if ('.' == ents[i].name[0]) /* a directory... */
 	    continue;
-	buf[cnt] = '\0';
-	if (0 != do_one_file ((char*)search, (char*)buf))
-	    return 3;
+	if (2 != ents[i].type && 3 != ents[i].type) /* rtc or a subdirectory */
+	    continue;
+	for (j = 0; j < SBUFSIZE-1; j++)
+	    files[batch].name[j] = ents[i].name[j];
+	files[batch].name[SBUFSIZE-1] = '\0';
+	if (0 == ring) {
+	    if (0 != do_one_file ((char*)search, (char*)files[batch].name))
+		return 3;
+	    continue;
+	}
+	if (GREP_BATCH == ++batch) {
+	    if (0 != do_batch (ring, (char*)search, batch))
+		return 3;
+	    batch = 0;
+	}
     }
+    if (0 != batch && 0 != do_batch (ring, (char*)search, batch))
+	return 3;
 
     return 0;
 }
@@ -4,25 +4,40 @@
 #include "ece391syscall.h"
 
 #define SBUFSIZE 33
+#define DIRENT_BATCH 16
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, i, len;
+    uint8_t buf[SBUFSIZE + 1];         /* name, '/' and newline */
+    uint8_t path[128];
+    struct ece391_dirent ents[DIRENT_BATCH];
 
-    if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
+    /* list the directory given, the root by default */
+    if (0 != ece391_getargs (path, 128)) {
+        path[0] = '.';
+        path[1] = '\0';
+    }
+    if (-1 == (fd = ece391_open (path))) {
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
         return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    /* a batch of entries per call, directories are marked with '/' */
+    while (0 != (cnt = ece391_getdents (fd, ents, sizeof (ents)))) {
         if (-1 == cnt) {
 	        ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	        return 3;
 	    }
-	    buf[cnt] = '\n';
-	    if (-1 == ece391_write (1, buf, cnt + 1))
-	        return 3;
+	    for (i = 0; i < cnt / (int32_t)sizeof (ents[0]); i++) {
+	        for (len = 0; len < SBUFSIZE-1 && ents[i].name[len] != '\0'; len++)
+	            buf[len] = ents[i].name[len];
+	        if (1 == ents[i].type && !(1 == len && '.' == buf[0]))
+	            buf[len++] = '/';
+	        buf[len] = '\n';
+	        if (-1 == ece391_write (1, buf, len + 1))
+	            return 3;
+	    }
     }
 
     return 0;
@@ -0,0 +1,73 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE 33
+#define LIVE    64	/* blocks held at once */
+#define ROUNDS  500	/* allocate and free LIVE blocks this many times */
+#define TRAPS   4096	/* sbrk pairs in the trap per allocation run */
+
+static uint8_t* live[LIVE];
+
+/* low half of the time stamp counter, the runs stay well below 2^32 cycles */
+static uint32_t cycles (void)
+{
+    uint32_t lo, hi;
+
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return lo;
+}
+
+static void put_number (const char* label, uint32_t value)
+{
+    uint8_t buf[BUFSIZE];
+
+    ece391_fdputs (1, (uint8_t*)label);
+    ece391_fdputs (1, ece391_itoa (value, buf, 10));
+    ece391_fdputs (1, (uint8_t*)"\n");
+}
+
+int main ()
+{
+    uint32_t start, malloc_cycles, trap_cycles, size, i, j;
+
+    /* mixed sizes, mostly small, one page sized block per round */
+    start = cycles ();
+    for (i = 0; i < ROUNDS; i++) {
+	for (j = 0; j < LIVE; j++) {
+	    size = (0 == j) ? 6000 : 8 + ((i + j * 37) & 511);
+	    if (0 == (live[j] = ece391_malloc (size))) {
+		ece391_fdputs (1, (uint8_t*)"out of heap\n");
+		return 2;
+	    }
+	    live[j][0] = j;
+	    live[j][size - 1] = j;
+	}
+	for (j = 0; j < LIVE; j++) {
+	    size = (0 == j) ? 6000 : 8 + ((i + j * 37) & 511);
+	    if (live[j][0] != j || live[j][size - 1] != j) {
+		ece391_fdputs (1, (uint8_t*)"heap corrupted\n");
+		return 3;
+	    }
+	    ece391_free (live[j]);
+	}
+    }
+    malloc_cycles = cycles () - start;
+
+    /* the same work with one trap per allocation and one per free */
+    start = cycles ();
+    for (i = 0; i < TRAPS; i++) {
+	if (-1 == ece391_sbrk (64) || -1 == ece391_sbrk (-64)) {
+	    ece391_fdputs (1, (uint8_t*)"sbrk failed\n");
+	    return 2;
+	}
+    }
+    trap_cycles = cycles () - start;
+
+    put_number ("malloc/free pairs: ", ROUNDS * LIVE);
+    put_number ("cycles per pair: ", malloc_cycles / (ROUNDS * LIVE));
+    put_number ("sbrk traps taken: ", ece391_heap_grows);
+    put_number ("cycles per sbrk pair: ", trap_cycles / TRAPS);
+    return 0;
+}
@@ -22,7 +22,7 @@ int main ()
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
         return 2;
     }
-    if (-1 == ece391_write (fd, buf, -299)) {
+    if (-1 == ece391_write (fd, buf, DIR_WRITE_REMOVE)) {
         ece391_fdputs (1, (uint8_t*)"file remove fail\n");
         return 3;
     }
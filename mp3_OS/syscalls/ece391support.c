@@ -102,3 +102,122 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+
+/* Queue one submission on an io ring; -1 when the submission queue is full */
+int32_t ece391_io_queue(struct ece391_io_ring* ring, uint32_t opcode, int32_t fd,
+			void* buf, int32_t nbytes, uint32_t offset, uint32_t user_data)
+{
+    struct ece391_sqe* sqe;
+
+    if (ring->sq_tail - ring->sq_head >= IO_RING_SQ_SIZE)
+        return -1;
+    sqe = &ring->sq[ring->sq_tail & (IO_RING_SQ_SIZE - 1)];
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->buf = buf;
+    sqe->nbytes = nbytes;
+    sqe->offset = offset;
+    sqe->user_data = user_data;
+    ring->sq_tail++;
+    return 0;
+}
+
+/* Take the oldest completion off an io ring; -1 when there is none */
+int32_t ece391_io_reap(struct ece391_io_ring* ring, struct ece391_cqe* cqe)
+{
+    if (ring->cq_head == ring->cq_tail)
+        return -1;
+    *cqe = ring->cq[ring->cq_head & (IO_RING_CQ_SIZE - 1)];
+    ring->cq_head++;
+    return 0;
+}
+
+
+/*
+ * The heap allocator.  Small blocks come in size classes of 16 << k bytes,
+ * header included, each with its own free list; an empty list is refilled
+ * by carving one 4KB chunk from ece391_sbrk, so most calls never trap.
+ * Bigger blocks are whole pages, kept on one first-fit list once freed.
+ */
+#define MALLOC_MIN_SHIFT 4	/* the smallest class is 16 bytes */
+#define MALLOC_CLASSES   8	/* 16 .. 2048 */
+#define MALLOC_CHUNK     4096	/* bytes taken from the kernel per refill */
+
+struct ece391_block {
+    uint32_t size;		/* class index below MALLOC_CLASSES, else bytes */
+    struct ece391_block* next;	/* free lists only */
+};
+
+static struct ece391_block* free_class[MALLOC_CLASSES];
+static struct ece391_block* free_big;
+uint32_t ece391_heap_grows;	/* ece391_sbrk calls made by the allocator */
+
+static void* heap_grow(uint32_t size)
+{
+    int32_t old_brk = ece391_sbrk (size);
+
+    if (-1 == old_brk)
+        return 0;
+    ece391_heap_grows++;
+    return (void*)old_brk;
+}
+
+/* Allocate size bytes, 8 byte aligned; 0 when the heap is full */
+void* ece391_malloc(uint32_t size)
+{
+    struct ece391_block *b, **link;
+    uint8_t* chunk;
+    uint32_t k, bytes, i;
+
+    if (0 == size || size > 0x00400000)
+        return 0;
+    size += sizeof (struct ece391_block);
+    for (k = 0; k < MALLOC_CLASSES && (16U << k) < size; k++);
+
+    if (k < MALLOC_CLASSES) {
+        if (0 == free_class[k]) {
+            if (0 == (chunk = heap_grow (MALLOC_CHUNK)))
+                return 0;
+            bytes = 16U << k;
+            for (i = 0; i < MALLOC_CHUNK; i += bytes) {
+                b = (struct ece391_block*)(chunk + i);
+                b->size = k;
+                b->next = free_class[k];
+                free_class[k] = b;
+            }
+        }
+        b = free_class[k];
+        free_class[k] = b->next;
+        return b + 1;
+    }
+
+    bytes = (size + MALLOC_CHUNK - 1) & ~(MALLOC_CHUNK - 1);
+    for (link = &free_big; 0 != *link; link = &(*link)->next) {
+        if ((*link)->size >= bytes) {
+            b = *link;
+            *link = b->next;
+            return b + 1;
+        }
+    }
+    if (0 == (b = heap_grow (bytes)))
+        return 0;
+    b->size = bytes;
+    return b + 1;
+}
+
+/* Give back a block from ece391_malloc; 0 is ignored */
+void ece391_free(void* ptr)
+{
+    struct ece391_block* b;
+
+    if (0 == ptr)
+        return;
+    b = (struct ece391_block*)ptr - 1;
+    if (b->size < MALLOC_CLASSES) {
+        b->next = free_class[b->size];
+        free_class[b->size] = b;
+    } else {
+        b->next = free_big;
+        free_big = b;
+    }
+}
@@ -8,6 +8,14 @@ extern int32_t ece391_strcmp(const uint8_t* s1, const uint8_t* s2);
 extern int32_t ece391_strncmp(const uint8_t* s1, const uint8_t* s2, uint32_t n);
 extern uint8_t *ece391_itoa(uint32_t value, uint8_t* buf, int32_t radix);
 extern uint8_t *ece391_strrev(uint8_t* s);
+struct ece391_io_ring;
+struct ece391_cqe;
+extern int32_t ece391_io_queue(struct ece391_io_ring* ring, uint32_t opcode, int32_t fd,
+			       void* buf, int32_t nbytes, uint32_t offset, uint32_t user_data);
+extern int32_t ece391_io_reap(struct ece391_io_ring* ring, struct ece391_cqe* cqe);
+extern void* ece391_malloc(uint32_t size);
+extern void ece391_free(void* ptr);
+extern uint32_t ece391_heap_grows;
 
 #endif /* ECE391SUPPORT_H */
 
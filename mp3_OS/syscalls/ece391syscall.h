@@ -5,6 +5,8 @@
 
 /* All calls return >= 0 on success or -1 on failure. */
 
+struct ece391_io_ring;
+
 /*  
  * Note that the system call for halt will have to make sure that only
  * the low byte of EBX (the status argument) is returned to the calling
@@ -21,10 +23,84 @@ extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
-extern int32_t ece391_malloc (int32_t size);
-extern int32_t ece391_free (void* ptr);
+extern int32_t ece391_sbrk (int32_t increment);
+extern int32_t ece391_brk (void* addr);
 extern int32_t ece391_ioctl (unsigned long cmd, unsigned long arg);
+extern int32_t ece391_mmap (int32_t fd, uint8_t** start);
+extern int32_t ece391_getdents (int32_t fd, void* buf, int32_t nbytes);
+extern int32_t ece391_fclone (const uint8_t* src, const uint8_t* dst);
+extern int32_t ece391_lseek (int32_t fd, int32_t offset, int32_t whence);
+extern int32_t ece391_pread (int32_t fd, void* buf, int32_t nbytes, uint32_t offset);
+extern int32_t ece391_pwrite (int32_t fd, const void* buf, int32_t nbytes, uint32_t offset);
+extern int32_t ece391_io_setup (struct ece391_io_ring** ring);
+extern int32_t ece391_io_enter (int32_t to_submit);
+extern int32_t ece391_dup (int32_t fd);
+extern int32_t ece391_dup2 (int32_t fd, int32_t new_fd);
+extern int32_t ece391_fork (void);
+
+/* one record filled by ece391_getdents */
+struct ece391_dirent {
+	uint8_t  name[32];	/* NUL padded, not terminated at 32 bytes */
+	uint32_t type;		/* 0 rtc, 1 directory, 2 file, 3 compressed file */
+	uint32_t inode;
+	uint32_t length;
+};
+
+/*
+ * The io ring is one page shared with the kernel.  Queue submissions at
+ * sq_tail, then ece391_io_enter runs them in order, one trap for the lot,
+ * and posts a completion for each at cq_tail.  A later submission may use
+ * a buffer an earlier one fills.  The indexes run free; mask them with the
+ * queue size.
+ */
+#define IO_RING_SQ_SIZE 64
+#define IO_RING_CQ_SIZE 128
+
+enum io_ops {
+	IO_OP_NOP = 0,
+	IO_OP_READ,
+	IO_OP_WRITE,
+	IO_OP_OPEN,	/* buf is the file name, fd unused */
+	IO_OP_CLOSE,
+	IO_OP_PREAD,
+	IO_OP_PWRITE
+};
+
+struct ece391_sqe {
+	uint32_t opcode;
+	int32_t  fd;
+	void*    buf;
+	int32_t  nbytes;
+	uint32_t offset;	/* pread and pwrite only */
+	uint32_t user_data;	/* handed back in the completion */
+};
+
+struct ece391_cqe {
+	uint32_t user_data;
+	int32_t  result;	/* what the system call would have returned */
+};
+
+struct ece391_io_ring {
+	uint32_t sq_head;	/* moved by the kernel */
+	uint32_t sq_tail;	/* moved by the program */
+	uint32_t cq_head;	/* moved by the program */
+	uint32_t cq_tail;	/* moved by the kernel */
+	struct ece391_sqe sq[IO_RING_SQ_SIZE];
+	struct ece391_cqe cq[IO_RING_CQ_SIZE];
+};
 
+/*
+ * ece391_fork returns 0 in the child, which starts with the memory and
+ * the fds of its parent, the pages shared until one of them writes.  As
+ * with ece391_execute, the parent waits until the child halts and then
+ * gets its pid.
+ */
+
+/*
+ * The heap is a 4MB window starting empty at 0x08C00000.  ece391_sbrk
+ * returns the old break; the pages up to the new break read as zero on
+ * first touch.  ece391_malloc in the support library sits on top.
+ */
 
 enum signums {
 	DIV_ZERO = 0,
@@ -35,5 +111,24 @@ enum signums {
 	NUM_SIGNALS
 };
 
+/* ece391_lseek whence; a directory moves by entries, a file by bytes */
+enum seek_whence {
+	SEEK_SET = 0,
+	SEEK_CUR,
+	SEEK_END
+};
+
+/* ece391_write on a directory: nbytes below 0 selects the operation on the path */
+#define DIR_WRITE_REMOVE (-299)
+#define DIR_WRITE_MKDIR  (-298)
+
+/* ece391_ioctl commands; the file commands take the fd as the argument */
+enum ioctl_cmds {
+	IOCTL_PRINT_COLOR = 0,
+	IOCTL_SET_COLOR,
+	IOCTL_APPEND,
+	IOCTL_TRUNCATE
+};
+
 #endif /* ECE391SYSCALL_H */
 
@@ -11,8 +11,19 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
-#define SYS_MALLOC  11
-#define SYS_FREE    12
+#define SYS_SBRK    11
+#define SYS_BRK     12
 #define SYS_IOCTL   13
+#define SYS_MMAP    14
+#define SYS_GETDENTS 15
+#define SYS_FCLONE  16
+#define SYS_LSEEK   17
+#define SYS_PREAD   18
+#define SYS_PWRITE  19
+#define SYS_IO_SETUP 20
+#define SYS_IO_ENTER 21
+#define SYS_DUP     22
+#define SYS_DUP2    23
+#define SYS_FORK    24
 
 #endif /* ECE391SYSNUM_H */
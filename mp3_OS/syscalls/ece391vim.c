@@ -92,6 +92,9 @@ int main ()
     }
 
     vim_init();
+    for (i = 0; i < 32 && name[i] != '\0'; i++) {
+        filename[i] = name[i];
+    }
     ece391_vidmap((uint8_t**)(&screen));
     word_count = cnt;
 
@@ -209,7 +212,12 @@ int32_t save_file()
                 break;
         }
     }
+    /* rewind to write from the start, the blocks are reused in place; a
+       file created at startup has no fd yet */
+    if (-1 == ece391_lseek(fd, 0, SEEK_SET))
+        fd = ece391_open((uint8_t*)filename);
     ece391_write(fd, buf, word_count);
+    ece391_ioctl(IOCTL_TRUNCATE, fd);
 }
 
 void quit()
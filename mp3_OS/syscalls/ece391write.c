@@ -10,8 +10,9 @@ int main ()
     uint8_t buf2[128];
     uint8_t buf3[128];
     // uint8_t buf4[128];
-    uint32_t i, j, bytes_write;
+    uint32_t i, j, bytes_write, append;
     i = 0;
+    append = 0;
     if (0 != ece391_getargs (buf, 128)) 
     {
         ece391_fdputs (1, (uint8_t*)"could not read arguments\n");
@@ -20,15 +21,21 @@ int main ()
 
     //buf2 is the file name
     //buf3 is the string to write
+    //"-a" in front of the file name appends instead of replacing
+    if (buf[0] == '-' && buf[1] == 'a' && buf[2] == ' ')
+    {
+        append = 1;
+        i = 3;
+    }
 
     //sepate the two file name in the buf into buf2 and buf3
-    while (buf[i] != ' ')
+    for (j = 0; buf[i] != ' ' && buf[i] != '\0'; j++)
     {
-        buf2[i] = buf[i];
+        buf2[j] = buf[i];
         i++;
     }
-    buf2[i] = '\0';
-    i++;
+    buf2[j] = '\0';
+    if (buf[i] == ' ') i++;
     j=0;
     while (buf[i] != '\0')
     {
@@ -49,6 +56,11 @@ int main ()
 	    return 2;
     }
 
+    if (append && -1 == ece391_ioctl (IOCTL_APPEND, fd))
+    {
+        ece391_fdputs (1, (uint8_t*)"file write failed\n");
+        return 3;
+    }
     if (j==0) return 0;
     bytes_write = j;
     //write to the file
@@ -60,8 +72,12 @@ int main ()
 	    ece391_fdputs (1, (uint8_t*)"file write failed\n");
 	    return 3;
         }
-        //wrtie success
-        if (cnt >= 0) return 0;
+    }
+    //drop whatever the old contents had past the new end
+    if (!append && -1 == ece391_ioctl (IOCTL_TRUNCATE, fd))
+    {
+        ece391_fdputs (1, (uint8_t*)"file write failed\n");
+        return 3;
     }
     return 0;
 }